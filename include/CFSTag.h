@@ -100,7 +100,7 @@ struct CFSTag {
 
     // equality operator (only considers uid!)
     bool operator==(const CFSTag& rhs) const {
-      return static_cast<std::string>(rhs._uid) == static_cast<std::string>(_uid);
+      return memcmp(rhs._uid.uidByte, _uid.uidByte, 4) == 0;
     }
 
     // inequality operator
@@ -108,29 +108,46 @@ struct CFSTag {
       return !operator==(rhs);
     }
 
+    // detect a MIFARE classic tag in proximity
+    // returns true when a tag was found
+    bool detect(Adafruit_PN532* nfc);
+
+    // authenticate the detected tag (with the uid based key or the standard key)
+    // returns true on success
+    bool authenticate(Adafruit_PN532* nfc);
+
     // read spooldata from tag
     // returns true on success (still, the spool could be empty)
     bool readSpoolData(Adafruit_PN532* nfc);
 
     // write spooldata to tag
     // returns true on success
-    bool writeSpoolData(Adafruit_PN532* nfc, SpoolData spooldata);
+    bool writeSpoolData(Adafruit_PN532* nfc, const SpoolData& spooldata);
+
+    // read back the spooldata and compare it with what was written
+    // returns true on success
+    bool verifySpoolData(Adafruit_PN532* nfc, const SpoolData& spooldata);
 
     // get the uid
-    Uid getUid() {
+    const Uid& getUid() const {
       return _uid;
     }
 
     // get spooldata
-    SpoolData getSpooldata() {
+    const SpoolData& getSpooldata() const {
       return _spooldata;
     }
 
     // is the tag yet unwritten
-    bool isEmpty() {
+    bool isEmpty() const {
       return _empty;
     }
 
+    // is the tag encrypted with the uid based key
+    bool isEncrypted() const {
+      return _encrypted;
+    }
+
     // Default key
     static constexpr MIFARE_Key std_key = {{255, 255, 255, 255, 255, 255}};
     static constexpr AES128_Key u_key = {{113, 51, 98, 117, 94, 116, 49, 110, 113, 102, 90, 40, 112, 102, 36, 49}};
@@ -145,6 +162,13 @@ struct CFSTag {
     bool _empty = true;
     SpoolData _spooldata = SpoolData();
 
+    // cut off the padding of the spooldata (everything after the last non-zero numeric)
+    static std::string _trimSpooldata(std::string spooldataStr) {
+      size_t last = spooldataStr.find_last_of("123456789");
+      spooldataStr.erase(last == std::string::npos ? 0 : last + 1);
+      return spooldataStr;
+    }
+
     // decrypt a triple block of MIFARE data
     // returns true on success
     static bool decrypt(const MIFARE_tripleBlock& input, const MIFARE_tripleBlock& output) {
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ArduinoJson.h>
+#include <MycilaWebSerial.h>
+#include <RingBuffer.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include <atomic>
+#include <string.h>
+#include <type_traits>
+
+// records kept until the next drain (power of two)
+#ifndef LOG_DEFERRED_RECORDS
+  #define LOG_DEFERRED_RECORDS 64
+#endif
+// bytes for the arguments of a record (strings are copied, up to what fits)
+#ifndef LOG_DEFERRED_ARGS
+  #define LOG_DEFERRED_ARGS 64
+#endif
+#ifndef LOG_DEFERRED_MAX_ARGS
+  #define LOG_DEFERRED_MAX_ARGS 8
+#endif
+// longest formatted line
+#ifndef LOG_DEFERRED_LINE
+  #define LOG_DEFERRED_LINE 256
+#endif
+#ifndef LOG_DEFERRED_INTERVAL
+  #define LOG_DEFERRED_INTERVAL 100
+#endif
+
+// One log call: the format and tag as pointers (literals), the arguments as raw values
+struct LogRecord {
+  public:
+    enum class ArgType : uint8_t {
+      INT32,
+      INT64,
+      DOUBLE,
+      POINTER,
+      STRING, // copied, zero terminated
+      MISSING // didn't fit
+    };
+
+    const char* format = nullptr;
+    const char* tag = nullptr;
+    uint32_t millis = 0;
+    uint8_t level = 0;
+    uint8_t core = 0;
+    uint8_t argc = 0;
+    uint8_t length = 0; // bytes used in args
+    ArgType types[LOG_DEFERRED_MAX_ARGS];
+    uint8_t args[LOG_DEFERRED_ARGS];
+
+    template <typename T>
+    void add(T value) {
+      if constexpr (std::is_same<T, char*>::value || std::is_same<T, const char*>::value) {
+        _addString(value);
+      } else if constexpr (std::is_floating_point<T>::value) {
+        _add(ArgType::DOUBLE, static_cast<double>(value));
+      } else if constexpr (std::is_pointer<T>::value || std::is_null_pointer<T>::value) {
+        _add(ArgType::POINTER, static_cast<const void*>(value));
+      } else if constexpr (sizeof(T) > sizeof(int32_t)) {
+        _add(ArgType::INT64, static_cast<int64_t>(value));
+      } else {
+        // char, bool and enums are promoted to int anyway
+        _add(ArgType::INT32, static_cast<int32_t>(value));
+      }
+    }
+
+  private:
+    template <typename T>
+    void _add(ArgType type, T value) {
+      if (length + sizeof(T) > sizeof(args)) {
+        types[argc++] = ArgType::MISSING;
+        return;
+      }
+      memcpy(args + length, &value, sizeof(T));
+      length += sizeof(T);
+      types[argc++] = type;
+    }
+
+    void _addString(const char* value) {
+      if (value == nullptr)
+        value = "(null)";
+      if (length >= sizeof(args)) {
+        types[argc++] = ArgType::MISSING;
+        return;
+      }
+      size_t size = strnlen(value, sizeof(args) - length - 1);
+      memcpy(args + length, value, size);
+      args[length + size] = 0;
+      length += size + 1;
+      types[argc++] = ArgType::STRING;
+    }
+};
+
+// Deferred logging to WebSerial
+// - a log call only copies the format pointer and its arguments into a lock-free ring (no formatting, no allocation)
+// - the drain task formats the records only while WebSerial wants lines (a client is connected or
+//   there is a scrollback), otherwise they are discarded
+class DeferredLog {
+  public:
+    void begin(Scheduler* scheduler, WebSerial* webSerial);
+    void end();
+    // records above this level are skipped
+    void setLevel(uint8_t level) { _level = level; }
+
+    // record a log call (any task)
+    template <typename... Args>
+    void log(uint8_t level, const char* tag, const char* format, Args... args) {
+      static_assert(sizeof...(Args) <= LOG_DEFERRED_MAX_ARGS, "too many arguments for a deferred log record");
+      if (level > _level)
+        return;
+      size_t ticket;
+      LogRecord* record = _ring.reserve(ticket);
+      if (record == nullptr) {
+        _dropped++;
+        return;
+      }
+      record->format = format;
+      record->tag = tag;
+      record->millis = ::millis();
+      record->level = level;
+      record->core = xPortGetCoreID();
+      record->argc = 0;
+      record->length = 0;
+      (record->add(args), ...);
+      _ring.commit(ticket);
+    }
+
+    void reportMetrics(JsonObject metrics);
+
+  private:
+    void _drainCallback();
+    static size_t _format(const LogRecord& record, char* line, size_t size);
+    static char _levelLetter(uint8_t level);
+
+    Scheduler* _scheduler = nullptr;
+    Task* _drainTask = nullptr;
+    WebSerial* _webSerial = nullptr;
+    std::atomic<uint8_t> _level{ARDUHAL_LOG_LEVEL_DEBUG};
+    MPSCRingBuffer<LogRecord, LOG_DEFERRED_RECORDS> _ring;
+    std::atomic<uint32_t> _dropped{0};
+    std::atomic<uint32_t> _formatted{0};
+    std::atomic<uint32_t> _discarded{0};
+    std::atomic<uint32_t> _formatMicros{0};
+};
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#include <functional>
+
+// sliding window (power of 2), RAM is about 5x the window
+// matches in the material database are mostly further apart than 4k
+#ifndef DEFLATE_WINDOW
+  #define DEFLATE_WINDOW 8192
+#endif
+// how many earlier positions are tried for a match
+#ifndef DEFLATE_MAX_CHAIN
+  #define DEFLATE_MAX_CHAIN 32
+#endif
+#define DEFLATE_HASH_BITS 12
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+
+// Incremental gzip compression with a small fixed memory footprint
+// - LZ77 with hash chains over a sliding window, a single block with the fixed Huffman codes
+// - good enough for the (very repetitive) material database, which shrinks to a few percent
+// - input can be fed in pieces of any size, output is handed to the sink in small pieces
+class GzipDeflater {
+  public:
+    // called for each piece of output, return false to stop
+    typedef std::function<bool(const uint8_t* data, size_t len)> Sink;
+
+    ~GzipDeflater() { end(); }
+
+    // allocate buffers, false when out of memory
+    bool begin();
+    void end();
+
+    // compress the input, false when the sink failed
+    bool write(const uint8_t* data, size_t len, Sink sink);
+    // compress the remaining input and write the trailer
+    bool finish(Sink sink);
+
+    size_t getTotalIn() { return _totalIn; }
+    size_t getTotalOut() { return _totalOut; }
+    uint32_t getCRC() { return _crc; }
+
+  private:
+    void _compress(bool flush);
+    void _slide();
+    void _insert(size_t pos);
+    void _literal(uint8_t c);
+    void _match(size_t length, size_t distance);
+    void _bits(uint32_t bits, uint8_t count);
+    void _huffman(uint16_t code, uint8_t count);
+    void _byte(uint8_t c);
+    bool _drain();
+
+    uint8_t* _window = nullptr; // two windows: history and lookahead
+    uint16_t* _head = nullptr;  // latest position per hash (+1, 0 is none)
+    uint16_t* _prev = nullptr;  // previous position with the same hash (+1), per window slot
+    size_t _pos = 0;            // next position to compress
+    size_t _end = 0;            // end of the input in the window
+    uint32_t _bitBuffer = 0;
+    uint8_t _bitCount = 0;
+    uint8_t _out[256];
+    size_t _outLen = 0;
+    Sink* _sink = nullptr; // during write() and finish()
+    bool _sinkFailed = false;
+    uint32_t _crc = 0;
+    size_t _totalIn = 0;
+    size_t _totalOut = 0;
+};
@@ -11,6 +11,10 @@
 
 #include <string>
 
+#ifndef NTP_SERVER
+  #define NTP_SERVER "pool.ntp.org"
+#endif
+
 class EventHandler {
   public:
     explicit EventHandler(ESPNetwork& espNetwork) : _espNetwork(&espNetwork) { _srConnected.setWaiting(); }
@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <TagEventBus.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#define EVENT_STREAM_URL "/api/events"
+
+// events kept for resuming clients (power of two)
+#ifndef SSE_REPLAY_EVENTS
+  #define SSE_REPLAY_EVENTS 32
+#endif
+// events queued per client, the rest waits in the replay ring
+#ifndef SSE_CLIENT_MAX_QUEUE
+  #define SSE_CLIENT_MAX_QUEUE 4
+#endif
+#ifndef SSE_MAX_CLIENTS
+  #define SSE_MAX_CLIENTS 4
+#endif
+#ifndef SSE_FLUSH_INTERVAL
+  #define SSE_FLUSH_INTERVAL 100
+#endif
+// reconnect delay announced to the clients (ms)
+#ifndef SSE_RETRY
+  #define SSE_RETRY 2000
+#endif
+
+// One tag event as kept for the stream
+struct __attribute__((packed)) EventRecord {
+    uint32_t id = 0;
+    uint32_t uptime = 0;   // millis() when the event was posted
+    uint8_t uid[4] = {0};
+    TagEvent::Type type = TagEvent::Type::READ_DONE;
+    uint8_t success = 0;
+    uint8_t empty = 0;     // the tag is yet unwritten
+    char material[6] = {0};
+    uint32_t color = 0;
+    uint16_t weight = 0;   // in g
+};
+
+// Server-Sent Events stream of the tag events at /api/events
+// - events: arrived, left, read, write, error (compact JSON, one line each)
+// - the last SSE_REPLAY_EVENTS events are kept, reconnecting clients resume after their Last-Event-ID
+// - a "sync" event is sent when a client can't be resumed (new, restarted, or fell too far behind)
+// - every client has at most SSE_CLIENT_MAX_QUEUE events queued, slow clients catch up from the ring
+class EventStream {
+  public:
+    explicit EventStream(AsyncWebServer& webServer) : _webServer(&webServer) {}
+    void begin(Scheduler* scheduler);
+    void end();
+    void reportMetrics(JsonObject metrics);
+
+  private:
+    struct Client {
+        AsyncEventSourceClient* client = nullptr;
+        uint32_t lastId = 0; // from the Last-Event-ID header
+        uint32_t next = 0;   // the next event to send (0: not synced yet)
+    };
+
+    void _streamCallback();
+    void _tagEventCallback(const TagEvent& event);
+    void _flushCallback();
+    void _sync(Client& client);
+    bool _send(Client& client, const EventRecord& record);
+    static const char* _getEventName(TagEvent::Type type);
+
+    Scheduler* _scheduler = nullptr;
+    Task* _flushTask = nullptr;
+    AsyncWebServer* _webServer;
+    AsyncEventSource _events{EVENT_STREAM_URL};
+    bool _started = false;
+
+    // written and read in the loop task only
+    EventRecord _records[SSE_REPLAY_EVENTS];
+    uint32_t _nextId = 0;
+
+    // connected and disconnected in the AsyncTCP task
+    std::vector<Client> _clients;
+    std::mutex _clientsMutex;
+
+    std::atomic<uint32_t> _sent{0};
+    std::atomic<uint32_t> _resumed{0};
+    std::atomic<uint32_t> _synced{0};
+    std::atomic<uint32_t> _deferred{0};
+    std::atomic<uint32_t> _rejected{0};
+};
@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include <functional>
+
+// tinfl from the ROM
+#if CONFIG_IDF_TARGET_ESP32S2
+  #include <esp32s2/rom/miniz.h>
+#elif CONFIG_IDF_TARGET_ESP32S3
+  #include <esp32s3/rom/miniz.h>
+#else
+  #include <esp32/rom/miniz.h>
+#endif
+
+// Incremental gzip decompression with a fixed memory footprint (32k dictionary + decompressor)
+// - input can be fed in pieces of any size (e.g. while uploading)
+// - output is handed out in pieces pointing into the dictionary
+class GzipInflater {
+  public:
+    enum class Status : uint8_t {
+      NEED_MORE, // all input consumed, feed more
+      DONE,      // stream is complete and the trailer is valid
+      ERROR
+    };
+
+    // called for each piece of output, return false to stop
+    typedef std::function<bool(const uint8_t* data, size_t len)> Sink;
+
+    ~GzipInflater() { end(); }
+
+    // allocate buffers, false when out of memory
+    bool begin();
+    void end();
+
+    // consume some input and make the next piece of output available
+    // in and inLen are advanced by the consumed input
+    Status step(const uint8_t*& in, size_t& inLen, const uint8_t*& out, size_t& outLen);
+
+    // consume all input, handing the output to sink
+    Status write(const uint8_t* data, size_t len, Sink sink);
+
+    Status getStatus() { return _status; }
+    size_t getTotalOut() { return _totalOut; }
+    uint32_t getCRC() { return _crc; }
+
+  private:
+    enum class Phase : uint8_t {
+      HEADER,
+      EXTRA_LEN,
+      EXTRA,
+      NAME,
+      COMMENT,
+      HCRC,
+      DEFLATE,
+      TRAILER,
+      FINISHED
+    };
+    bool _header(uint8_t c);
+    tinfl_decompressor* _decompressor = nullptr;
+    uint8_t* _dict = nullptr;
+    size_t _dictOffset = 0;
+    Phase _phase = Phase::HEADER;
+    Status _status = Status::NEED_MORE;
+    uint8_t _flags = 0;
+    size_t _count = 0;
+    size_t _skip = 0;
+    uint8_t _trailer[8];
+    uint32_t _crc = 0;
+    size_t _totalOut = 0;
+};
+
+// Read the decompressed content of a gzipped file as Stream (e.g. for deserializeJson)
+class InflateStream : public Stream {
+  public:
+    explicit InflateStream(File& file) : _file(&file) { setTimeout(0); }
+    bool begin() { return _inflater.begin(); }
+    void end() { _inflater.end(); }
+    GzipInflater::Status getStatus() { return _inflater.getStatus(); }
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t readBytes(char* buffer, size_t length) override;
+    size_t write(__unused uint8_t c) override { return 0; }
+
+  private:
+    bool _fill();
+    File* _file;
+    GzipInflater _inflater;
+    uint8_t _in[512];
+    const uint8_t* _inNext = _in;
+    size_t _inLen = 0;
+    const uint8_t* _out = nullptr;
+    size_t _outLen = 0;
+};
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ESPAsyncWebServer.h>
+#include <TagEventBus.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef INVENTORY_MAX_ENTRIES
+  #define INVENTORY_MAX_ENTRIES 1024
+#endif
+#ifndef INVENTORY_PENDING_RECORDS
+  #define INVENTORY_PENDING_RECORDS 16
+#endif
+#ifndef INVENTORY_FLUSH_INTERVAL
+  #define INVENTORY_FLUSH_INTERVAL 30000
+#endif
+// how often the loop task checks for a merge asked for by the webserver (ms)
+#ifndef INVENTORY_FLUSH_POLL
+  #define INVENTORY_FLUSH_POLL 500
+#endif
+// records scanned per chunk of a listing (the lock is released in between)
+#ifndef INVENTORY_SCAN_BATCH
+  #define INVENTORY_SCAN_BATCH 32
+#endif
+#ifndef INVENTORY_PAGE_LIMIT
+  #define INVENTORY_PAGE_LIMIT 50
+#endif
+
+#define INVENTORY_FILE "/inventory.bin"
+#define INVENTORY_TMP_FILE "/inventory.tmp"
+
+// One spool of the inventory, the file holds these sorted by uid
+struct __attribute__((packed)) InventoryRecord {
+    uint8_t uid[4] = {0};
+    uint32_t firstSeen = 0;   // unix time in s (0 when the time wasn't synced yet)
+    uint32_t lastSeen = 0;    // unix time in s
+    uint16_t reads = 0;
+    uint16_t writes = 0;
+    uint16_t weight = 0;      // weight on the tag (in g)
+    uint16_t remaining = 0;   // estimated remaining weight (in g)
+    char spooldata[44] = {0}; // spooldata as on the tag (not zero terminated when full)
+
+    // sort key (same order as the uid string)
+    uint32_t key() const { return key(uid); }
+    static uint32_t key(const uint8_t* uid) { return (uid[0] << 24) | (uid[1] << 16) | (uid[2] << 8) | uid[3]; }
+};
+static_assert(sizeof(InventoryRecord) == 64, "InventoryRecord should fill 64 bytes");
+
+// Inventory of all spools seen by the reader, keyed by uid
+// - the file on LittleFS is kept sorted, only the uids are held in RAM for the lookup
+// - changes are collected in a small sorted buffer and merged into the file in batches
+class Inventory {
+  public:
+    explicit Inventory(AsyncWebServer& webServer) : _webServer(&webServer) {}
+    void begin(Scheduler* scheduler);
+    void end();
+    // merge pending changes into the file
+    void flush();
+    // get the entry for a uid, false if unknown
+    bool find(uint32_t key, InventoryRecord& record);
+    size_t size();
+
+  private:
+    void _inventoryCallback();
+    void _tagEventCallback(const TagEvent& event);
+    void _flushCallback();
+    void _loadIndex();
+    bool _updateLocked(const InventoryRecord& record, bool flush = true);
+    bool _findLocked(uint32_t key, InventoryRecord& record);
+    bool _readRecord(File& file, size_t position, InventoryRecord& record);
+    bool _nextLocked(File& file, uint32_t after, bool first, InventoryRecord& record);
+    void _flushLocked();
+    void _handleGet(AsyncWebServerRequest* request);
+    void _handlePost(AsyncWebServerRequest* request);
+    Scheduler* _scheduler = nullptr;
+    Task* _flushTask = nullptr;
+    AsyncWebServer* _webServer;
+    AsyncCallbackWebHandler* _getHandler = nullptr;
+    AsyncCallbackWebHandler* _postHandler = nullptr;
+    bool _ready = false;
+    uint32_t _lastFlush = 0;
+    std::atomic<bool> _flushWanted{false}; // the pending buffer ran full in the webserver
+
+    // shared between the loop task and the webserver
+    std::mutex _mutex;
+    std::vector<uint32_t> _index;                         // sorted keys, position in the file
+    InventoryRecord _pending[INVENTORY_PENDING_RECORDS]; // sorted by key
+    size_t _pendingCount = 0;
+    size_t _newCount = 0;                                 // pending entries not yet in the file
+    uint32_t _generation = 0;                             // counts replacements of the file
+
+    // streaming of entries (per request)
+    struct Reader {
+        enum class Phase : uint8_t {
+          HEADER,
+          ENTRIES,
+          TRAILER,
+          DONE
+        };
+        Phase phase = Phase::HEADER;
+        uint32_t after = 0;
+        bool first = true;
+        uint32_t limit = INVENTORY_PAGE_LIMIT;
+        uint32_t count = 0;
+        bool exhausted = false;
+        std::string type = "";
+        uint32_t color = 0;
+        bool filterColor = false;
+        std::string line;
+        size_t offset = 0;
+        File file; // open for the whole listing, reopened when the file was replaced
+        uint32_t generation = 0;
+    };
+    size_t _fill(Reader& reader, uint8_t* buffer, size_t maxLen);
+    bool _nextLine(Reader& reader);
+    static bool _match(const Reader& reader, const InventoryRecord& record);
+    static void _toJson(const InventoryRecord& record, const JsonObject& entry);
+};
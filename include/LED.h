@@ -4,16 +4,42 @@
  */
 #pragma once
 
+#include <ArduinoJson.h>
 #include <FastLED.h>
+#include <TagEventBus.h>
 #include <TaskSchedulerDeclarations.h>
 #include <thingy.h>
 
+#include <atomic>
+
 #if defined(RGB_BUILTIN) || defined(RGB_EXTERNAL)
   #define IS_RGB true
 #else
   #define IS_RGB false
 #endif
 
+// run the effects in hardware: LEDC fades for plain LEDs, pre-rendered RMT periods for RGB LEDs
+// (0: the task steps every keyframe)
+#ifndef LED_HW_EFFECTS
+  #define LED_HW_EFFECTS 1
+#endif
+// keyframes covered by a single LEDC fade
+#ifndef LED_FADE_STEPS
+  #define LED_FADE_STEPS 5
+#endif
+// RMT memory blocks for the RGB LED (a larger block means less refill interrupts)
+#ifndef LED_RMT_MEM_BLOCKS
+  #if SOC_RMT_TX_CANDIDATES_PER_GROUP > 2
+    #define LED_RMT_MEM_BLOCKS 4
+  #else
+    #define LED_RMT_MEM_BLOCKS 2
+  #endif
+#endif
+// a rendered period ends this early (ms), so it's done when the task sends it again
+#ifndef LED_RMT_REARM_MARGIN
+  #define LED_RMT_REARM_MARGIN 2
+#endif
+
 class LED {
   public:
     enum class LEDMode {
@@ -36,16 +62,64 @@ class LED {
 #endif
     void begin(Scheduler* scheduler);
     void end();
+    // one-shot modes (TAG_READ, TAG_WRITTEN, TAG_REWRITTEN) return to the mode set before
     void setMode(LEDMode mode);
 
+    void reportMetrics(JsonObject metrics);
+
+    // A mode as keyframes, stepped by the animation task
+    struct Animation {
+        const uint8_t* levels; // brightness per keyframe
+        uint8_t count;         // keyframes
+        uint8_t stride;        // keyframes advanced per step
+        uint16_t interval;     // ms per step
+        uint8_t hue;           // color of RGB LEDs
+        uint8_t sat;
+        bool fade;             // changes smoothly between keyframes
+        bool oneShot;          // returns to the previous mode after the last keyframe
+    };
+
+    // who runs the effects
+    enum class Backend : uint8_t {
+      SOFTWARE,  // the task writes every keyframe
+      LEDC_FADE, // the task starts a hardware fade for LED_FADE_STEPS keyframes
+      RMT        // the task sends a pre-rendered period (RGB LEDs)
+    };
+
   private:
     int _ledPin;
     bool _isRGB;
     Scheduler* _scheduler = nullptr;
     Task* _ledTask = nullptr;
-    uint8_t _ledState = 0;
+    const Animation* _animation = nullptr;
+    uint8_t _frame = 0;
+    Backend _backend = Backend::SOFTWARE;
+    rmt_data_t* _symbols = nullptr; // the rendered period
+    size_t _symbolCount = 0;
     void _ledInitCallback();
+    void _animationCallback();
+    void _tagEventCallback(const TagEvent& event);
+    void _start();
+    uint8_t _steps() const;
+    void _show(uint8_t brightness, uint8_t steps);
+    CRGB _color(uint8_t brightness) const;
+    int _rmtPin() const;
+    void _render();
+    size_t _renderFrame(rmt_data_t* symbols, uint8_t brightness, uint32_t idleTicks) const;
+    bool _transmit();
+    void _countWakeups(uint32_t wakeups) { _wakeups[static_cast<uint8_t>(_mode)] += wakeups; }
+    void _account(uint32_t now);
+    static const char* _getModeName(LEDMode mode);
+    static const char* _getBackendName(Backend backend);
     LEDMode _mode = LEDMode::WAITING_WIFI;
+    LEDMode _baseMode = LEDMode::NONE; // where one-shot modes return to
+
+    // task runs and interrupts per mode, and the time spent in it
+    static constexpr size_t MODES = static_cast<size_t>(LEDMode::ERROR) + 1;
+    std::atomic<uint32_t> _wakeups[MODES] = {};
+    std::atomic<uint32_t> _modeMillis[MODES] = {};
+    std::atomic<uint32_t> _modeSince{0};
+    std::atomic<uint32_t> _rmtRestarts{0}; // periods stopped by creating the channel again
 #ifdef COLOR_CORR_SCALE
     CRGB _colorAdjustment = CRGB::computeAdjustment(COLOR_CORR_SCALE, CRGB(COLOR_CORR_R, COLOR_CORR_G, COLOR_CORR_B), CRGB(UncorrectedTemperature));
     static void _adjustLed(CRGB* led, const CRGB& adjustment) {
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ArduinoJson.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include <atomic>
+
+// messages logged per call site and window, the rest is counted only (0: no limit)
+#ifndef LOG_RATE_BURST
+  #define LOG_RATE_BURST 3
+#endif
+// window in ms
+#ifndef LOG_RATE_WINDOW
+  #define LOG_RATE_WINDOW 10000
+#endif
+
+// The state of a single log call site (a static in the LOGx macros)
+// - up to LOG_RATE_BURST messages per window are logged, the others are suppressed
+// - the suppressed messages are summarized as "repeated N times" with the next message of the window after,
+//   or by LogRateLimiter when the call site went quiet
+// - call sites logging different data each time (tag reads, dumps) use LOGD_UNLIMITED/LOGI_UNLIMITED instead
+class LogRateLimit {
+  public:
+    constexpr LogRateLimit(uint8_t level, const char* tag, const char* format) : level(level), tag(tag), format(format) {}
+
+    // true when the message is to be logged
+    // repeated is the number of messages suppressed before (to be summarized first)
+    bool allow(uint32_t& repeated);
+
+    // hand over the messages suppressed in an expired window
+    uint32_t expired(uint32_t now);
+
+    const uint8_t level;
+    const char* const tag;
+    const char* const format;
+    LogRateLimit* next = nullptr; // in the list of LogRateLimiter
+
+  private:
+    std::atomic<uint32_t> _windowStart{0};
+    std::atomic<uint32_t> _count{0};
+    std::atomic<uint32_t> _suppressed{0};
+    std::atomic<bool> _listed{false};
+};
+
+// Keeps the call sites which have suppressed messages
+// and summarizes them when they went quiet for a window (in the loop task)
+class LogRateLimiter {
+  public:
+    void begin(Scheduler* scheduler);
+    void end();
+
+    // any task, a call site is added once and never removed (it's a static)
+    void add(LogRateLimit* site);
+    void countSuppressed() { _suppressed++; }
+    void countSummary() { _summaries++; }
+
+    void reportMetrics(JsonObject metrics);
+
+  private:
+    void _sweepCallback();
+
+    Scheduler* _scheduler = nullptr;
+    Task* _sweepTask = nullptr;
+    std::atomic<LogRateLimit*> _sites{nullptr};
+    std::atomic<uint32_t> _siteCount{0};
+    std::atomic<uint32_t> _suppressed{0};
+    std::atomic<uint32_t> _summaries{0};
+};
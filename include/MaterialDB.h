@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <MaterialDBValidator.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#define MATERIAL_DB_URL "/material_database.json"
+#define MATERIAL_DB_FILE "/material_database.json.gz"
+#define MATERIAL_DB_TMP_FILE "/material_database.tmp"
+#define MATERIAL_INDEX_FILE "/materials.idx"
+#define MATERIAL_INDEX_MAGIC 0x494d324b // "K2MI"
+#define MATERIAL_INDEX_FORMAT 1
+#define MATERIAL_MAX_COLORS 4
+
+// uploads are written in blocks of this size (a LittleFS block), 0 writes every chunk directly
+// (the throughput of both is reported as materialDB.lastUpload.kBps)
+#ifndef MATERIAL_UPLOAD_BUFFER
+  #define MATERIAL_UPLOAD_BUFFER 4096
+#endif
+
+// Compact index of the material database (just what the website needs)
+struct __attribute__((packed)) MaterialIndexHeader {
+    uint32_t magic = MATERIAL_INDEX_MAGIC;
+    uint8_t format = MATERIAL_INDEX_FORMAT;
+    uint8_t reserved = 0;
+    uint16_t count = 0;
+    uint32_t dbCRC = 0;  // CRC32 of the uncompressed database (from the gzip trailer)
+    uint32_t dbSize = 0; // size of the uncompressed database
+    int64_t version = 0; // result.version of the database
+};
+
+struct __attribute__((packed)) MaterialIndexEntry {
+    char id[8] = {0};
+    char brand[24] = {0};
+    char name[48] = {0};
+    char type[16] = {0};
+    uint8_t colorCount = 0;
+    uint8_t reserved[3] = {0};
+    uint32_t colors[MATERIAL_MAX_COLORS] = {0};
+    int16_t minTemp = 0;
+    int16_t maxTemp = 0;
+};
+
+class MaterialDB {
+  public:
+    typedef std::function<void()> IndexCallback;
+
+    explicit MaterialDB(AsyncWebServer& webServer) : _webServer(&webServer) {}
+    void begin(Scheduler* scheduler);
+    void end();
+    // rebuild the index from the database (can be called from any task)
+    void requestRebuild() { _rebuildRequested = true; }
+    // get notified when the index was rebuilt (in the loop task)
+    void onIndexChanged(IndexCallback callback) { _indexCallback = callback; }
+    int64_t getVersion() { return _version; }
+    // strong ETag of the gzipped database (empty without database)
+    const char* getETag() { return _etag; }
+
+    // upload of a new gzipped database (in the AsyncTCP task)
+    // the data is validated while it is received and only replaces the database when valid
+    void handleUpload(AsyncWebServerRequest* request, size_t index, uint8_t* data, size_t len, bool final);
+    void finishUpload(AsyncWebServerRequest* request);
+    // replace the database by a validated file (in the AsyncTCP task), the index is rebuilt
+    bool replaceDatabase(const char* path);
+    // add upload throughput to metrics
+    void reportMetrics(const JsonObject& metrics);
+
+  private:
+    void _materialDBCallback();
+    void _rebuildCallback();
+    bool _isIndexCurrent();
+    bool _buildIndex();
+    void _handleRequest(AsyncWebServerRequest* request);
+    void _handleDownload(AsyncWebServerRequest* request);
+    void _hashDatabase();
+    void _setETag(uint32_t crc, size_t size);
+    static bool _readTrailer(uint32_t& crc, uint32_t& size);
+    struct Upload {
+        ~Upload();
+        // write through the block buffer, false on error
+        bool write(const uint8_t* data, size_t len);
+        bool flush();
+        AsyncWebServerRequest* request = nullptr;
+        File file;
+        MaterialDBValidator validator;
+        uint8_t* buffer = nullptr;
+        size_t buffered = 0;
+        size_t size = 0;
+        uint32_t crc = 0; // CRC32 of the gzipped data, for the ETag
+        uint32_t writes = 0;
+        uint32_t start = 0;
+        bool done = false;
+        bool valid = false;
+        bool rejected = false; // the validator couldn't start, the data is ignored
+    };
+    std::unique_ptr<Upload> _upload;
+
+    // last upload
+    struct UploadStats {
+        uint32_t size = 0;
+        uint32_t duration = 0;
+        uint32_t writes = 0;
+    };
+    UploadStats _uploadStats;
+    Scheduler* _scheduler = nullptr;
+    Task* _rebuildTask = nullptr;
+    AsyncWebServer* _webServer;
+    AsyncCallbackWebHandler* _handler = nullptr;
+    AsyncCallbackWebHandler* _downloadHandler = nullptr;
+    IndexCallback _indexCallback = nullptr;
+    std::atomic<bool> _rebuildRequested{false};
+    int64_t _version = 0;
+    char _etag[24] = {0};
+};
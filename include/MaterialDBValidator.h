@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <Inflater.h>
+
+#define VALIDATOR_MAX_DEPTH 32
+#define VALIDATOR_KEY_LEVELS 6
+#define VALIDATOR_KEY_LENGTH 16
+
+// Validate a gzipped material database while it is being received
+// - the data is inflated and run through a push-style JSON tokenizer byte by byte
+// - only the structure needed by the firmware and the website is checked:
+//   {"result": {"list": [{"base": {"id": "..."}}, ...], "count": n, "version": v}}
+// - RAM is bounded (inflater plus a few hundred bytes), independent of the database size
+// - plain JSON can be checked as well (e.g. while downloading from the printer)
+class MaterialDBValidator {
+  public:
+    bool begin(bool gzipped = true);
+    void end() { _inflater.end(); }
+    // feed the next piece of the (gzipped) database, false when it's invalid
+    bool write(const uint8_t* data, size_t len);
+    // all data received, false when it's incomplete or invalid
+    bool finish();
+
+    const char* getError() { return _error; }
+    int64_t getVersion() { return _version; }
+    uint32_t getEntries() { return _entries; }
+    size_t getSize() { return _gzipped ? _inflater.getTotalOut() : _size; }
+
+  private:
+    enum class Token : uint8_t {
+      VALUE,
+      KEY_OR_END,
+      KEY,
+      COLON,
+      NEXT_OR_END,
+      STRING,
+      ESCAPE,
+      UNICODE,
+      NUMBER,
+      LITERAL,
+      DONE
+    };
+
+    // known keys and values along the checked path
+    enum class Key : uint8_t {
+      OTHER,
+      RESULT,
+      LIST,
+      COUNT,
+      VERSION,
+      BASE,
+      ID
+    };
+    enum class Role : uint8_t {
+      OTHER,
+      ROOT,
+      RESULT,
+      LIST,
+      COUNT,
+      VERSION,
+      ENTRY,
+      BASE,
+      ID
+    };
+
+    bool _fail(const char* error);
+    bool _parse(char c);
+    bool _beginValue(char c);
+    bool _endValue();
+    bool _open(bool array, Role role);
+    bool _close(bool array);
+    Role _role();
+    static Key _key(const char* key);
+
+    GzipInflater _inflater;
+    bool _gzipped = true;
+    size_t _size = 0;
+    const char* _error = nullptr;
+    Token _token = Token::VALUE;
+    uint8_t _depth = 0;
+    uint32_t _arrays = 0; // bit per level: container is an array
+    Key _keys[VALIDATOR_KEY_LEVELS];
+    Role _roles[VALIDATOR_KEY_LEVELS];
+    bool _isKey = false;
+    bool _justOpened = false;
+    Role _valueRole = Role::OTHER;
+    char _keyBuffer[VALIDATOR_KEY_LENGTH + 1];
+    size_t _keyLength = 0;
+    uint8_t _unicode = 0;
+    const char* _literal = nullptr;
+    int64_t _number = 0;
+    bool _negative = false;
+    bool _fraction = false;
+
+    // what was found
+    bool _hasResult = false;
+    bool _hasList = false;
+    bool _hasCount = false;
+    bool _hasVersion = false;
+    bool _entryHasBase = false;
+    bool _entryHasId = false;
+    int64_t _version = 0;
+    int64_t _count = 0;
+    uint32_t _entries = 0;
+};
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <AsyncTCP.h>
+#include <Deflater.h>
+#include <ESPAsyncWebServer.h>
+#include <LittleFS.h>
+#include <MaterialDBValidator.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include <atomic>
+
+#define MATERIAL_SYNC_PATH "/downloads/defData/material_database.json"
+#define MATERIAL_SYNC_TMP_FILE "/material_sync.tmp"
+#define MATERIAL_SYNC_LINE_LENGTH 128
+
+// port of the printer's webserver
+#ifndef MATERIAL_SYNC_PORT
+  #define MATERIAL_SYNC_PORT 80
+#endif
+// give up when the printer doesn't send anything for this long (s)
+#ifndef MATERIAL_SYNC_TIMEOUT
+  #define MATERIAL_SYNC_TIMEOUT 10
+#endif
+
+// Fetch the material database directly from the printer
+// - plain HTTP/1.0 GET with a non-blocking client (in the AsyncTCP task)
+// - the JSON is validated and gzipped on the fly into a temp file, the database is only replaced when valid
+// - a conditional request (ETag / Last-Modified of the last sync) and result.version avoid needless updates
+class MaterialSync {
+  public:
+    enum class State : uint8_t {
+      IDLE,
+      CONNECTING,
+      RECEIVING,
+      UPDATED,
+      UNCHANGED,
+      FAILED
+    };
+
+    explicit MaterialSync(AsyncWebServer& webServer) : _webServer(&webServer) {}
+    void begin(Scheduler* scheduler);
+    void end();
+    // start fetching from the printer (in the AsyncTCP task), false when a sync is running already
+    bool start(const String& host, uint16_t port = MATERIAL_SYNC_PORT);
+    State getState() { return _state; }
+    static const char* getStateName(State state);
+
+  private:
+    void _syncCallback();
+    void _handleStart(AsyncWebServerRequest* request);
+    void _handleStatus(AsyncWebServerRequest* request);
+    void _onConnect();
+    void _onData(const uint8_t* data, size_t len);
+    void _onDisconnect();
+    bool _onLine(const char* line);
+    bool _onBody(const uint8_t* data, size_t len);
+    bool _store(const uint8_t* data, size_t len);
+    bool _flush();
+    void _complete();
+    void _fail(const char* error);
+    void _cleanup();
+
+    Scheduler* _scheduler = nullptr;
+    AsyncWebServer* _webServer;
+    AsyncCallbackWebHandler* _startHandler = nullptr;
+    AsyncCallbackWebHandler* _statusHandler = nullptr;
+    std::atomic<State> _state{State::IDLE};
+    const char* _error = nullptr;
+
+    // the running sync
+    AsyncClient* _client = nullptr;
+    String _host;
+    uint16_t _port = MATERIAL_SYNC_PORT;
+    char _line[MATERIAL_SYNC_LINE_LENGTH + 1];
+    size_t _lineLength = 0;
+    bool _statusLine = true;
+    bool _inBody = false;
+    int _httpStatus = 0;
+    int32_t _contentLength = -1;
+    String _remoteETag;
+    String _remoteModified;
+    MaterialDBValidator _validator;
+    GzipDeflater _deflater;
+    File _file;
+    uint8_t* _buffer = nullptr;
+    size_t _buffered = 0;
+
+    // results of the last sync
+    uint32_t _start = 0;
+    uint32_t _duration = 0;
+    size_t _received = 0;
+    size_t _stored = 0;
+    int64_t _version = 0;
+};
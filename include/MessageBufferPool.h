@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// buffers kept for reuse
+#ifndef WS_BUFFER_POOL_SIZE
+  #define WS_BUFFER_POOL_SIZE 4
+#endif
+// larger buffers go back to the heap
+#ifndef WS_BUFFER_POOL_MAX
+  #define WS_BUFFER_POOL_MAX 1024
+#endif
+
+// Pool of websocket message buffers
+// - a message is serialized once per event into a buffer shared (ref-counted) by all clients
+// - when the last client has sent it, the buffer goes back into the pool instead of the heap
+// - counts the heap allocations for the messages (buffers and their JsonDocuments) per event
+class MessageBufferPool {
+  public:
+    ~MessageBufferPool();
+    // a buffer of exactly length bytes (can be called from any task)
+    AsyncWebSocketSharedBuffer get(size_t length);
+    // allocator for the JsonDocuments of the messages, counts their heap use
+    ArduinoJson::Allocator* getAllocator() { return &_jsonAllocator; }
+    // a message was built for sending
+    void countEvent() { _events++; }
+    void reportMetrics(JsonObject metrics);
+
+  private:
+    // counts the memory of JsonDocuments
+    class JsonAllocator : public ArduinoJson::Allocator {
+      public:
+        explicit JsonAllocator(MessageBufferPool* pool) : _pool(pool) {}
+        void* allocate(size_t size) override;
+        void deallocate(void* pointer) override;
+        void* reallocate(void* pointer, size_t newSize) override;
+
+      private:
+        MessageBufferPool* _pool;
+    };
+
+    // counts the control blocks of the shared buffers
+    template <typename T>
+    struct ControlAllocator {
+        using value_type = T;
+        MessageBufferPool* pool;
+        explicit ControlAllocator(MessageBufferPool* p) : pool(p) {}
+        template <typename U>
+        ControlAllocator(const ControlAllocator<U>& other) : pool(other.pool) {}
+        T* allocate(size_t n) {
+          pool->_countAllocation(n * sizeof(T));
+          return std::allocator<T>().allocate(n);
+        }
+        void deallocate(T* pointer, size_t n) { std::allocator<T>().deallocate(pointer, n); }
+        template <typename U>
+        bool operator==(const ControlAllocator<U>& other) const { return pool == other.pool; }
+        template <typename U>
+        bool operator!=(const ControlAllocator<U>& other) const { return pool != other.pool; }
+    };
+
+    void _release(std::vector<uint8_t>* buffer);
+    void _countAllocation(size_t size) {
+      _allocations++;
+      _allocatedBytes += size;
+    }
+
+    JsonAllocator _jsonAllocator{this};
+    std::vector<std::vector<uint8_t>*> _free;
+    std::mutex _mutex;
+    std::atomic<uint32_t> _events{0};
+    std::atomic<uint32_t> _allocations{0};
+    std::atomic<uint32_t> _allocatedBytes{0};
+    std::atomic<uint32_t> _reused{0};
+};
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#include <atomic>
+#include <functional>
+
+#ifndef WS_MAX_HANDLERS
+  #define WS_MAX_HANDLERS 8
+#endif
+// larger messages are rejected unparsed
+#ifndef WS_MAX_MESSAGE_SIZE
+  #define WS_MAX_MESSAGE_SIZE 1024
+#endif
+#ifndef WS_MAX_NESTING
+  #define WS_MAX_NESTING 3
+#endif
+
+// The type of a message, hashed (FNV-1a) at compile time
+struct MessageType {
+  public:
+    constexpr explicit MessageType(const char* name) : hash(fnv1a(name)), name(name) {}
+    const uint32_t hash;
+    const char* const name;
+
+    static constexpr uint32_t fnv1a(const char* str, uint32_t hash = 2166136261UL) {
+      return *str ? fnv1a(str + 1, (hash ^ static_cast<uint8_t>(*str)) * 16777619UL) : hash;
+    }
+};
+
+// Table of handlers for the messages from websocket clients (JSON or MessagePack)
+// - a message is first parsed for its type only, then for the fields its handler asked for (filter)
+// - messages which can't be an object, are too large or of an unknown type are rejected without parsing them fully
+// - the parse time is measured per message type
+class MessageDispatcher {
+  public:
+    typedef std::function<void(AsyncWebSocketClient* client, JsonDocument& jsonRXMsg)> Handler;
+
+    // register a handler for a message type, filter names the fields the handler reads
+    // returns false when all slots are taken or the type is registered already
+    bool on(const MessageType& type, const JsonDocument& filter, Handler handler);
+
+    // parse a message and hand it to its handler (in the AsyncTCP task)
+    // returns false when the message was rejected
+    bool dispatch(AsyncWebSocketClient* client, const uint8_t* data, size_t len, bool binary);
+
+    void reportMetrics(JsonObject metrics);
+
+  private:
+    struct Entry {
+        uint32_t hash = 0;
+        const char* name = nullptr;
+        JsonDocument filter;
+        Handler handler = nullptr;
+        std::atomic<uint32_t> count{0};
+        std::atomic<uint32_t> micros{0};
+        std::atomic<uint32_t> maxMicros{0};
+    };
+
+    static bool _looksLikeObject(const uint8_t* data, size_t len, bool binary);
+    static DeserializationError _parse(JsonDocument& jsonRXMsg, const uint8_t* data, size_t len, bool binary, const JsonDocument& filter);
+    Entry* _find(const char* type);
+
+    Entry _entries[WS_MAX_HANDLERS];
+    size_t _entryCount = 0;
+    JsonDocument _typeFilter;
+    std::atomic<uint32_t> _malformed{0};
+    std::atomic<uint32_t> _unknown{0};
+};
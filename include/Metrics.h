@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ESPAsyncWebServer.h>
+#include <TagEventBus.h>
+#include <TaskSchedulerDeclarations.h>
+
+class Metrics {
+  public:
+    explicit Metrics(AsyncWebServer& webServer) : _webServer(&webServer) {}
+    void begin(Scheduler* scheduler);
+    void end();
+
+  private:
+    void _metricsCallback();
+    void _tagEventCallback(const TagEvent& event);
+    Scheduler* _scheduler = nullptr;
+    AsyncWebServer* _webServer;
+    AsyncCallbackWebHandler* _handler = nullptr;
+    uint32_t _eventCount[static_cast<uint8_t>(TagEvent::Type::STATE_CHANGED) + 1] = {0};
+    uint32_t _readErrors = 0;
+    uint32_t _writeErrors = 0;
+    uint32_t _lastEvent = 0;
+};
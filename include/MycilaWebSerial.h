@@ -11,10 +11,15 @@
   #include "WiFi.h"
 #endif
 
+#include <ArduinoJson.h>
 #include <ESPAsyncWebServer.h>
+#include <RingBuffer.h>
 #include <TaskSchedulerDeclarations.h>
+#include <atomic>
 #include <functional>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #define WSL_VERSION          "8.1.1"
 #define WSL_VERSION_MAJOR    8
@@ -25,10 +30,55 @@
   #define WSL_MAX_WS_CLIENTS DEFAULT_MAX_WS_CLIENTS
 #endif
 
+// Log ring:
+// - every written line is a single record of up to WSL_LINE_SIZE bytes (longer lines are cut)
+// - WSL_RING_LINES records are preallocated, lines are dropped while the ring is full
+// - the drain task batches the lines into frames of up to WSL_FRAME_SIZE bytes ('\n' separated)
+#ifndef WSL_RING_LINES
+  #define WSL_RING_LINES 64
+#endif
+#ifndef WSL_LINE_SIZE
+  #define WSL_LINE_SIZE 160
+#endif
+#ifndef WSL_FRAME_SIZE
+  #define WSL_FRAME_SIZE 1024
+#endif
+
+// Scrollback:
+// - the last WSL_SCROLLBACK bytes of frames are kept (WSL_SCROLLBACK_PSRAM bytes in PSRAM, when found)
+// - new clients get them first, in frames of up to WSL_SCROLLBACK_FRAME bytes
+// - the oldest frames are evicted as a whole (length prefixed, O(1) each)
+#ifndef WSL_SCROLLBACK
+  #define WSL_SCROLLBACK 8192
+#endif
+#ifndef WSL_SCROLLBACK_PSRAM
+  #define WSL_SCROLLBACK_PSRAM WSL_SCROLLBACK
+#endif
+#ifndef WSL_SCROLLBACK_FRAME
+  #define WSL_SCROLLBACK_FRAME 4096
+#endif
+
+// Slow clients:
+// - frames are held back while a client has this many messages queued in the WebSocket
+// - up to WSL_CLIENT_BACKLOG frames are held back per client, the oldest are dropped
+// - a client is disconnected after WSL_CLIENT_MAX_DROPPED frames were dropped in a row
+#ifndef WSL_CLIENT_SLOW_QUEUE
+  #define WSL_CLIENT_SLOW_QUEUE 16
+#endif
+#ifndef WSL_CLIENT_BACKLOG
+  #define WSL_CLIENT_BACKLOG 32
+#endif
+#ifndef WSL_CLIENT_MAX_DROPPED
+  #define WSL_CLIENT_MAX_DROPPED 256
+#endif
+#ifndef WSL_DRAIN_INTERVAL
+  #define WSL_DRAIN_INTERVAL 100
+#endif
+
 // High performance mode:
-// - Low memory footprint (no stack allocation, no global buffer by default)
-// - Low latency (messages sent immediately to the WebSocket queue)
-// - High throughput (up to 20 messages per second, no locking mechanism)
+// - Low memory footprint (preallocated log ring, frames are shared by all clients)
+// - Writing never blocks or allocates (lock-free ring, any task or core)
+// - High throughput (lines are batched into one WebSocket message per drain)
 // Also recommended to tweak AsyncTCP and ESPAsyncWebServer settings, for example:
 //  -D CONFIG_ASYNC_TCP_QUEUE_SIZE=64  // AsyncTCP queue size
 //  -D CONFIG_ASYNC_TCP_RUNNING_CORE=1  // core for the async_task
@@ -41,14 +91,6 @@ class WebSerial : public Print {
     size_t write(uint8_t) override;
     size_t write(const uint8_t* buffer, size_t size) override;
 
-    // A buffer (shared across cores) can be initialised with an initial capacity to be able to use any Print functions event those that are not buffered and would
-    // create a performance impact for WS calls. The goal of this buffer is to be used with lines ending with '\n', like log messages.
-    // The buffer size will eventually grow until a '\n' is found, then the message will be sent to the WS clients and a new buffer will be created.
-    // Set initialCapacity to 0 to disable buffering.
-    // Must be called before begin(): calling it after will erase the buffer and its content will be lost.
-    // The buffer is not enabled by default.
-    void setBuffer(size_t initialCapacity);
-
     // Expose the internal WebSocket makeBuffer to even improve memory consumption on client-side
     // 1. make a AsyncWebSocketMessageBuffer
     // 2. put the data inside
@@ -67,14 +109,77 @@ class WebSerial : public Print {
         _ws->textAll(buffer);
     }
 
+    // somebody is listening
+    bool hasClients() const { return _clientCount > 0; }
+    // lines are sent or kept for the scrollback
+    bool wantsLines() const { return _scrollbackSize || _clientCount > 0; }
+
+    // ring usage, batching, queue depths and dropped frames of the clients
+    void reportMetrics(JsonObject metrics);
+
   private:
+    // a line (or a part of it) in the log ring
+    struct LogLine {
+        uint16_t length = 0;
+        bool eol = false; // the line ends here
+        char data[WSL_LINE_SIZE];
+    };
+
+    // frames held back for a slow client
+    struct Client {
+        uint32_t id = 0;
+        bool replayed = false; // got the scrollback
+        AsyncWebSocketSharedBuffer backlog[WSL_CLIENT_BACKLOG];
+        size_t first = 0;
+        size_t count = 0;
+        uint32_t droppedInARow = 0;
+        size_t highWater = 0;
+    };
+
     void _wsCleanupCallback();
+    void _drainCallback();
+    void _record(const uint8_t* data, size_t length, bool eol);
+    void _batch(const LogLine& line);
+    void _emit();
+    void _queueFrame(Client& client, const AsyncWebSocketSharedBuffer& frame);
+    void _keep(const AsyncWebSocketSharedBuffer& frame);
+    void _replay(Client& client);
+    void _scrollbackWrite(size_t pos, const uint8_t* data, size_t length);
+    void _scrollbackRead(size_t pos, uint8_t* data, size_t length) const;
+    void _drain(Client& client);
     Task* _wsCleanupTask = nullptr;
+    Task* _drainTask = nullptr;
+    std::vector<Client> _clients;
+    std::mutex _clientsMutex;
+    std::atomic<size_t> _clientCount{0};
+    std::atomic<uint32_t> _droppedFrames{0};
+    std::atomic<uint32_t> _disconnected{0};
+    std::atomic<size_t> _highWater{0};
     Scheduler* _scheduler = nullptr;
     // Server
     AsyncWebServer* _server;
     AsyncWebSocket* _ws;
-    size_t _initialBufferCapacity = 0;
-    std::string _buffer;
-    void _send(const uint8_t* buffer, size_t size);
+
+    // written by any task, drained by the drain task
+    MPSCRingBuffer<LogLine, WSL_RING_LINES> _ring;
+    std::atomic<uint32_t> _lines{0};
+    std::atomic<uint32_t> _ringFull{0};
+    // the frame being batched (complete lines up to _frameEnd, then the open line)
+    std::vector<uint8_t> _frame;
+    size_t _frameEnd = 0;
+    size_t _frameLines = 0;
+    std::atomic<uint32_t> _frames{0};
+    std::atomic<uint32_t> _batchedLines{0};
+    std::atomic<uint32_t> _splitLines{0};
+    std::atomic<uint32_t> _truncatedLines{0};
+
+    // the frames sent last, [uint16_t length][data] from _scrollbackTail to _scrollbackHead (in the loop task)
+    uint8_t* _scrollback = nullptr;
+    size_t _scrollbackSize = 0;
+    size_t _scrollbackHead = 0;
+    size_t _scrollbackTail = 0;
+    size_t _scrollbackUsed = 0;
+    bool _scrollbackPSRAM = false;
+    std::atomic<uint32_t> _evicted{0};
+    std::atomic<uint32_t> _replayFrames{0};
 };
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ESPAsyncWebServer.h>
+#include <IPAddress.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include <atomic>
+
+#define PRINTER_MODEL "F008"
+#define PRINTER_PROBE_BUFFER 128
+
+// probes running at the same time
+#ifndef PRINTER_PROBE_CONCURRENCY
+  #define PRINTER_PROBE_CONCURRENCY 8
+#endif
+// give up on a host after this long (ms)
+#ifndef PRINTER_PROBE_TIMEOUT
+  #define PRINTER_PROBE_TIMEOUT 1000
+#endif
+#ifndef PRINTER_POLL_INTERVAL
+  #define PRINTER_POLL_INTERVAL 20
+#endif
+
+// Find a K2 Plus on the local network
+// - the printer found last is kept in the preferences and just revalidated with a single request
+// - otherwise the /24 subnet is scanned for a webserver answering /info with model F008
+// - probes use non-blocking sockets polled from the loop task, with bounded concurrency
+class PrinterDiscovery {
+  public:
+    enum class State : uint8_t {
+      IDLE,
+      VALIDATING,
+      SCANNING,
+      FOUND,
+      NOT_FOUND
+    };
+
+    explicit PrinterDiscovery(AsyncWebServer& webServer) : _webServer(&webServer) {}
+    void begin(Scheduler* scheduler);
+    void end();
+    // start finding the printer (can be called from any task)
+    void requestDiscovery() { _discoveryRequested = true; }
+    State getState() { return _state; }
+    // the printer found last (might be outdated when not FOUND)
+    IPAddress getPrinter() { return IPAddress(_printer.load()); }
+    static const char* getStateName(State state);
+
+  private:
+    enum class ProbeState : uint8_t {
+      FREE,
+      CONNECTING,
+      RECEIVING
+    };
+    struct Probe {
+        ProbeState state = ProbeState::FREE;
+        int fd = -1;
+        uint32_t ip = 0;
+        uint32_t start = 0;
+        bool headerChecked = false;
+        char buffer[PRINTER_PROBE_BUFFER + 1];
+        size_t length = 0;
+    };
+
+    void _discoveryCallback();
+    void _pollCallback();
+    void _start();
+    bool _startProbe(Probe& probe, uint32_t ip);
+    void _closeProbe(Probe& probe);
+    void _probeDone(Probe& probe, bool isPrinter);
+    bool _checkResponse(Probe& probe);
+    bool _nextHost(uint32_t& ip);
+    void _finish(State state);
+    void _handleRequest(AsyncWebServerRequest* request);
+
+    Scheduler* _scheduler = nullptr;
+    Task* _pollTask = nullptr;
+    AsyncWebServer* _webServer;
+    AsyncCallbackWebHandler* _getHandler = nullptr;
+    AsyncCallbackWebHandler* _postHandler = nullptr;
+    std::atomic<bool> _discoveryRequested{false};
+    std::atomic<State> _state{State::IDLE};
+    std::atomic<uint32_t> _printer{0};
+    Probe _probes[PRINTER_PROBE_CONCURRENCY];
+
+    // the running discovery
+    uint32_t _cached = 0;
+    IPAddress _self;
+    uint16_t _nextHostIndex = 1;
+    uint32_t _startTime = 0;
+    std::atomic<uint32_t> _duration{0};
+    std::atomic<uint16_t> _probeCount{0};
+    std::atomic<bool> _fromCache{false};
+};
@@ -6,14 +6,40 @@
 
 #include <Adafruit_PN532.h>
 #include <CFSTag.h>
+#include <RingBuffer.h>
 #include <SPI.h>
 #include <SpoolData.h>
+#include <TagEventBus.h>
 #include <TaskSchedulerDeclarations.h>
 
+#include <atomic>
+#include <mutex>
 #include <string>
 
 #define RETRIES 3
 
+#ifndef RFID_TASK_CORE
+  #define RFID_TASK_CORE 0
+#endif
+#ifndef RFID_TASK_PRIORITY
+  #define RFID_TASK_PRIORITY 1
+#endif
+#ifndef RFID_TASK_STACK_SIZE
+  #define RFID_TASK_STACK_SIZE 8192
+#endif
+#ifndef RFID_POLL_INTERVAL
+  #define RFID_POLL_INTERVAL 250
+#endif
+#ifndef RFID_COOLDOWN_INTERVAL
+  #define RFID_COOLDOWN_INTERVAL RFID_POLL_INTERVAL
+#endif
+#ifndef RFID_WRITE_RETRIES
+  #define RFID_WRITE_RETRIES 10
+#endif
+#ifndef RFID_TRACE_LENGTH
+  #define RFID_TRACE_LENGTH 16
+#endif
+
 class RFID {
 
   public:
@@ -21,14 +47,17 @@ class RFID {
     void begin(Scheduler* scheduler);
     void end();
     // enable writing onto tags
-    void enableWriting(bool enable = true, bool overwrite = false);
+    // returns the id of this arming, the tag events carry the id of the arming in effect
+    uint32_t enableWriting(bool enable = true, bool overwrite = false);
     bool getWriteEnabled() { return _writeEnabled; }
     bool getOverwriteEnabled() { return _overwriteEnabled; }
-    SpoolData getSpooldata() { return _spooldata; }
-    typedef std::function<void(CFSTag tag)> TagReadCallback;
-    void listenTagRead(TagReadCallback callback) { _tagReadCallback = callback; }
-    typedef std::function<void(bool success)> TagWriteCallback;
-    void listenTagWrite(TagWriteCallback callback) { _tagWriteCallback = callback; }
+    SpoolData getSpooldata() {
+      std::lock_guard<std::mutex> lock(_rxSpooldataMutex);
+      return _rxSpooldata;
+    }
+    // set spooldata for writing
+    // beware: will throw exception in case of failure
+    void setSpooldata(const JsonDocument& doc);
     void enableBeep(bool enable);
     bool getStatus() { return _PN532Status; }
     LED::LEDMode getStatus_as_LEDMode() {
@@ -44,27 +73,114 @@ class RFID {
         return LED::LEDMode::ERROR;
       }
     }
+    // add state timings and the latest transitions to metrics
+    void reportMetrics(const JsonObject& metrics);
 
   private:
-    void _rfidReadCallback();
-    Task* _rfidReadTask = nullptr;
-    Task* _rfidWriteTask = nullptr;
+    // commands from the web layer and the loop task to the reader task
+    struct Command {
+        enum class Type : uint8_t {
+          SPOOLDATA,
+          ARM
+        };
+        Type type = Type::ARM;
+        bool enable = false;
+        bool overwrite = false;
+        uint32_t armId = 0;
+        SpoolData spooldata = SpoolData();
+    };
+
+    // Scheduler side (loop task)
     void _initNFCcallback();
     Scheduler* _scheduler = nullptr;
+
+    // web side (AsyncTCP task), mirrors the requested state
+    void _postCommand(const Command& command);
+    SpoolData _rxSpooldata = SpoolData(); // read by the loop task as well
+    std::mutex _rxSpooldataMutex;
+    std::atomic<bool> _writeEnabled{false};
+    std::atomic<bool> _overwriteEnabled{false};
+    std::atomic<uint32_t> _armCount{0};
+    std::atomic<bool> _beep{false};
+    std::atomic<bool> _PN532Status{false};
+
+    // reader side (RFID task)
+    static void _rfidTask(void* arg);
+    void _rfidLoop();
+    bool _initNFC();
+    void _processCommands();
+    void _postEvent(TagEvent::Type type, const CFSTag* tag = nullptr, bool success = false);
+    TaskHandle_t _taskHandle = nullptr;
+    std::atomic<bool> _stopTask{false};
     SPIClass* _spi;
     Adafruit_PN532 _nfc;
-    bool _PN532Status = false;
     bool _tagInProximity = false;
     bool _newTagInProximity = false;
     int32_t _retryCounter = RETRIES;
+    CFSTag _tag = CFSTag();
     CFSTag _lastTag = CFSTag();
+    bool _readSuccess = false;
     SpoolData _spooldata = SpoolData();
-    void _spooldataRxCallback(JsonDocument doc);
-    TagReadCallback _tagReadCallback = nullptr;
-    TagWriteCallback _tagWriteCallback = nullptr;
-    bool _writeEnabled = false;
-    bool _overwriteEnabled = false;
+    bool _armed = false;
+    bool _armedOverwrite = false;
+    uint32_t _armId = 0;
     uint32_t _writeError = 0;
-    bool _beep = false;
+    TickType_t _holdOff = 0;
     void _doBeep(uint32_t freq = 1500);
+
+    // reader state machine (RFID task)
+    // one cycle runs from IDLE through the states until it returns to IDLE
+    enum class State : uint8_t {
+      IDLE,
+      DETECT,
+      AUTHENTICATE,
+      READ,
+      WRITE,
+      VERIFY,
+      COOLDOWN,
+      COUNT
+    };
+    typedef State (RFID::*StateHandler)();
+    struct StateEntry {
+        const char* name;
+        StateHandler handler;
+    };
+    static const StateEntry _stateTable[static_cast<size_t>(State::COUNT)];
+    void _runStateMachine();
+    void _transition(State next);
+    State _stateIdle();
+    State _stateDetect();
+    State _stateAuthenticate();
+    State _stateRead();
+    State _stateWrite();
+    State _stateVerify();
+    State _stateCooldown();
+    State _tagMissing();
+    State _writeFailed();
+    State _state = State::IDLE;
+    int64_t _stateEntered = 0;
+
+    // time spent in each state (from entering until leaving it)
+    struct StateTiming {
+        uint32_t count = 0;
+        uint32_t lastUs = 0;
+        uint32_t maxUs = 0;
+        uint64_t totalUs = 0;
+    };
+    StateTiming _stateTiming[static_cast<size_t>(State::COUNT)];
+
+    // ring of the latest transitions
+    struct Transition {
+        uint32_t timestamp = 0;
+        uint32_t durationUs = 0;
+        State from = State::IDLE;
+        State to = State::IDLE;
+    };
+    Transition _trace[RFID_TRACE_LENGTH];
+    uint32_t _traceCount = 0;
+    // timings and trace are copied by the metrics handler (AsyncTCP task)
+    std::mutex _metricsMutex;
+
+    // commands from the AsyncTCP and the loop task (events are posted to tagEventBus)
+    MPSCRingBuffer<Command, 8> _commands;
 };
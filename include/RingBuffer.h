@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free single-producer/single-consumer ring buffer
+// Exactly one task may push, exactly one (other) task may pop.
+// All slots are preallocated, N must be a power of two and one slot is always kept free.
+template <typename T, size_t N>
+class SPSCRingBuffer {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SPSCRingBuffer: capacity must be a power of two");
+
+  public:
+    // copy an item into the ring
+    // returns false when the ring is full
+    bool push(const T& item) {
+      T* slot = reserve();
+      if (slot == nullptr)
+        return false;
+      *slot = item;
+      commit();
+      return true;
+    }
+
+    // get the next free slot for filling it in place (producer side)
+    // returns nullptr when the ring is full
+    T* reserve() {
+      size_t head = _head.load(std::memory_order_relaxed);
+      if (((head + 1) & (N - 1)) == _tail.load(std::memory_order_acquire))
+        return nullptr;
+      return &_items[head];
+    }
+
+    // publish the slot obtained by reserve() (producer side)
+    void commit() {
+      size_t head = _head.load(std::memory_order_relaxed);
+      _head.store((head + 1) & (N - 1), std::memory_order_release);
+    }
+
+    // copy the oldest item out of the ring
+    // returns false when the ring is empty
+    bool pop(T& item) {
+      T* slot = front();
+      if (slot == nullptr)
+        return false;
+      item = *slot;
+      release();
+      return true;
+    }
+
+    // get the oldest item for reading it in place (consumer side)
+    // returns nullptr when the ring is empty
+    T* front() {
+      size_t tail = _tail.load(std::memory_order_relaxed);
+      if (tail == _head.load(std::memory_order_acquire))
+        return nullptr;
+      return &_items[tail];
+    }
+
+    // hand the slot obtained by front() back to the producer (consumer side)
+    void release() {
+      size_t tail = _tail.load(std::memory_order_relaxed);
+      _tail.store((tail + 1) & (N - 1), std::memory_order_release);
+    }
+
+    bool empty() const {
+      return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return N - 1; }
+
+  private:
+    T _items[N];
+    std::atomic<size_t> _head{0};
+    std::atomic<size_t> _tail{0};
+};
+
+// Lock-free multi-producer/single-consumer ring buffer (bounded, after D. Vyukov)
+// Any task may push, exactly one task may pop. Producers never block or allocate,
+// a producer preempted between reserve() and commit() only holds back the consumer.
+// All slots are preallocated, N must be a power of two.
+template <typename T, size_t N>
+class MPSCRingBuffer {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "MPSCRingBuffer: capacity must be a power of two");
+
+  public:
+    MPSCRingBuffer() {
+      for (size_t i = 0; i < N; ++i)
+        _slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // claim the next free slot for filling it in place (any producer)
+    // returns nullptr when the ring is full, otherwise pass ticket to commit()
+    T* reserve(size_t& ticket) {
+      size_t head = _head.load(std::memory_order_relaxed);
+      for (;;) {
+        Slot& slot = _slots[head & (N - 1)];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(head);
+        if (diff == 0) {
+          // head is updated on failure
+          if (_head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+            ticket = head;
+            return &slot.item;
+          }
+        } else if (diff < 0) {
+          return nullptr;
+        } else {
+          head = _head.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // publish the slot obtained by reserve() (producer side)
+    void commit(size_t ticket) {
+      _slots[ticket & (N - 1)].seq.store(ticket + 1, std::memory_order_release);
+    }
+
+    // get the oldest item for reading it in place (consumer side)
+    // returns nullptr when the ring is empty (or the oldest slot isn't committed yet)
+    T* front() {
+      size_t tail = _tail.load(std::memory_order_relaxed);
+      Slot& slot = _slots[tail & (N - 1)];
+      if (slot.seq.load(std::memory_order_acquire) != tail + 1)
+        return nullptr;
+      return &slot.item;
+    }
+
+    // hand the slot obtained by front() back to the producers (consumer side)
+    void release() {
+      size_t tail = _tail.load(std::memory_order_relaxed);
+      _slots[tail & (N - 1)].seq.store(tail + N, std::memory_order_release);
+      _tail.store(tail + 1, std::memory_order_relaxed);
+    }
+
+    // items waiting (approximate while producers are active)
+    size_t size() const { return _head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_relaxed); }
+
+    static constexpr size_t capacity() { return N; }
+
+  private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        T item;
+    };
+    Slot _slots[N];
+    std::atomic<size_t> _head{0};
+    std::atomic<size_t> _tail{0};
+};
@@ -103,7 +103,7 @@ struct SpoolData {
       _materialVendor = spooldata.substr(5, 4);
 
       // get batch
-      _materialVendor = spooldata.substr(9, 2);
+      _materialBatch = spooldata.substr(9, 2);
 
       // get material type (ignore the leading '1')
       _materialType = spooldata.substr(12, 5);
@@ -128,24 +128,35 @@ struct SpoolData {
     // typecast to JSON Document
     explicit operator JsonDocument() const {
       JsonDocument spooldata;
-      spooldata["spooldata"] = _spooldata;
-      spooldata["batch"] = _materialBatch;
-      spooldata["date"] = _materialDate;
-      spooldata["vendor"] = _materialVendor;
-      spooldata["type"] = _materialType;
-      spooldata["weight"] = _materialWeight;
-      spooldata["color"] = _materialColorString;
-      spooldata["serial"] = _serialNum;
-      spooldata["reserve"] = _reserve;
+      convertToJson(*this, spooldata.to<JsonVariant>());
       spooldata.shrinkToFit();
       return spooldata;
     }
 
+    // fill a JSON variant in place, e.g. msg["spooldata"] = spooldata (ArduinoJson custom converter)
+    friend void convertToJson(const SpoolData& src, JsonVariant dst) {
+      dst["spooldata"] = src._spooldata;
+      dst["batch"] = src._materialBatch;
+      dst["date"] = src._materialDate;
+      dst["vendor"] = src._materialVendor;
+      dst["type"] = src._materialType;
+      dst["weight"] = src._materialWeight;
+      dst["color"] = src._materialColorString;
+      dst["serial"] = src._serialNum;
+      dst["reserve"] = src._reserve;
+    }
+
     // typecast to std::string
     explicit operator std::string() const {
       return _spooldata;
     }
 
+    // getters
+    const std::string& getType() const { return _materialType; }
+    uint32_t getColor() const { return _materialColorNumeric; }
+    const std::string& getColorString() const { return _materialColorString; }
+    uint32_t getWeight() const { return _materialWeight; }
+
     friend class CFSTag;
 
   private:
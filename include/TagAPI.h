@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ArduinoJson.h>
+#include <AsyncJson.h>
+#include <ESPAsyncWebServer.h>
+#include <TagEventBus.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// wait for a tag this long when not asked otherwise (ms)
+#ifndef TAG_API_DEFAULT_WAIT
+  #define TAG_API_DEFAULT_WAIT 10000
+#endif
+// longest wait of a request (ms)
+#ifndef TAG_API_MAX_WAIT
+  #define TAG_API_MAX_WAIT 60000
+#endif
+// GET requests waiting at the same time
+#ifndef TAG_API_MAX_WAITERS
+  #define TAG_API_MAX_WAITERS 4
+#endif
+#ifndef TAG_API_POLL_INTERVAL
+  #define TAG_API_POLL_INTERVAL 100
+#endif
+
+// HTTP API for scripted reading and writing of tags
+// - GET /api/tag[?since=<seq>][&wait=<ms>]: the tag on the reader, or wait for the next one (after since)
+// - POST /api/tag {"spooldata": {...}, "overwrite": false, "wait": <ms>}: arm a single write and answer with its result
+// - waiting requests are paused and answered from the tag events in the loop task, the AsyncTCP task never blocks
+class TagAPI {
+  public:
+    explicit TagAPI(AsyncWebServer& webServer) : _webServer(&webServer) {}
+    void begin(Scheduler* scheduler);
+    void end();
+    void reportMetrics(JsonObject metrics);
+
+  private:
+    struct Waiter {
+        AsyncWebServerRequestPtr request;
+        uint32_t start = 0;
+        uint32_t wait = 0;
+        uint32_t since = 0;
+    };
+
+    void _apiCallback();
+    void _tagEventCallback(const TagEvent& event);
+    void _timeoutCallback();
+    void _handleGet(AsyncWebServerRequest* request);
+    void _handlePost(AsyncWebServerRequest* request, JsonVariant& json);
+    void _finishWrite(bool success, const CFSTag* tag, bool disarm = true);
+    static uint32_t _getWait(uint32_t wait);
+    static bool _isValidSpooldata(const JsonDocument& jsonSpool);
+    static void _sendJson(AsyncWebServerRequestPtr& request, int code, const JsonDocument& jsonMsg);
+
+    Scheduler* _scheduler = nullptr;
+    Task* _timeoutTask = nullptr;
+    AsyncWebServer* _webServer;
+    AsyncCallbackWebHandler* _getHandler = nullptr;
+    AsyncCallbackJsonWebHandler* _postHandler = nullptr;
+    std::mutex _mutex;
+
+    // the tag read last, serialized once for all requests
+    uint32_t _seq = 0;
+    bool _present = false; // the tag is still on the reader
+    std::string _tagJson;
+    std::vector<Waiter> _readers;
+
+    // the running write
+    Waiter _writer;
+    bool _writing = false;
+    uint32_t _armId = 0; // the arming of the write (see RFID::enableWriting)
+
+    std::atomic<uint32_t> _reads{0};
+    std::atomic<uint32_t> _writes{0};
+    std::atomic<uint32_t> _timeouts{0};
+};
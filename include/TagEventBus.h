@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <CFSTag.h>
+#include <RingBuffer.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include <atomic>
+#include <functional>
+
+#ifndef TAG_EVENT_MAX_SUBSCRIBERS
+  #define TAG_EVENT_MAX_SUBSCRIBERS 8
+#endif
+
+// A single event record, preallocated in the bus' ring
+struct TagEvent {
+  public:
+    enum class Type : uint8_t {
+      TAG_ARRIVED,   // a new tag is in proximity
+      TAG_LEFT,      // the tag is gone
+      READ_DONE,     // spooldata was read (success: data is valid)
+      WRITE_DONE,    // spooldata was written (success: written and verified)
+      ERROR,         // repeated failures, user attention is needed
+      STATE_CHANGED, // arming or reader state has changed
+    };
+
+    static constexpr uint32_t mask(Type type) { return 1UL << static_cast<uint8_t>(type); }
+    static constexpr uint32_t ALL = 0xFFFFFFFF;
+
+    Type type = Type::STATE_CHANGED;
+    uint32_t timestamp = 0; // millis() when the event was posted
+    CFSTag tag = CFSTag();  // the tag (uid is valid for all tag related events)
+    bool success = false;
+    bool armed = false;     // writing was enabled
+    bool overwrite = false; // overwriting was enabled
+    bool reader = false;    // the reader is available
+    uint32_t armId = 0;     // the arming in effect (see RFID::enableWriting)
+};
+
+// Event bus from the reader task to any number of subscribers
+// - one producer (the reader task) fills the preallocated records in place
+// - a Scheduler task dispatches them to the subscribers by const reference
+class TagEventBus {
+  public:
+    typedef std::function<void(const TagEvent& event)> Subscriber;
+
+    void begin(Scheduler* scheduler);
+    void end();
+
+    // register a subscriber for the event types given in mask (see TagEvent::mask)
+    // returns false when all subscriber slots are taken
+    bool subscribe(uint32_t mask, Subscriber subscriber);
+
+    // get a record to fill in place (producer side)
+    // returns nullptr when the ring is full (the event is counted as dropped)
+    TagEvent* reserve(TagEvent::Type type);
+    // publish the record obtained by reserve() (producer side)
+    void commit() { _ring.commit(); }
+
+    uint32_t getDispatched() { return _dispatched; }
+    uint32_t getDropped() { return _dropped; }
+
+  private:
+    void _dispatchCallback();
+    Task* _dispatchTask = nullptr;
+    Scheduler* _scheduler = nullptr;
+    struct Subscription {
+        uint32_t mask = 0;
+        Subscriber callback = nullptr;
+    };
+    Subscription _subscribers[TAG_EVENT_MAX_SUBSCRIBERS];
+    size_t _subscriberCount = 0;
+    SPSCRingBuffer<TagEvent, 16> _ring;
+    uint32_t _dispatched = 0;
+    std::atomic<uint32_t> _dropped{0};
+};
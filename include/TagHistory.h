@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+#pragma once
+
+#include <ESPAsyncWebServer.h>
+#include <FS.h>
+#include <TagEventBus.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#ifndef HISTORY_SEGMENTS
+  #define HISTORY_SEGMENTS 4
+#endif
+#ifndef HISTORY_SEGMENT_RECORDS
+  #define HISTORY_SEGMENT_RECORDS 128
+#endif
+#ifndef HISTORY_BUFFER_RECORDS
+  #define HISTORY_BUFFER_RECORDS 8
+#endif
+#ifndef HISTORY_FLUSH_INTERVAL
+  #define HISTORY_FLUSH_INTERVAL 5000
+#endif
+#ifndef HISTORY_PAGE_LIMIT
+  #define HISTORY_PAGE_LIMIT 100
+#endif
+
+#define HISTORY_DIR "/history"
+
+// One fixed-size record of the history log
+// - record n is stored in segment (n / HISTORY_SEGMENT_RECORDS) % HISTORY_SEGMENTS
+//   at offset (n % HISTORY_SEGMENT_RECORDS) * sizeof(HistoryRecord)
+struct __attribute__((packed)) HistoryRecord {
+    enum class Operation : uint8_t {
+      READ,
+      WRITE,
+      ERROR
+    };
+
+    uint32_t seq = 0;         // running number (used as cursor)
+    uint32_t time = 0;        // unix time in s (0 when the time wasn't synced yet)
+    uint32_t uptime = 0;      // millis() when the event was posted
+    uint8_t uid[4] = {0};     // uid of the tag
+    Operation op = Operation::READ;
+    uint8_t success = 0;      // operation succeeded
+    uint8_t armed = 0;        // writing was enabled
+    uint8_t overwrite = 0;    // overwriting was enabled
+    char spooldata[44] = {0}; // spooldata as on the tag (not zero terminated when full)
+};
+static_assert(sizeof(HistoryRecord) == 64, "HistoryRecord should fill 64 bytes");
+
+// Append-only log of tag reads and writes on LittleFS
+// - records are collected in RAM and flushed in batches
+// - the log is split into segments, the oldest segment is overwritten when all are used
+class TagHistory {
+  public:
+    explicit TagHistory(AsyncWebServer& webServer) : _webServer(&webServer) {}
+    void begin(Scheduler* scheduler);
+    void end();
+    // write buffered records to the filesystem
+    void flush();
+
+    // first and next record persisted in the log
+    uint32_t getFirstSeq();
+    uint32_t getNextSeq() { return _flushedSeq; }
+
+  private:
+    void _historyCallback();
+    void _tagEventCallback(const TagEvent& event);
+    void _recover();
+    void _handleRequest(AsyncWebServerRequest* request);
+    static std::string _segmentPath(uint32_t seq);
+    Scheduler* _scheduler = nullptr;
+    Task* _flushTask = nullptr;
+    AsyncWebServer* _webServer;
+    AsyncCallbackWebHandler* _handler = nullptr;
+    bool _ready = false;
+
+    // RAM buffer (loop task)
+    HistoryRecord _buffer[HISTORY_BUFFER_RECORDS];
+    size_t _buffered = 0;
+    uint32_t _nextSeq = 0;
+    uint32_t _lost = 0;
+
+    // records up to here are on the filesystem (read by the webserver)
+    std::atomic<uint32_t> _flushedSeq{0};
+
+    // streaming of records (per request)
+    struct Reader {
+        enum class Phase : uint8_t {
+          HEADER,
+          RECORDS,
+          TRAILER,
+          DONE
+        };
+        Phase phase = Phase::HEADER;
+        bool csv = false;
+        uint32_t first = 0;
+        uint32_t seq = 0;
+        uint32_t end = 0;
+        uint32_t count = 0;
+        File file;
+        uint32_t segment = UINT32_MAX;
+        std::string line;
+        size_t offset = 0;
+    };
+    static size_t _fill(Reader& reader, uint8_t* buffer, size_t maxLen);
+    static bool _nextLine(Reader& reader);
+    static bool _readRecord(Reader& reader, HistoryRecord& record);
+    static void _formatRecord(const HistoryRecord& record, bool csv, bool separator, std::string& line);
+};
@@ -14,6 +14,8 @@ class WebServerAPI {
     void end();
     bool isFSMounted() { return _fsMounted; }
     StatusRequest* getStatusRequest();
+    // send 304 when If-None-Match matches the (quoted) etag, false when a full response is needed
+    static bool notModified(AsyncWebServerRequest* request, const char* etag);
 
   private:
     void _webServerCallback();
@@ -4,21 +4,89 @@
  */
 #pragma once
 
+#include <ArduinoJson.h>
 #include <ESPAsyncWebServer.h>
+#include <IPAddress.h>
+#include <MessageBufferPool.h>
+#include <MessageDispatcher.h>
+#include <TagEventBus.h>
 #include <TaskSchedulerDeclarations.h>
 
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <vector>
+
+// state updates within one interval are coalesced (ms)
+#ifndef WS_COALESCE_INTERVAL
+  #define WS_COALESCE_INTERVAL 50
+#endif
+// events kept for clients resuming after a reconnect
+#ifndef WS_REPLAY_EVENTS
+  #define WS_REPLAY_EVENTS 16
+#endif
+// keep recording events this long after the last client has left (ms)
+#ifndef WS_REPLAY_WINDOW
+  #define WS_REPLAY_WINDOW 60000
+#endif
+// queued messages from which state updates to a client are collapsed into the latest state
+#ifndef WS_CLIENT_SLOW_QUEUE
+  #define WS_CLIENT_SLOW_QUEUE 8
+#endif
+// queued messages from which a client is disconnected
+#ifndef WS_CLIENT_MAX_QUEUE
+  #define WS_CLIENT_MAX_QUEUE 32
+#endif
 
 class WebSite {
   public:
     explicit WebSite(AsyncWebServer& webServer) : _webServer(&webServer) { _sr.setWaiting(); }
     void begin(Scheduler* scheduler);
     void end();
-    typedef std::function<void(JsonDocument doc)> SpooldataCallback;
-    void listenSpooldata(SpooldataCallback callback) { _spooldataCallback = callback; }
     StatusRequest* getStatusRequest();
+    // add the websocket statistics to the metrics
+    void reportMetrics(JsonObject metrics);
 
   private:
+    // connected clients and their format (MessagePack with /ws?format=msgpack)
+    struct WSClient {
+        uint32_t id = 0;
+        bool binary = false;
+        bool welcomed = false;
+        // resume after the last event seen
+        bool resume = false;
+        uint32_t epoch = 0;
+        uint32_t lastSeq = 0;
+        // backpressure
+        size_t depth = 0;
+        size_t highWater = 0;
+        bool stale = false;
+        bool closing = false;
+    };
+    // a message waiting for the next flush
+    struct Pending {
+        JsonDocument jsonMsg;
+        bool coalesce;
+    };
+    // a sent event, for the replay
+    struct Recorded {
+        uint32_t seq = 0;
+        AsyncWebSocketSharedBuffer msgPack;
+    };
+    struct Stats {
+        std::atomic<uint32_t> serialized{0};
+        std::atomic<uint32_t> bytes{0};
+        std::atomic<uint32_t> micros{0};
+        void report(JsonObject jsonStats) const;
+    };
+    // pre-serialized initial_config, shared by all connecting clients
+    struct Snapshot {
+        uint32_t version = 0;
+        IPAddress host;
+        AsyncWebSocketSharedBuffer text;
+        AsyncWebSocketSharedBuffer binary;
+    };
+
     void _webSiteCallback();
     void _wsCleanupCallback();
     Task* _wsCleanupTask = nullptr;
@@ -26,14 +94,58 @@ class WebSite {
     StatusRequest _sr;
     AsyncWebServer* _webServer;
     AsyncWebSocket* _ws = nullptr;
-    uint32_t _disconnectTime;
+    std::atomic<uint32_t> _disconnectTime{0};
 #ifdef USE_BEEPER
-    bool _beepOnRW = false;
+    std::atomic<bool> _beepOnRW{false};
 #endif
-    bool _cloneSerial = false;
-    SpooldataCallback _spooldataCallback = nullptr;
-    void _tagReadCallback(CFSTag tag);
+    std::atomic<bool> _cloneSerial{false};
+    void _tagEventCallback(const TagEvent& event);
+    void _tagReadCallback(const CFSTag& tag);
     void _tagWriteCallback(bool success);
+    void _registerMessages();
+    void _armStateCallback(AsyncWebSocketClient* client, JsonDocument& jsonRXMsg);
+    void _updateConfigCallback(AsyncWebSocketClient* client, JsonDocument& jsonRXMsg);
+    MessageDispatcher _dispatcher;
+    void _welcome(const WSClient& client);
+    AsyncWebSocketSharedBuffer _getSnapshot(bool binary);
+    void _invalidateSnapshot() { _snapshotVersion++; }
+    AsyncWebSocketSharedBuffer _serialize(const JsonDocument& jsonMsg, bool binary);
+    void _send(uint32_t id, bool binary, AsyncWebSocketSharedBuffer buffer);
+    void _publish(JsonDocument&& jsonMsg, bool coalesce);
+    void _flushCallback();
+    void _record(uint32_t seq, AsyncWebSocketSharedBuffer msgPack);
+    bool _wantEvents();
+    void _checkBackpressure(WSClient& client);
+    std::vector<WSClient> _clients;
+    std::mutex _clientsMutex;
+    std::vector<Pending> _pending;
+    std::mutex _pendingMutex;
+    Task* _flushTask = nullptr;
+    // only used by the flush
+    std::vector<WSClient> _sending;
+    std::vector<Pending> _flushing;
+    Recorded _replay[WS_REPLAY_EVENTS];
+    uint32_t _epoch = 0;
+    uint32_t _seq = 0;
+    uint32_t _replayFrom = 1;
+    std::atomic<bool> _unrecorded{false};
+    std::atomic<uint32_t> _coalesced{0};
+    std::atomic<uint32_t> _resumed{0};
+    std::atomic<uint32_t> _replayed{0};
+    std::atomic<uint32_t> _collapsed{0};
+    // arming as last told to the clients
+    std::atomic<bool> _announcedArmed{false};
+    std::atomic<bool> _announcedOverwrite{false};
+    std::atomic<uint32_t> _slowDisconnects{0};
+    std::atomic<size_t> _queueHighWater{0};
+    Stats _jsonStats;
+    Stats _msgPackStats;
+    MessageBufferPool _pool;
+    Snapshot _snapshot;
+    std::mutex _snapshotMutex;
+    std::atomic<uint32_t> _snapshotVersion{1};
+    std::atomic<uint32_t> _snapshotBuilds{0};
+    std::atomic<uint32_t> _snapshotHits{0};
     static void _denyUpload(AsyncWebServerRequest* request, __unused String filename, __unused size_t index, __unused uint8_t* data, __unused size_t len, __unused bool final) { // don't accept file uploads
       request->send(400);
     }
@@ -9,14 +9,23 @@
 #include <CFSTag.h>
 #include <ESPAsyncWebServer.h>
 #include <ESPNetworkTask.h>
+#include <EventStream.h>
 #include <EventHandler.h>
 #include <FS.h>
+#include <Inventory.h>
 #include <LED.h>
 #include <LittleFS.h>
+#include <MaterialDB.h>
+#include <MaterialSync.h>
+#include <Metrics.h>
 #include <MycilaESPConnect.h>
 #include <MycilaSystem.h>
+#include <PrinterDiscovery.h>
 #include <RFID.h>
 #include <SpoolData.h>
+#include <TagAPI.h>
+#include <TagEventBus.h>
+#include <TagHistory.h>
 #include <WebServerAPI.h>
 #include <WebSite.h>
 
@@ -27,40 +36,142 @@ extern WebServerAPI webServerAPI;
 extern WebSite webSite;
 extern RFID rfid;
 extern LED led;
+extern TagEventBus tagEventBus;
+extern Metrics metrics;
+extern TagHistory tagHistory;
+extern Inventory inventory;
+extern MaterialDB materialDB;
+extern MaterialSync materialSync;
+extern PrinterDiscovery printerDiscovery;
+extern TagAPI tagAPI;
+extern EventStream eventStream;
+
+// Log calls above this level are compiled out, their arguments are not evaluated
+#ifndef APP_LOG_LEVEL
+  #define APP_LOG_LEVEL ARDUHAL_LOG_LEVEL_DEBUG
+#endif
 
 // Allow serial logging for App
 #ifdef MYCILA_LOGGER_SUPPORT_APP
   #include <MycilaLogger.h>
 extern Mycila::Logger* serialLogger;
-  #define LOGD(tag, format, ...) serialLogger->debug(tag, format, ##__VA_ARGS__)
-  #define LOGI(tag, format, ...) serialLogger->info(tag, format, ##__VA_ARGS__)
-  #define LOGW(tag, format, ...) serialLogger->warn(tag, format, ##__VA_ARGS__)
-  #define LOGE(tag, format, ...) serialLogger->error(tag, format, ##__VA_ARGS__)
+  #define APP_LOGD(tag, format, ...) serialLogger->debug(tag, format, ##__VA_ARGS__)
+  #define APP_LOGI(tag, format, ...) serialLogger->info(tag, format, ##__VA_ARGS__)
+  #define APP_LOGW(tag, format, ...) serialLogger->warn(tag, format, ##__VA_ARGS__)
+  #define APP_LOGE(tag, format, ...) serialLogger->error(tag, format, ##__VA_ARGS__)
 #endif
 
 // Allow logging for App via webSerial
 #ifdef MYCILA_WEBSERIAL_SUPPORT_APP
-  #include <MycilaLogger.h>
   #include <MycilaWebSerial.h>
-extern Mycila::Logger* webLogger;
 extern WebSerial webSerial;
-  #define LOGD(tag, format, ...) \
-    if (webLogger != nullptr)    \
-    webLogger->debug(tag, format, ##__VA_ARGS__)
-  #define LOGI(tag, format, ...) \
-    if (webLogger != nullptr)    \
-    webLogger->info(tag, format, ##__VA_ARGS__)
-  #define LOGW(tag, format, ...) \
-    if (webLogger != nullptr)    \
-    webLogger->warn(tag, format, ##__VA_ARGS__)
-  #define LOGE(tag, format, ...) \
-    if (webLogger != nullptr)    \
-    webLogger->error(tag, format, ##__VA_ARGS__)
+  #ifdef LOG_DEFERRED
+    // record format and arguments, formatted later in the loop task when WebSerial wants lines
+    // (the dead printf lets the compiler check the arguments)
+    #include <DeferredLog.h>
+extern DeferredLog deferredLog;
+    #define APP_LOG(level, tag, format, ...)                  \
+      do {                                                    \
+        if (false)                                            \
+          printf(format, ##__VA_ARGS__);                      \
+        deferredLog.log(level, tag, format, ##__VA_ARGS__);   \
+      } while (0)
+    #define APP_LOGD(tag, format, ...) APP_LOG(ARDUHAL_LOG_LEVEL_DEBUG, tag, format, ##__VA_ARGS__)
+    #define APP_LOGI(tag, format, ...) APP_LOG(ARDUHAL_LOG_LEVEL_INFO, tag, format, ##__VA_ARGS__)
+    #define APP_LOGW(tag, format, ...) APP_LOG(ARDUHAL_LOG_LEVEL_WARN, tag, format, ##__VA_ARGS__)
+    #define APP_LOGE(tag, format, ...) APP_LOG(ARDUHAL_LOG_LEVEL_ERROR, tag, format, ##__VA_ARGS__)
+  #else
+    #include <MycilaLogger.h>
+extern Mycila::Logger* webLogger;
+    #define APP_LOGD(tag, format, ...) \
+      if (webLogger != nullptr)        \
+      webLogger->debug(tag, format, ##__VA_ARGS__)
+    #define APP_LOGI(tag, format, ...) \
+      if (webLogger != nullptr)        \
+      webLogger->info(tag, format, ##__VA_ARGS__)
+    #define APP_LOGW(tag, format, ...) \
+      if (webLogger != nullptr)        \
+      webLogger->warn(tag, format, ##__VA_ARGS__)
+    #define APP_LOGE(tag, format, ...) \
+      if (webLogger != nullptr)        \
+      webLogger->error(tag, format, ##__VA_ARGS__)
+  #endif
 #endif
 
-#if !defined(MYCILA_WEBSERIAL_SUPPORT_APP) && !defined(MYCILA_LOGGER_SUPPORT_APP)
+#if defined(MYCILA_WEBSERIAL_SUPPORT_APP) || defined(MYCILA_LOGGER_SUPPORT_APP)
+  #include <LogRateLimit.h>
+extern LogRateLimiter logRateLimiter;
+  // the summary of suppressed messages, the arguments are the format of the call site and the count
+  #define LOG_REPEATED_FORMAT "\"%s\" repeated %" PRIu32 " times"
+  #if LOG_RATE_BURST > 0
+    // each call site keeps its own rate limit
+    #define LOG_LIMITED(level, backend, tag, format, ...)         \
+      do {                                                        \
+        static LogRateLimit _logRate(level, tag, format);         \
+        uint32_t _repeated;                                       \
+        if (_logRate.allow(_repeated)) {                          \
+          if (_repeated) {                                        \
+            logRateLimiter.countSummary();                        \
+            backend(tag, LOG_REPEATED_FORMAT, format, _repeated); \
+          }                                                       \
+          backend(tag, format, ##__VA_ARGS__);                    \
+        }                                                         \
+      } while (0)
+  #else
+    #define LOG_LIMITED(level, backend, tag, format, ...) \
+      do {                                                \
+        backend(tag, format, ##__VA_ARGS__);              \
+      } while (0)
+  #endif
+
+  #if APP_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_DEBUG
+    #define LOGD(tag, format, ...) LOG_LIMITED(ARDUHAL_LOG_LEVEL_DEBUG, APP_LOGD, tag, format, ##__VA_ARGS__)
+    // bypasses the rate limit, for call sites logging different data each time (tag reads, dumps)
+    #define LOGD_UNLIMITED(tag, format, ...)  \
+      do {                                    \
+        APP_LOGD(tag, format, ##__VA_ARGS__); \
+      } while (0)
+  #else
+    #define LOGD(tag, format, ...) \
+      do {                         \
+      } while (0)
+    #define LOGD_UNLIMITED(tag, format, ...) \
+      do {                                   \
+      } while (0)
+  #endif
+  #if APP_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+    #define LOGI(tag, format, ...) LOG_LIMITED(ARDUHAL_LOG_LEVEL_INFO, APP_LOGI, tag, format, ##__VA_ARGS__)
+    #define LOGI_UNLIMITED(tag, format, ...)  \
+      do {                                    \
+        APP_LOGI(tag, format, ##__VA_ARGS__); \
+      } while (0)
+  #else
+    #define LOGI(tag, format, ...) \
+      do {                         \
+      } while (0)
+    #define LOGI_UNLIMITED(tag, format, ...) \
+      do {                                   \
+      } while (0)
+  #endif
+  #if APP_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_WARN
+    #define LOGW(tag, format, ...) LOG_LIMITED(ARDUHAL_LOG_LEVEL_WARN, APP_LOGW, tag, format, ##__VA_ARGS__)
+  #else
+    #define LOGW(tag, format, ...) \
+      do {                         \
+      } while (0)
+  #endif
+  #if APP_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_ERROR
+    #define LOGE(tag, format, ...) LOG_LIMITED(ARDUHAL_LOG_LEVEL_ERROR, APP_LOGE, tag, format, ##__VA_ARGS__)
+  #else
+    #define LOGE(tag, format, ...) \
+      do {                         \
+      } while (0)
+  #endif
+#else
   #define LOGD(tag, format, ...)
+  #define LOGD_UNLIMITED(tag, format, ...)
   #define LOGI(tag, format, ...)
+  #define LOGI_UNLIMITED(tag, format, ...)
   #define LOGW(tag, format, ...)
   #define LOGE(tag, format, ...)
 #endif
@@ -13,60 +13,67 @@ using std::runtime_error;
 // constructor from PN532 nfc reader
 // beware: will throw exception in case of failure
 CFSTag::CFSTag(Adafruit_PN532* nfc) {
+  if (!detect(nfc))
+    throw runtime_error("No tag in proximity");
+
+  if (!authenticate(nfc))
+    throw runtime_error("authentification failed");
+}
+
+bool CFSTag::detect(Adafruit_PN532* nfc) {
   _uid = Uid();
+  _encrypted = false;
+  _validMaterial = false;
+  _empty = true;
+  _spooldata = SpoolData();
   bool success = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid.uidByte, &_uid.size, PN532_TIMEOUT);
 
   // have we found a MIFARE classic tag?
-  if (success && _uid.size == 4) {
-    _eKey = createKey(_uid);
-    bool unlocked = false;
-
-    // try authentification with created key
-    if (nfc->mifareclassic_AuthenticateBlock(_uid.uidByte, _uid.size, 7, 0, _eKey.keyByte)) {
-      _encrypted = true;
-      unlocked = true;
-    }
+  if (!success || _uid.size != 4)
+    return false;
 
-    // retry authentification with standard key
-    if (!_encrypted) {
-      nfc->reset();
-      delay(PN532_TIMEOUT);
-      nfc->wakeup();
-      success = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid.uidByte, &_uid.size, PN532_TIMEOUT);
-      if (success)
-        unlocked = nfc->mifareclassic_AuthenticateBlock(_uid.uidByte, _uid.size, 7, 0, const_cast<uint8_t*>(std_key.keyByte));
-    }
+  _eKey = createKey(_uid);
+  return true;
+}
 
-    if (!unlocked)
-      throw runtime_error("authentification failed");
-  } else {
-    throw runtime_error("No tag in proximity");
+bool CFSTag::authenticate(Adafruit_PN532* nfc) {
+  // try authentification with created key
+  if (nfc->mifareclassic_AuthenticateBlock(_uid.uidByte, _uid.size, 7, 0, _eKey.keyByte)) {
+    _encrypted = true;
+    return true;
   }
+
+  // retry authentification with standard key
+  nfc->reset();
+  delay(PN532_TIMEOUT);
+  nfc->wakeup();
+  if (!nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid.uidByte, &_uid.size, PN532_TIMEOUT))
+    return false;
+  return nfc->mifareclassic_AuthenticateBlock(_uid.uidByte, _uid.size, 7, 0, const_cast<uint8_t*>(std_key.keyByte));
 }
 
-static void dumpSpooldata(const CFSTag::MIFARE_tripleBlock& spooldata) {
-  // prepare dump of spooldata
-  std::string asciidump = "";
-  std::string hexdump = "";
-  char buffer[4];
-  for (char const& c : spooldata.data) {
-    // insert two spaces before each character
-    snprintf(buffer, sizeof(buffer), "  %c", isalnum(c) ? c : '.');
-    asciidump += buffer;
-    // make hex form character and add one space
-    snprintf(buffer, sizeof(buffer), " %02x", c);
-    hexdump += buffer;
-  }
-  LOGI(TAG, "  Ascii:");
-  LOGI(TAG, "        .0 .1 .2 .3 .4 .5 .6 .7");
-  for (size_t row = 0; row < 6; ++row) {
-    LOGI(TAG, "    %d. %s", row, asciidump.substr(row * 24, 24).c_str());
+// rows of 8 bytes, formatted straight into the log (compiled out below info level)
+static void dumpSpooldata(__unused const CFSTag::MIFARE_tripleBlock& spooldata) {
+#if APP_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+  char row[8 * 3 + 1];
+  LOGI_UNLIMITED(TAG, "  Ascii:");
+  LOGI_UNLIMITED(TAG, "        .0 .1 .2 .3 .4 .5 .6 .7");
+  for (size_t r = 0; r < 6; ++r) {
+    // two spaces before each character
+    for (size_t i = 0; i < 8; ++i) {
+      char c = spooldata.data[r * 8 + i];
+      snprintf(row + i * 3, 4, "  %c", isalnum(c) ? c : '.');
+    }
+    LOGI_UNLIMITED(TAG, "    %d. %s", r, row);
   }
-  LOGI(TAG, "  Hex:");
-  LOGI(TAG, "        .0 .1 .2 .3 .4 .5 .6 .7");
-  for (size_t row = 0; row < 6; ++row) {
-    LOGI(TAG, "    %d. %s", row, hexdump.substr(row * 24, 24).c_str());
+  LOGI_UNLIMITED(TAG, "  Hex:");
+  LOGI_UNLIMITED(TAG, "        .0 .1 .2 .3 .4 .5 .6 .7");
+  for (size_t r = 0; r < 6; ++r) {
+    for (size_t i = 0; i < 8; ++i)
+      snprintf(row + i * 3, 4, " %02x", static_cast<uint8_t>(spooldata.data[r * 8 + i]));
+    LOGI_UNLIMITED(TAG, "    %d. %s", r, row);
   }
+#endif
 }
 
 bool CFSTag::readSpoolData(Adafruit_PN532* nfc) {
@@ -94,8 +101,8 @@ bool CFSTag::readSpoolData(Adafruit_PN532* nfc) {
     plainData = encryptedData;
   }
 
-  // convert read (and decrypted) data to string
-  std::string spooldataStr = plainData.data;
+  // convert read (and decrypted) data to string (the blocks are not zero terminated)
+  std::string spooldataStr(plainData.data, strnlen(plainData.data, sizeof(plainData.data)));
 
   // empty (yet unwritten) tag?
   if (!spooldataStr.size()) { // yes, it's empty
@@ -108,7 +115,7 @@ bool CFSTag::readSpoolData(Adafruit_PN532* nfc) {
 
   // cleanup data
   // just remove everything after the last non-zero numeric
-  spooldataStr.erase(spooldataStr.find_last_of("123456789") + 1);
+  spooldataStr = _trimSpooldata(spooldataStr);
 
   // try to construct SpoolData from string
   try {
@@ -120,13 +127,13 @@ bool CFSTag::readSpoolData(Adafruit_PN532* nfc) {
   }
 
   // Everything went well, spooldata is available now
-  LOGI(TAG, "Spooldata read: %s", static_cast<std::string>(_spooldata).c_str());
+  LOGI_UNLIMITED(TAG, "Spooldata read: %s", static_cast<std::string>(_spooldata).c_str());
   dumpSpooldata(plainData);
   _validMaterial = true;
   return true;
 }
 
-bool CFSTag::writeSpoolData(Adafruit_PN532* nfc, SpoolData spooldata) {
+bool CFSTag::writeSpoolData(Adafruit_PN532* nfc, const SpoolData& spooldata) {
   MIFARE_tripleBlock plainData, encryptedData;
 
   // pad and copy spooldata into buffer
@@ -173,20 +180,24 @@ bool CFSTag::writeSpoolData(Adafruit_PN532* nfc, SpoolData spooldata) {
     }
   }
 
+  // the data was written encrypted and the tag is locked with our key now
+  _encrypted = true;
+  return true;
+}
+
+bool CFSTag::verifySpoolData(Adafruit_PN532* nfc, const SpoolData& spooldata) {
   // check the data that was just written
-  SpoolData written = _spooldata;
   if (!readSpoolData(nfc)) {
     LOGE(TAG, "Reading tag after writing failed!");
-    _spooldata = written;
     return false;
-  } else {
-    if (_spooldata == written) {
-      LOGI(TAG, "Writing spooldata successful");
-      return true;
-    } else {
-      LOGW(TAG, "Tag content doesn't match data to be written!");
-      _spooldata = written;
-      return false;
-    }
   }
+
+  // compare with the same padding removed as when reading
+  if (static_cast<std::string>(_spooldata) != _trimSpooldata(static_cast<std::string>(spooldata))) {
+    LOGW(TAG, "Tag content doesn't match data to be written!");
+    return false;
+  }
+
+  LOGI(TAG, "Writing spooldata successful");
+  return true;
 }
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <DeferredLog.h>
+
+#include <algorithm>
+#include <inttypes.h>
+
+void DeferredLog::begin(Scheduler* scheduler, WebSerial* webSerial) {
+  _scheduler = scheduler;
+  _webSerial = webSerial;
+
+  _drainTask = new Task(LOG_DEFERRED_INTERVAL, TASK_FOREVER, [&] { _drainCallback(); }, _scheduler, false, NULL, NULL, true);
+  _drainTask->enable();
+}
+
+void DeferredLog::end() {
+  if (_drainTask != nullptr) {
+    _drainTask->disable();
+    _drainTask = nullptr;
+  }
+  _webSerial = nullptr;
+}
+
+// format the records while somebody is listening or the scrollback keeps them (in the loop task)
+void DeferredLog::_drainCallback() {
+  bool listening = _webSerial != nullptr && _webSerial->wantsLines();
+  char line[LOG_DEFERRED_LINE];
+  LogRecord* record;
+  while ((record = _ring.front()) != nullptr) {
+    if (listening) {
+      uint32_t start = micros();
+      size_t length = _format(*record, line, sizeof(line) - 1);
+      line[length++] = '\n';
+      _webSerial->write(reinterpret_cast<const uint8_t*>(line), length);
+      _formatMicros += micros() - start;
+      _formatted++;
+    } else {
+      _discarded++;
+    }
+    _ring.release();
+  }
+}
+
+// "I     1234 1 (TAG) message", formats the arguments one conversion at a time
+size_t DeferredLog::_format(const LogRecord& record, char* line, size_t size) {
+  int prefix = snprintf(line, size, "%c %8" PRIu32 " %u (%s) ", _levelLetter(record.level), record.millis, record.core, record.tag);
+  size_t length = std::min(static_cast<size_t>(std::max(prefix, 0)), size - 1);
+  const uint8_t* arg = record.args;
+  uint8_t next = 0;
+
+  const char* f = record.format;
+  while (*f && length < size - 1) {
+    if (*f != '%') {
+      line[length++] = *f++;
+      continue;
+    }
+    if (f[1] == '%') {
+      line[length++] = '%';
+      f += 2;
+      continue;
+    }
+
+    // flags, width, precision, length modifier and conversion
+    char spec[16];
+    size_t s = 0;
+    spec[s++] = *f++;
+    while (*f && !strchr("diouxXeEfFgGaAcsp", *f) && s < sizeof(spec) - 2)
+      spec[s++] = *f++;
+    if (!*f)
+      break;
+    spec[s++] = *f++;
+    spec[s] = 0;
+
+    // a '*' width or precision takes an argument of its own
+    int star = 0;
+    bool hasStar = strchr(spec, '*') != nullptr;
+    if (hasStar && next < record.argc && record.types[next] == LogRecord::ArgType::INT32) {
+      int32_t value;
+      memcpy(&value, arg, sizeof(value));
+      arg += sizeof(value);
+      star = value;
+      next++;
+    }
+    if (next >= record.argc || record.types[next] == LogRecord::ArgType::MISSING) {
+      line[length++] = '?';
+      next++;
+      continue;
+    }
+
+    size_t room = size - length;
+    int written = 0;
+    switch (record.types[next++]) {
+      case LogRecord::ArgType::INT32: {
+        int32_t value;
+        memcpy(&value, arg, sizeof(value));
+        arg += sizeof(value);
+        written = hasStar ? snprintf(line + length, room, spec, star, value) : snprintf(line + length, room, spec, value);
+        break;
+      }
+      case LogRecord::ArgType::INT64: {
+        int64_t value;
+        memcpy(&value, arg, sizeof(value));
+        arg += sizeof(value);
+        written = hasStar ? snprintf(line + length, room, spec, star, value) : snprintf(line + length, room, spec, value);
+        break;
+      }
+      case LogRecord::ArgType::DOUBLE: {
+        double value;
+        memcpy(&value, arg, sizeof(value));
+        arg += sizeof(value);
+        written = hasStar ? snprintf(line + length, room, spec, star, value) : snprintf(line + length, room, spec, value);
+        break;
+      }
+      case LogRecord::ArgType::POINTER: {
+        const void* value;
+        memcpy(&value, arg, sizeof(value));
+        arg += sizeof(value);
+        written = hasStar ? snprintf(line + length, room, spec, star, value) : snprintf(line + length, room, spec, value);
+        break;
+      }
+      case LogRecord::ArgType::STRING: {
+        const char* value = reinterpret_cast<const char*>(arg);
+        arg += strlen(value) + 1;
+        written = hasStar ? snprintf(line + length, room, spec, star, value) : snprintf(line + length, room, spec, value);
+        break;
+      }
+      default:
+        break;
+    }
+    length += std::min(static_cast<size_t>(std::max(written, 0)), room - 1);
+  }
+  line[length] = 0;
+  return length;
+}
+
+char DeferredLog::_levelLetter(uint8_t level) {
+  switch (level) {
+    case ARDUHAL_LOG_LEVEL_ERROR:
+      return 'E';
+    case ARDUHAL_LOG_LEVEL_WARN:
+      return 'W';
+    case ARDUHAL_LOG_LEVEL_INFO:
+      return 'I';
+    case ARDUHAL_LOG_LEVEL_DEBUG:
+      return 'D';
+    default:
+      return 'V';
+  }
+}
+
+void DeferredLog::reportMetrics(JsonObject metrics) {
+  uint32_t formatted = _formatted;
+  metrics["formatted"] = formatted;
+  metrics["discarded"] = _discarded.load();
+  metrics["dropped"] = _dropped.load();
+  metrics["pending"] = _ring.size();
+  metrics["avgFormatMicros"] = formatted ? _formatMicros / formatted : 0;
+}
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <Deflater.h>
+#include <esp_rom_crc.h>
+
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+
+// length codes 257..285 and distance codes 0..29 (RFC 1951, 3.2.5)
+static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                          193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                          6145, 8193, 12289, 16385, 24577};
+static const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                          6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+bool GzipDeflater::begin() {
+  end();
+  _window = reinterpret_cast<uint8_t*>(malloc(2 * DEFLATE_WINDOW));
+  _head = reinterpret_cast<uint16_t*>(calloc(DEFLATE_HASH_SIZE, sizeof(uint16_t)));
+  _prev = reinterpret_cast<uint16_t*>(calloc(DEFLATE_WINDOW, sizeof(uint16_t)));
+  if (_window == nullptr || _head == nullptr || _prev == nullptr) {
+    end();
+    return false;
+  }
+  _pos = 0;
+  _end = 0;
+  _bitBuffer = 0;
+  _bitCount = 0;
+  _outLen = 0;
+  _sinkFailed = false;
+  _crc = 0;
+  _totalIn = 0;
+  _totalOut = 0;
+
+  // gzip header: ID1, ID2, CM (deflate), FLG, MTIME[4], XFL, OS (unknown)
+  static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+  for (uint8_t c : header)
+    _byte(c);
+  // one final block with fixed Huffman codes
+  _bits(1, 1);
+  _bits(1, 2);
+  return true;
+}
+
+void GzipDeflater::end() {
+  free(_window);
+  _window = nullptr;
+  free(_head);
+  _head = nullptr;
+  free(_prev);
+  _prev = nullptr;
+}
+
+bool GzipDeflater::write(const uint8_t* data, size_t len, Sink sink) {
+  if (_window == nullptr)
+    return false;
+  _sink = &sink;
+  _crc = esp_rom_crc32_le(_crc, data, len);
+  _totalIn += len;
+  while (len && !_sinkFailed) {
+    if (_end == 2 * DEFLATE_WINDOW) {
+      _compress(false);
+      _slide();
+    }
+    size_t count = min(len, 2 * DEFLATE_WINDOW - _end);
+    memcpy(_window + _end, data, count);
+    _end += count;
+    data += count;
+    len -= count;
+  }
+  _compress(false);
+  _drain();
+  _sink = nullptr;
+  return !_sinkFailed;
+}
+
+bool GzipDeflater::finish(Sink sink) {
+  if (_window == nullptr)
+    return false;
+  _sink = &sink;
+  _compress(true);
+  // end of block, pad to a full byte
+  _huffman(0, 7);
+  if (_bitCount)
+    _bits(0, 8 - _bitCount);
+  // trailer: CRC32 and size of the uncompressed data
+  for (uint8_t i = 0; i < 4; ++i)
+    _byte(_crc >> (8 * i));
+  for (uint8_t i = 0; i < 4; ++i)
+    _byte(_totalIn >> (8 * i));
+  _drain();
+  _sink = nullptr;
+  return !_sinkFailed;
+}
+
+// LZ77: emit the longest earlier match or a literal
+// without flush, a full match length is kept as lookahead
+void GzipDeflater::_compress(bool flush) {
+  while (_pos < _end && !_sinkFailed && (flush || _end - _pos >= DEFLATE_MAX_MATCH)) {
+    size_t maxLength = min<size_t>(DEFLATE_MAX_MATCH, _end - _pos);
+    size_t bestLength = 0;
+    size_t bestDistance = 0;
+    if (maxLength >= DEFLATE_MIN_MATCH) {
+      uint32_t hash = ((_window[_pos] << 16 | _window[_pos + 1] << 8 | _window[_pos + 2]) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+      uint16_t candidate = _head[hash];
+      for (uint16_t chain = 0; candidate && chain < DEFLATE_MAX_CHAIN; ++chain) {
+        size_t start = candidate - 1;
+        if (_pos - start > DEFLATE_WINDOW)
+          break;
+        if (_window[start + bestLength] == _window[_pos + bestLength]) {
+          size_t length = 0;
+          while (length < maxLength && _window[start + length] == _window[_pos + length])
+            length++;
+          if (length > bestLength) {
+            bestLength = length;
+            bestDistance = _pos - start;
+            if (length == maxLength)
+              break;
+          }
+        }
+        // older slots are reused, chains have to go backwards
+        candidate = _prev[start & (DEFLATE_WINDOW - 1)];
+        if (candidate > start)
+          break;
+      }
+    }
+
+    if (bestLength >= DEFLATE_MIN_MATCH) {
+      _match(bestLength, bestDistance);
+      for (size_t i = 0; i < bestLength; ++i)
+        _insert(_pos++);
+    } else {
+      _literal(_window[_pos]);
+      _insert(_pos++);
+    }
+  }
+}
+
+// move the second window to the first one, positions move along
+void GzipDeflater::_slide() {
+  memcpy(_window, _window + DEFLATE_WINDOW, DEFLATE_WINDOW);
+  _pos -= DEFLATE_WINDOW;
+  _end -= DEFLATE_WINDOW;
+  for (size_t i = 0; i < DEFLATE_HASH_SIZE; ++i)
+    _head[i] = _head[i] > DEFLATE_WINDOW ? _head[i] - DEFLATE_WINDOW : 0;
+  for (size_t i = 0; i < DEFLATE_WINDOW; ++i)
+    _prev[i] = _prev[i] > DEFLATE_WINDOW ? _prev[i] - DEFLATE_WINDOW : 0;
+}
+
+// remember a position for later matches
+void GzipDeflater::_insert(size_t pos) {
+  if (pos + DEFLATE_MIN_MATCH > _end)
+    return;
+  uint32_t hash = ((_window[pos] << 16 | _window[pos + 1] << 8 | _window[pos + 2]) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+  _prev[pos & (DEFLATE_WINDOW - 1)] = _head[hash];
+  _head[hash] = pos + 1;
+}
+
+void GzipDeflater::_literal(uint8_t c) {
+  if (c < 144) {
+    _huffman(0x30 + c, 8);
+  } else {
+    _huffman(0x190 + c - 144, 9);
+  }
+}
+
+void GzipDeflater::_match(size_t length, size_t distance) {
+  uint8_t code = 28;
+  while (length < lengthBase[code])
+    code--;
+  uint16_t symbol = 257 + code;
+  if (symbol < 280) {
+    _huffman(symbol - 256, 7);
+  } else {
+    _huffman(0xc0 + symbol - 280, 8);
+  }
+  _bits(length - lengthBase[code], lengthExtra[code]);
+
+  code = 29;
+  while (distance < distanceBase[code])
+    code--;
+  _huffman(code, 5);
+  _bits(distance - distanceBase[code], distanceExtra[code]);
+}
+
+// Huffman codes are packed starting with the most significant bit
+void GzipDeflater::_huffman(uint16_t code, uint8_t count) {
+  uint16_t reversed = 0;
+  for (uint8_t i = 0; i < count; ++i) {
+    reversed = (reversed << 1) | (code & 1);
+    code >>= 1;
+  }
+  _bits(reversed, count);
+}
+
+void GzipDeflater::_bits(uint32_t bits, uint8_t count) {
+  _bitBuffer |= bits << _bitCount;
+  _bitCount += count;
+  while (_bitCount >= 8) {
+    _byte(_bitBuffer & 0xff);
+    _bitBuffer >>= 8;
+    _bitCount -= 8;
+  }
+}
+
+void GzipDeflater::_byte(uint8_t c) {
+  _out[_outLen++] = c;
+  _totalOut++;
+  if (_outLen == sizeof(_out))
+    _drain();
+}
+
+bool GzipDeflater::_drain() {
+  if (!_outLen || _sink == nullptr)
+    return !_sinkFailed;
+  if (!_sinkFailed && !(*_sink)(_out, _outLen))
+    _sinkFailed = true;
+  _outLen = 0;
+  return !_sinkFailed;
+}
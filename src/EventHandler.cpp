@@ -38,6 +38,8 @@ void EventHandler::_networkStateCallback(Mycila::ESPConnect::State state) {
     case Mycila::ESPConnect::State::NETWORK_CONNECTED:
       LOGI(TAG, "--> Connected to network...");
       LOGI(TAG, "IPAddress: %s", _espNetwork->getESPConnect()->getIPAddress().toString().c_str());
+      // get the time for timestamps in the tag history
+      configTime(0, 0, NTP_SERVER);
       _srConnected.signalComplete();
       led.setMode(rfid.getStatus_as_LEDMode());
       break;
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <thingy.h>
+
+#include <algorithm>
+
+#define TAG "EventStream"
+
+static_assert((SSE_REPLAY_EVENTS & (SSE_REPLAY_EVENTS - 1)) == 0, "SSE_REPLAY_EVENTS must be a power of two");
+
+void EventStream::begin(Scheduler* scheduler) {
+  // Task handling
+  _scheduler = scheduler;
+  _clients.reserve(SSE_MAX_CLIENTS);
+
+  // ids of a previous boot should not match (Last-Event-ID is parsed as int)
+  _nextId = (esp_random() >> 2) + 1;
+
+  // record the tag events for the stream
+  tagEventBus.subscribe(TagEvent::mask(TagEvent::Type::TAG_ARRIVED) | TagEvent::mask(TagEvent::Type::TAG_LEFT) |
+                          TagEvent::mask(TagEvent::Type::READ_DONE) | TagEvent::mask(TagEvent::Type::WRITE_DONE) |
+                          TagEvent::mask(TagEvent::Type::ERROR),
+                        [&](const TagEvent& event) { _tagEventCallback(event); });
+
+  // create and run a task for setting up the endpoint
+  Task* streamTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _streamCallback(); }, _scheduler, false, NULL, NULL, true);
+  streamTask->enable();
+  streamTask->waitFor(webServerAPI.getStatusRequest());
+}
+
+void EventStream::end() {
+  if (_flushTask != nullptr) {
+    _flushTask->disable();
+    _flushTask = nullptr;
+  }
+  if (_started) {
+    _events.close();
+    _webServer->removeHandler(&_events);
+    _started = false;
+  }
+  std::lock_guard<std::mutex> lock(_clientsMutex);
+  _clients.clear();
+}
+
+// Add the event stream to the webserver
+void EventStream::_streamCallback() {
+  LOGD(TAG, "Starting EventStream...");
+
+  // send in the loop task only
+  _flushTask = new Task(SSE_FLUSH_INTERVAL, TASK_FOREVER, [&] { _flushCallback(); }, _scheduler, false, NULL, NULL, true);
+  _flushTask->enable();
+
+  // clients are only registered here, they are synced with the next flush
+  _events.onConnect([&](AsyncEventSourceClient* client) {
+    std::lock_guard<std::mutex> lock(_clientsMutex);
+    Client entry;
+    entry.client = client;
+    entry.lastId = client->lastId();
+    _clients.push_back(entry);
+    LOGD(TAG, "Client connected (Last-Event-ID: %" PRIu32 ")", entry.lastId);
+  });
+  _events.onDisconnect([&](AsyncEventSourceClient* client) {
+    std::lock_guard<std::mutex> lock(_clientsMutex);
+    _clients.erase(std::remove_if(_clients.begin(), _clients.end(), [client](const Client& entry) { return entry.client == client; }),
+                   _clients.end());
+  });
+  // clients beyond SSE_MAX_CLIENTS are turned away before they are added
+  // (closing them in onConnect would re-enter the library while it holds its client lock)
+  // the filter runs for every request, so only those for the stream count
+  _events.setFilter([&](AsyncWebServerRequest* request) {
+    if (eventHandler.getNetworkState() == Mycila::ESPConnect::State::PORTAL_STARTED)
+      return false;
+    if (request->url() == EVENT_STREAM_URL && _events.count() >= SSE_MAX_CLIENTS) {
+      _rejected++;
+      return false;
+    }
+    return true;
+  });
+  _webServer->addHandler(&_events);
+  _started = true;
+
+  LOGD(TAG, "...done!");
+}
+
+// Keep the event as a compact record (in the loop task)
+void EventStream::_tagEventCallback(const TagEvent& event) {
+  EventRecord& record = _records[_nextId & (SSE_REPLAY_EVENTS - 1)];
+  record = EventRecord();
+  record.id = _nextId;
+  record.uptime = event.timestamp;
+  memcpy(record.uid, event.tag.getUid().uidByte, sizeof(record.uid));
+  record.type = event.type;
+  record.success = event.success;
+  record.empty = event.tag.isEmpty();
+  if (event.type == TagEvent::Type::READ_DONE && event.success && !event.tag.isEmpty()) {
+    const SpoolData& spooldata = event.tag.getSpooldata();
+    strncpy(record.material, spooldata.getType().c_str(), sizeof(record.material) - 1);
+    record.color = spooldata.getColor();
+    record.weight = spooldata.getWeight();
+  }
+  _nextId++;
+
+  // don't wait for the next flush
+  _flushCallback();
+}
+
+void EventStream::_flushCallback() {
+  std::lock_guard<std::mutex> lock(_clientsMutex);
+  for (Client& client : _clients) {
+    if (!client.next)
+      _sync(client);
+
+    // the client fell behind more than the ring holds
+    if (_nextId - client.next > SSE_REPLAY_EVENTS) {
+      client.lastId = 0;
+      _sync(client);
+    }
+
+    while (client.next != _nextId) {
+      if (client.client->packetsWaiting() >= SSE_CLIENT_MAX_QUEUE) {
+        // catches up from the ring with a later flush
+        _deferred++;
+        break;
+      }
+      if (!_send(client, _records[client.next & (SSE_REPLAY_EVENTS - 1)]))
+        break;
+      client.next++;
+    }
+  }
+}
+
+// resume after Last-Event-ID, or tell the client to start over
+void EventStream::_sync(Client& client) {
+  bool known = client.lastId == _nextId - 1 ||
+               (_nextId - client.lastId <= SSE_REPLAY_EVENTS && _records[client.lastId & (SSE_REPLAY_EVENTS - 1)].id == client.lastId);
+  if (client.lastId && known) {
+    client.next = client.lastId + 1;
+    _resumed++;
+    return;
+  }
+
+  // the id makes a reconnect resume from here
+  char data[48];
+  snprintf(data, sizeof(data), "{\"uptime\":%" PRIu32 "}", millis());
+  client.client->send(data, "sync", _nextId - 1, SSE_RETRY);
+  client.next = _nextId;
+  _synced++;
+}
+
+bool EventStream::_send(Client& client, const EventRecord& record) {
+  char data[160];
+  int len = snprintf(data, sizeof(data), "{\"uptime\":%" PRIu32 ",\"uid\":\"%02x%02x%02x%02x\"", record.uptime, record.uid[0], record.uid[1],
+                     record.uid[2], record.uid[3]);
+  if (record.type == TagEvent::Type::READ_DONE || record.type == TagEvent::Type::WRITE_DONE)
+    len += snprintf(data + len, sizeof(data) - len, ",\"success\":%s", record.success ? "true" : "false");
+  if (record.type == TagEvent::Type::READ_DONE && record.success) {
+    len += snprintf(data + len, sizeof(data) - len, ",\"empty\":%s", record.empty ? "true" : "false");
+    if (!record.empty)
+      len += snprintf(data + len, sizeof(data) - len, ",\"type\":\"%.*s\",\"color\":\"#%06" PRIX32 "\",\"weight\":%u",
+                      static_cast<int>(sizeof(record.material)), record.material, record.color, record.weight);
+  }
+  snprintf(data + len, sizeof(data) - len, "}");
+
+  if (!client.client->send(data, _getEventName(record.type), record.id))
+    return false;
+  _sent++;
+  return true;
+}
+
+const char* EventStream::_getEventName(TagEvent::Type type) {
+  switch (type) {
+    case TagEvent::Type::TAG_ARRIVED:
+      return "arrived";
+    case TagEvent::Type::TAG_LEFT:
+      return "left";
+    case TagEvent::Type::READ_DONE:
+      return "read";
+    case TagEvent::Type::WRITE_DONE:
+      return "write";
+    case TagEvent::Type::ERROR:
+      return "error";
+    default:
+      return "state";
+  }
+}
+
+void EventStream::reportMetrics(JsonObject metrics) {
+  metrics["sent"] = _sent.load();
+  metrics["resumed"] = _resumed.load();
+  metrics["synced"] = _synced.load();
+  metrics["deferred"] = _deferred.load();
+  metrics["rejected"] = _rejected.load();
+  std::lock_guard<std::mutex> lock(_clientsMutex);
+  metrics["clients"] = _clients.size();
+}
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <Inflater.h>
+#include <esp_rom_crc.h>
+
+// gzip header flags
+#define GZIP_FHCRC    0x02
+#define GZIP_FEXTRA   0x04
+#define GZIP_FNAME    0x08
+#define GZIP_FCOMMENT 0x10
+
+bool GzipInflater::begin() {
+  end();
+  _decompressor = reinterpret_cast<tinfl_decompressor*>(malloc(sizeof(tinfl_decompressor)));
+  _dict = reinterpret_cast<uint8_t*>(malloc(TINFL_LZ_DICT_SIZE));
+  if (_decompressor == nullptr || _dict == nullptr) {
+    end();
+    _status = Status::ERROR;
+    return false;
+  }
+  tinfl_init(_decompressor);
+  _dictOffset = 0;
+  _phase = Phase::HEADER;
+  _status = Status::NEED_MORE;
+  _flags = 0;
+  _count = 0;
+  _skip = 0;
+  _crc = 0;
+  _totalOut = 0;
+  return true;
+}
+
+void GzipInflater::end() {
+  free(_decompressor);
+  _decompressor = nullptr;
+  free(_dict);
+  _dict = nullptr;
+}
+
+// parse the gzip header byte by byte, false on error
+bool GzipInflater::_header(uint8_t c) {
+  switch (_phase) {
+    case Phase::HEADER:
+      // ID1, ID2, CM, FLG, MTIME[4], XFL, OS
+      if ((_count == 0 && c != 0x1f) || (_count == 1 && c != 0x8b) || (_count == 2 && c != 8))
+        return false;
+      if (_count == 3)
+        _flags = c;
+      if (++_count == 10) {
+        _count = 0;
+        _phase = Phase::EXTRA_LEN;
+      }
+      break;
+
+    case Phase::EXTRA_LEN:
+      if (!(_flags & GZIP_FEXTRA)) {
+        _phase = Phase::NAME;
+        return _header(c);
+      }
+      _skip |= c << (8 * _count);
+      if (++_count == 2) {
+        _count = 0;
+        _phase = _skip ? Phase::EXTRA : Phase::NAME;
+      }
+      break;
+
+    case Phase::EXTRA:
+      if (--_skip == 0)
+        _phase = Phase::NAME;
+      break;
+
+    case Phase::NAME:
+      if (!(_flags & GZIP_FNAME)) {
+        _phase = Phase::COMMENT;
+        return _header(c);
+      }
+      if (c == 0)
+        _phase = Phase::COMMENT;
+      break;
+
+    case Phase::COMMENT:
+      if (!(_flags & GZIP_FCOMMENT)) {
+        _phase = Phase::HCRC;
+        return _header(c);
+      }
+      if (c == 0)
+        _phase = Phase::HCRC;
+      break;
+
+    case Phase::HCRC:
+      if (!(_flags & GZIP_FHCRC)) {
+        _phase = Phase::DEFLATE;
+        return false; // not a header byte
+      }
+      if (++_count == 2) {
+        _count = 0;
+        _phase = Phase::DEFLATE;
+      }
+      break;
+
+    default:
+      return false;
+  }
+  return true;
+}
+
+GzipInflater::Status GzipInflater::step(const uint8_t*& in, size_t& inLen, const uint8_t*& out, size_t& outLen) {
+  out = nullptr;
+  outLen = 0;
+  if (_status != Status::NEED_MORE)
+    return _status;
+
+  // header
+  while (inLen && _phase < Phase::DEFLATE) {
+    if (!_header(*in)) {
+      if (_phase != Phase::DEFLATE)
+        return _status = Status::ERROR;
+      break;
+    }
+    in++;
+    inLen--;
+  }
+
+  // compressed data, output goes into the dictionary (wrapping around)
+  if (_phase == Phase::DEFLATE) {
+    size_t inBytes = inLen;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - _dictOffset;
+    tinfl_status status = tinfl_decompress(_decompressor, in, &inBytes, _dict, _dict + _dictOffset, &outBytes, TINFL_FLAG_HAS_MORE_INPUT);
+    in += inBytes;
+    inLen -= inBytes;
+    out = _dict + _dictOffset;
+    outLen = outBytes;
+    _dictOffset = (_dictOffset + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+    _crc = esp_rom_crc32_le(_crc, out, outLen);
+    _totalOut += outLen;
+    if (status < TINFL_STATUS_DONE)
+      return _status = Status::ERROR;
+    if (status == TINFL_STATUS_DONE)
+      _phase = Phase::TRAILER;
+    // let the caller take the output before continuing
+    if (outLen)
+      return _status;
+  }
+
+  // trailer: CRC32 and size of the uncompressed data
+  while (inLen && _phase == Phase::TRAILER) {
+    _trailer[_count++] = *in++;
+    inLen--;
+    if (_count == sizeof(_trailer)) {
+      uint32_t crc = _trailer[0] | (_trailer[1] << 8) | (_trailer[2] << 16) | (_trailer[3] << 24);
+      uint32_t size = _trailer[4] | (_trailer[5] << 8) | (_trailer[6] << 16) | (_trailer[7] << 24);
+      _phase = Phase::FINISHED;
+      return _status = (crc == _crc && size == static_cast<uint32_t>(_totalOut)) ? Status::DONE : Status::ERROR;
+    }
+  }
+
+  return _status;
+}
+
+GzipInflater::Status GzipInflater::write(const uint8_t* data, size_t len, Sink sink) {
+  const uint8_t* out;
+  size_t outLen;
+  do {
+    step(data, len, out, outLen);
+    if (outLen && !sink(out, outLen))
+      return _status = Status::ERROR;
+  } while (_status == Status::NEED_MORE && (len || outLen));
+  return _status;
+}
+
+// get the next piece of output, false at the end of the stream
+bool InflateStream::_fill() {
+  while (!_outLen) {
+    if (_inflater.getStatus() != GzipInflater::Status::NEED_MORE)
+      return false;
+    if (!_inLen) {
+      int len = _file->read(_in, sizeof(_in));
+      if (len <= 0)
+        return false;
+      _inNext = _in;
+      _inLen = len;
+    }
+    _inflater.step(_inNext, _inLen, _out, _outLen);
+  }
+  return true;
+}
+
+int InflateStream::available() {
+  return _fill() ? _outLen : 0;
+}
+
+int InflateStream::read() {
+  if (!_fill())
+    return -1;
+  _outLen--;
+  return *_out++;
+}
+
+int InflateStream::peek() {
+  if (!_fill())
+    return -1;
+  return *_out;
+}
+
+size_t InflateStream::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length && _fill()) {
+    size_t len = min(length - count, _outLen);
+    memcpy(buffer + count, _out, len);
+    _out += len;
+    _outLen -= len;
+    count += len;
+  }
+  return count;
+}
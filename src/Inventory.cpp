@@ -0,0 +1,466 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <thingy.h>
+
+#include <algorithm>
+#include <time.h>
+
+#define TAG "Inventory"
+
+// anything before is not a synced time
+#define INVENTORY_MIN_VALID_TIME 1700000000
+
+void Inventory::begin(Scheduler* scheduler) {
+  // Task handling
+  _scheduler = scheduler;
+
+  // track spools being read or written
+  tagEventBus.subscribe(TagEvent::mask(TagEvent::Type::READ_DONE) | TagEvent::mask(TagEvent::Type::WRITE_DONE),
+                        [&](const TagEvent& event) { _tagEventCallback(event); });
+
+  // create and run a task for setting up the inventory (needs the filesystem)
+  Task* inventoryTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _inventoryCallback(); }, _scheduler, false, NULL, NULL, true);
+  inventoryTask->enable();
+  inventoryTask->waitFor(webServerAPI.getStatusRequest());
+}
+
+void Inventory::end() {
+  if (_flushTask != nullptr) {
+    _flushTask->disable();
+    _flushTask = nullptr;
+  }
+  flush();
+  _ready = false;
+  if (_getHandler != nullptr) {
+    _webServer->removeHandler(_getHandler);
+    _getHandler = nullptr;
+  }
+  if (_postHandler != nullptr) {
+    _webServer->removeHandler(_postHandler);
+    _postHandler = nullptr;
+  }
+}
+
+// Load the index and add the inventory endpoints to the webserver
+void Inventory::_inventoryCallback() {
+  LOGD(TAG, "Starting Inventory...");
+
+  if (!webServerAPI.isFSMounted()) {
+    LOGE(TAG, "Filesystem not mounted, inventory is disabled");
+    return;
+  }
+  _loadIndex();
+  _ready = true;
+
+  // merge pending changes in batches
+  _lastFlush = millis();
+  _flushTask = new Task(INVENTORY_FLUSH_POLL, TASK_FOREVER, [&] { _flushCallback(); }, _scheduler, false, NULL, NULL, true);
+  _flushTask->enable();
+
+  _getHandler = &_webServer->on("/api/inventory", HTTP_GET, [&](AsyncWebServerRequest* request) { _handleGet(request); });
+  _getHandler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+  _postHandler = &_webServer->on("/api/inventory", HTTP_POST, [&](AsyncWebServerRequest* request) { _handlePost(request); });
+  _postHandler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+
+  LOGD(TAG, "...done!");
+}
+
+// read all uids from the file (they are sorted already)
+void Inventory::_loadIndex() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  LittleFS.remove(INVENTORY_TMP_FILE);
+  _index.clear();
+
+  File file = LittleFS.open(INVENTORY_FILE, "r");
+  if (!file) {
+    LOGI(TAG, "Starting with an empty inventory");
+    return;
+  }
+  _index.reserve(file.size() / sizeof(InventoryRecord));
+  InventoryRecord record;
+  while (file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record)) {
+    if (!_index.empty() && record.key() <= _index.back()) {
+      LOGE(TAG, "Inventory is not sorted, ignoring the remainder");
+      break;
+    }
+    _index.push_back(record.key());
+  }
+  file.close();
+  LOGI(TAG, "Inventory holds %u spools", _index.size());
+}
+
+void Inventory::_tagEventCallback(const TagEvent& event) {
+  if (!event.success || event.tag.isEmpty())
+    return;
+
+  const SpoolData& spooldata = event.tag.getSpooldata();
+  std::string spooldataStr = static_cast<std::string>(spooldata);
+  time_t now = time(nullptr);
+  uint32_t timestamp = now > INVENTORY_MIN_VALID_TIME ? static_cast<uint32_t>(now) : 0;
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  InventoryRecord record;
+  bool known = _findLocked(InventoryRecord::key(event.tag.getUid().uidByte), record);
+  if (!known) {
+    record = InventoryRecord();
+    memcpy(record.uid, event.tag.getUid().uidByte, sizeof(record.uid));
+    record.firstSeen = timestamp;
+  }
+
+  // a new spool (or re-written tag) starts full
+  bool changed = strncmp(record.spooldata, spooldataStr.c_str(), sizeof(record.spooldata)) != 0;
+  if (!known || changed || event.type == TagEvent::Type::WRITE_DONE) {
+    record.weight = spooldata.getWeight();
+    record.remaining = record.weight;
+    memset(record.spooldata, 0, sizeof(record.spooldata));
+    memcpy(record.spooldata, spooldataStr.c_str(), min(spooldataStr.size(), sizeof(record.spooldata)));
+  }
+
+  record.lastSeen = timestamp;
+  if (event.type == TagEvent::Type::WRITE_DONE) {
+    record.writes++;
+  } else {
+    record.reads++;
+  }
+  _updateLocked(record);
+}
+
+bool Inventory::find(uint32_t key, InventoryRecord& record) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _findLocked(key, record);
+}
+
+size_t Inventory::size() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _index.size() + _newCount;
+}
+
+void Inventory::flush() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _flushLocked();
+}
+
+// merge every INVENTORY_FLUSH_INTERVAL, or right away when the webserver found the buffer full (in the loop task)
+void Inventory::_flushCallback() {
+  uint32_t now = millis();
+  if (!_flushWanted.exchange(false) && now - _lastFlush < INVENTORY_FLUSH_INTERVAL)
+    return;
+  _lastFlush = now;
+  flush();
+}
+
+// pending changes first, then binary search in the index
+bool Inventory::_findLocked(uint32_t key, InventoryRecord& record) {
+  InventoryRecord* pending = std::lower_bound(_pending, _pending + _pendingCount, key,
+                                              [](const InventoryRecord& lhs, uint32_t rhs) { return lhs.key() < rhs; });
+  if (pending != _pending + _pendingCount && pending->key() == key) {
+    record = *pending;
+    return true;
+  }
+
+  auto position = std::lower_bound(_index.begin(), _index.end(), key);
+  if (position == _index.end() || *position != key)
+    return false;
+  File file = LittleFS.open(INVENTORY_FILE, "r");
+  return _readRecord(file, position - _index.begin(), record);
+}
+
+bool Inventory::_readRecord(File& file, size_t position, InventoryRecord& record) {
+  if (!file)
+    return false;
+  size_t offset = position * sizeof(InventoryRecord);
+  if (file.position() != offset && !file.seek(offset))
+    return false;
+  if (file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) != sizeof(record))
+    return false;
+  return record.key() == _index[position];
+}
+
+// get the entry following after (or the very first one), pending changes take precedence
+bool Inventory::_nextLocked(File& file, uint32_t after, bool first, InventoryRecord& record) {
+  size_t position = first ? 0 : std::upper_bound(_index.begin(), _index.end(), after) - _index.begin();
+  InventoryRecord* pending = first ? _pending : std::upper_bound(_pending, _pending + _pendingCount, after, [](uint32_t lhs, const InventoryRecord& rhs) { return lhs < rhs.key(); });
+  bool hasFile = position < _index.size();
+  bool hasPending = pending != _pending + _pendingCount;
+
+  if (hasPending && (!hasFile || pending->key() <= _index[position])) {
+    record = *pending;
+    return true;
+  }
+  if (hasFile)
+    return _readRecord(file, position, record);
+  return false;
+}
+
+// put a changed record into the pending buffer, false when it wasn't taken
+// - a full buffer is merged into the file first, unless flush is false (the webserver must not rewrite the file)
+bool Inventory::_updateLocked(const InventoryRecord& record, bool flush) {
+  uint32_t key = record.key();
+  InventoryRecord* pending = std::lower_bound(_pending, _pending + _pendingCount, key,
+                                              [](const InventoryRecord& lhs, uint32_t rhs) { return lhs.key() < rhs; });
+  if (pending != _pending + _pendingCount && pending->key() == key) {
+    *pending = record;
+    return true;
+  }
+
+  bool known = std::binary_search(_index.begin(), _index.end(), key);
+  if (!known && _index.size() + _newCount >= INVENTORY_MAX_ENTRIES) {
+    LOGW(TAG, "Inventory is full, spool not added");
+    return false;
+  }
+
+  // make room
+  if (_pendingCount == INVENTORY_PENDING_RECORDS) {
+    if (!flush)
+      return false;
+    _flushLocked();
+    if (_pendingCount == INVENTORY_PENDING_RECORDS) {
+      LOGE(TAG, "Inventory update lost");
+      return false;
+    }
+    pending = std::lower_bound(_pending, _pending + _pendingCount, key,
+                               [](const InventoryRecord& lhs, uint32_t rhs) { return lhs.key() < rhs; });
+  }
+
+  memmove(pending + 1, pending, (_pending + _pendingCount - pending) * sizeof(InventoryRecord));
+  *pending = record;
+  _pendingCount++;
+  if (!known)
+    _newCount++;
+  return true;
+}
+
+// merge the sorted file with the sorted pending records into a new file and replace the old one
+void Inventory::_flushLocked() {
+  if (!_ready || !_pendingCount)
+    return;
+
+  File in = LittleFS.open(INVENTORY_FILE, "r");
+  File out = LittleFS.open(INVENTORY_TMP_FILE, "w");
+  if (!out) {
+    LOGE(TAG, "Opening %s failed", INVENTORY_TMP_FILE);
+    return;
+  }
+
+  std::vector<uint32_t> index;
+  index.reserve(_index.size() + _newCount);
+  size_t position = 0;
+  size_t pending = 0;
+  bool success = true;
+  InventoryRecord record;
+  while (success && (position < _index.size() || pending < _pendingCount)) {
+    if (pending < _pendingCount && (position == _index.size() || _pending[pending].key() <= _index[position])) {
+      // replaced or new record
+      if (position < _index.size() && _pending[pending].key() == _index[position])
+        position++;
+      record = _pending[pending++];
+    } else {
+      success = _readRecord(in, position++, record);
+    }
+    success = success && out.write(reinterpret_cast<const uint8_t*>(&record), sizeof(record)) == sizeof(record);
+    index.push_back(record.key());
+  }
+  in.close();
+  out.close();
+
+  if (!success || !LittleFS.rename(INVENTORY_TMP_FILE, INVENTORY_FILE)) {
+    LOGE(TAG, "Writing the inventory failed");
+    LittleFS.remove(INVENTORY_TMP_FILE);
+    return;
+  }
+
+  LOGD(TAG, "Merged %u changes into the inventory", _pendingCount);
+  _generation++;
+  _index.swap(index);
+  _pendingCount = 0;
+  _newCount = 0;
+}
+
+// GET /api/inventory?uid=<uid>
+// GET /api/inventory?after=<uid>&limit=<n>&type=<type>&color=<RRGGBB>
+// entries are sorted by uid, the response carries the uid to continue after
+void Inventory::_handleGet(AsyncWebServerRequest* request) {
+  if (request->hasParam("uid")) {
+    InventoryRecord record;
+    if (!find(strtoul(request->getParam("uid")->value().c_str(), nullptr, 16), record)) {
+      request->send(404, "text/plain", "Unknown spool");
+      return;
+    }
+    JsonDocument jsonMsg;
+    _toJson(record, jsonMsg.to<JsonObject>());
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    serializeJson(jsonMsg, *response);
+    request->send(response);
+    return;
+  }
+
+  std::shared_ptr<Reader> reader = std::make_shared<Reader>();
+  if (request->hasParam("after")) {
+    reader->after = strtoul(request->getParam("after")->value().c_str(), nullptr, 16);
+    reader->first = false;
+  }
+  if (request->hasParam("limit"))
+    reader->limit = constrain(strtoul(request->getParam("limit")->value().c_str(), nullptr, 10), 1UL, static_cast<unsigned long>(INVENTORY_MAX_ENTRIES));
+  if (request->hasParam("type"))
+    reader->type = request->getParam("type")->value().c_str();
+  if (request->hasParam("color")) {
+    const String& color = request->getParam("color")->value();
+    reader->color = strtoul(color.c_str() + (color.startsWith("#") ? 1 : 0), nullptr, 16);
+    reader->filterColor = true;
+  }
+
+  AsyncWebServerResponse* response = request->beginChunkedResponse("application/json",
+                                                                   [this, reader](uint8_t* buffer, size_t maxLen, __unused size_t index) -> size_t {
+                                                                     return _fill(*reader, buffer, maxLen);
+                                                                   });
+  request->send(response);
+}
+
+// POST /api/inventory with uid=<uid>&remaining=<g>
+// set the remaining weight, e.g. after weighing the spool
+void Inventory::_handlePost(AsyncWebServerRequest* request) {
+  if (!request->hasParam("uid", true) || !request->hasParam("remaining", true)) {
+    request->send(400, "text/plain", "uid and remaining are required");
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  InventoryRecord record;
+  if (!_findLocked(strtoul(request->getParam("uid", true)->value().c_str(), nullptr, 16), record)) {
+    request->send(404, "text/plain", "Unknown spool");
+    return;
+  }
+  record.remaining = min<uint32_t>(strtoul(request->getParam("remaining", true)->value().c_str(), nullptr, 10), UINT16_MAX);
+  // the loop task merges the full buffer, the client retries after that
+  if (!_updateLocked(record, false)) {
+    _flushWanted = true;
+    AsyncWebServerResponse* response = request->beginResponse(503, "text/plain", "Inventory is busy, retry later");
+    response->addHeader("Retry-After", "1");
+    request->send(response);
+    return;
+  }
+  request->send(200, "text/plain", "OK");
+}
+
+// copy as much of the output as fits into the chunk
+// a scan batch without a match ends the chunk early (or retries it when nothing was copied yet)
+size_t Inventory::_fill(Reader& reader, uint8_t* buffer, size_t maxLen) {
+  size_t len = 0;
+  while (len < maxLen) {
+    if (reader.offset >= reader.line.size()) {
+      if (!_nextLine(reader))
+        break;
+      if (reader.line.empty())
+        return len ? len : RESPONSE_TRY_AGAIN;
+    }
+    size_t count = min(maxLen - len, reader.line.size() - reader.offset);
+    memcpy(buffer + len, reader.line.data() + reader.offset, count);
+    len += count;
+    reader.offset += count;
+  }
+  return len;
+}
+
+// prepare the next piece of output, false when done
+// the position is kept as uid, so merging in between requests or chunks doesn't matter
+bool Inventory::_nextLine(Reader& reader) {
+  char trailer[32];
+  reader.line.clear();
+  reader.offset = 0;
+
+  switch (reader.phase) {
+    case Reader::Phase::HEADER:
+      reader.phase = Reader::Phase::ENTRIES;
+      reader.line = "{\"count\":" + std::to_string(size()) + ",\"entries\":[";
+      return true;
+
+    case Reader::Phase::ENTRIES:
+      if (reader.count < reader.limit) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!reader.file || reader.generation != _generation) {
+          reader.file = LittleFS.open(INVENTORY_FILE, "r");
+          reader.generation = _generation;
+        }
+        InventoryRecord record;
+        for (size_t scanned = 0; scanned < INVENTORY_SCAN_BATCH; ++scanned) {
+          if (!_nextLocked(reader.file, reader.after, reader.first, record)) {
+            reader.exhausted = true;
+            break;
+          }
+          reader.after = record.key();
+          reader.first = false;
+          if (_match(reader, record)) {
+            JsonDocument jsonMsg;
+            _toJson(record, jsonMsg.to<JsonObject>());
+            if (reader.count++)
+              reader.line = ",";
+            serializeJson(jsonMsg, reader.line);
+            return true;
+          }
+        }
+        // no match in this batch, continue with the next chunk without holding up the writers
+        if (!reader.exhausted)
+          return true;
+      }
+      reader.phase = Reader::Phase::TRAILER;
+      // fall through
+
+    case Reader::Phase::TRAILER:
+      reader.phase = Reader::Phase::DONE;
+      if (reader.exhausted || reader.first) {
+        reader.line = "],\"next\":null}";
+      } else {
+        snprintf(trailer, sizeof(trailer), "],\"next\":\"%08lx\"}", static_cast<unsigned long>(reader.after));
+        reader.line = trailer;
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+bool Inventory::_match(const Reader& reader, const InventoryRecord& record) {
+  if (reader.type.empty() && !reader.filterColor)
+    return true;
+  try {
+    SpoolData spooldata(std::string(record.spooldata, strnlen(record.spooldata, sizeof(record.spooldata))));
+    if (!reader.type.empty() && spooldata.getType() != reader.type)
+      return false;
+    if (reader.filterColor && spooldata.getColor() != reader.color)
+      return false;
+    return true;
+  } catch (const std::exception& e) {
+    return false;
+  }
+}
+
+void Inventory::_toJson(const InventoryRecord& record, const JsonObject& entry) {
+  char uid[9];
+  snprintf(uid, sizeof(uid), "%02x%02x%02x%02x", record.uid[0], record.uid[1], record.uid[2], record.uid[3]);
+  entry["uid"] = uid;
+  entry["firstSeen"] = record.firstSeen;
+  entry["lastSeen"] = record.lastSeen;
+  entry["reads"] = record.reads;
+  entry["writes"] = record.writes;
+  entry["weight"] = record.weight;
+  entry["remaining"] = record.remaining;
+
+  std::string spooldataStr(record.spooldata, strnlen(record.spooldata, sizeof(record.spooldata)));
+  entry["spooldata"] = spooldataStr;
+  try {
+    SpoolData spooldata(spooldataStr);
+    entry["type"] = spooldata.getType();
+    entry["color"] = spooldata.getColorString();
+  } catch (const std::exception& e) {
+    entry["type"] = nullptr;
+    entry["color"] = nullptr;
+  }
+}
@@ -3,9 +3,12 @@
  * Copyright (C) 2025 Robert Wendlandt
  */
 
-#include <math.h>
 #include <thingy.h>
 
+#include <algorithm>
+#include <esp_heap_caps.h>
+#include <math.h>
+
 #define TAG "RFID"
 
 #define LEDC_DUTY_RES    (8)
@@ -17,6 +20,68 @@
 #define DEFAULT_SAT      240
 #define DEFAULT_VALUE    255
 
+// breathing from 0 to 100: (exp(sin(t)) - 1/e) * 42.546, 50 keyframes per period
+static constexpr uint8_t LEVELS_BREATHING[] = {26, 32, 38, 45, 53, 60, 68, 76, 83, 89, 94, 97, 99, 99, 97, 94, 89,
+                                               83, 76, 68, 60, 53, 45, 38, 32, 26, 21, 17, 13, 10, 7,  5,  4,  2,
+                                               1,  0,  0,  0,  0,  0,  0,  1,  2,  4,  5,  7,  10, 13, 17, 21};
+static constexpr uint8_t LEVELS_BLINK[] = {LED_BRIGHT_DIM, LED_BRIGHT_OFF};
+static constexpr uint8_t LEVELS_DIM[] = {LED_BRIGHT_DIM};
+static constexpr uint8_t LEVELS_FLASH[] = {LED_BRIGHT_FULL};
+static constexpr uint8_t LEVELS_OFF[] = {LED_BRIGHT_OFF};
+
+// keyframes per LEDMode (same order)
+static constexpr LED::Animation ANIMATIONS[] = {
+  {LEVELS_OFF, sizeof(LEVELS_OFF), 1, 0, HUE_BLUE, 0, false, false},                         // NONE
+  {LEVELS_BLINK, sizeof(LEVELS_BLINK), 1, 400, HUE_BLUE, 0, false, false},                   // WAITING_WIFI: blinking white
+  {LEVELS_BLINK, sizeof(LEVELS_BLINK), 1, 100, HUE_BLUE, 0, false, false},                   // WAITING_CAPTIVE: fast blinking white
+  {LEVELS_DIM, sizeof(LEVELS_DIM), 1, 0, HUE_BLUE, DEFAULT_SAT, false, false},               // WAITING_READ: dim solid blue
+  {LEVELS_FLASH, sizeof(LEVELS_FLASH), 1, 250, HUE_BLUE, DEFAULT_SAT, false, true},          // TAG_READ: flash blue
+  {LEVELS_BREATHING, sizeof(LEVELS_BREATHING), 1, 40, HUE_GREEN, DEFAULT_SAT, true, false},  // ARMED_WRITING: breathing green (2 s)
+  {LEVELS_BREATHING, sizeof(LEVELS_BREATHING), 2, 40, HUE_RED, DEFAULT_SAT, true, false},    // ARMED_REWRITING: breathing red (1 s)
+  {LEVELS_FLASH, sizeof(LEVELS_FLASH), 1, 250, HUE_GREEN, DEFAULT_SAT, false, true},         // TAG_WRITTEN: flash green
+  {LEVELS_FLASH, sizeof(LEVELS_FLASH), 1, 250, HUE_RED, DEFAULT_SAT, false, true},           // TAG_REWRITTEN: flash red
+  {LEVELS_BLINK, sizeof(LEVELS_BLINK), 1, 100, HUE_RED, DEFAULT_SAT, false, false},          // ERROR: fast blinking red
+};
+static_assert(sizeof(ANIMATIONS) / sizeof(ANIMATIONS[0]) == static_cast<size_t>(LED::LEDMode::ERROR) + 1, "an animation per LEDMode");
+
+// WS2812 symbols at 10 MHz (as rgbLedWrite): 0 is 0.4 us high and 0.8 us low, 1 is 0.8 us high and 0.4 us low
+#define RMT_RESOLUTION    10000000
+#define RMT_TICKS_PER_MS  (RMT_RESOLUTION / 1000)
+#define RMT_BIT_TICKS     12
+#define RMT_FRAME_SYMBOLS 24
+#define RMT_RESET_TICKS   3000
+#define RMT_MAX_DURATION  32767
+#define RMT_MEM_SYMBOLS   (SOC_RMT_MEM_WORDS_PER_CHANNEL * LED_RMT_MEM_BLOCKS)
+
+// low symbols to hold a frame for ms
+static constexpr size_t rmtIdleSymbols(uint32_t ms) {
+  return ms * RMT_TICKS_PER_MS / (2 * RMT_MAX_DURATION) + 1;
+}
+
+// a period of the animation, or a single frame when it's static or a flash
+static constexpr size_t rmtSymbols(const LED::Animation& animation) {
+  if (animation.count == 1 || animation.oneShot)
+    return RMT_FRAME_SYMBOLS + rmtIdleSymbols(0);
+  return animation.count / animation.stride * (RMT_FRAME_SYMBOLS + rmtIdleSymbols(animation.interval));
+}
+
+static constexpr size_t rmtMaxSymbols() {
+  size_t symbols = 0;
+  for (const LED::Animation& animation : ANIMATIONS)
+    symbols = std::max(symbols, rmtSymbols(animation));
+  return symbols;
+}
+
+// a fade ends on a keyframe, the keyframes wrap around
+static constexpr bool fadesFit() {
+  for (const LED::Animation& animation : ANIMATIONS) {
+    if (animation.fade && animation.count % (animation.stride * LED_FADE_STEPS))
+      return false;
+  }
+  return true;
+}
+static_assert(fadesFit(), "the keyframes of a fading animation must be a multiple of stride * LED_FADE_STEPS");
+
 // const char* fmtMemCk = "Free: %d MaxAlloc: %d PSFree: %d";
 // #define MEMCK LOGD(TAG, fmtMemCk, ESP.getFreeHeap(), ESP.getMaxAllocHeap(), ESP.getFreePsram())
 
@@ -27,6 +92,13 @@ void LED::begin(Scheduler* scheduler) {
   // create and run a task for setting up the led
   Task* ledInitTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _ledInitCallback(); }, _scheduler, false, NULL, NULL, true);
   ledInitTask->enable();
+
+  // show reader state and tag events
+  tagEventBus.subscribe(TagEvent::mask(TagEvent::Type::READ_DONE) |
+                          TagEvent::mask(TagEvent::Type::WRITE_DONE) |
+                          TagEvent::mask(TagEvent::Type::ERROR) |
+                          TagEvent::mask(TagEvent::Type::STATE_CHANGED),
+                        [&](const TagEvent& event) { _tagEventCallback(event); });
 }
 
 void LED::end() {
@@ -46,215 +118,323 @@ void LED::_ledInitCallback() {
   if (!_isRGB) {
     ledcAttach(_ledPin, LEDC_FREQ, LEDC_DUTY_RES);
     ledcWrite(_ledPin, 0);
+#if LED_HW_EFFECTS
+    _backend = Backend::LEDC_FADE;
+#endif
   }
 
+#if LED_HW_EFFECTS
+  // use an RMT channel of our own for RGB LEDs, with a buffer for the longest period
+  if (_isRGB) {
+    _symbols = static_cast<rmt_data_t*>(heap_caps_malloc(rmtMaxSymbols() * sizeof(rmt_data_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    if (_symbols != nullptr && rmtInit(_rmtPin(), RMT_TX_MODE, static_cast<rmt_reserve_memsize_t>(LED_RMT_MEM_BLOCKS), RMT_RESOLUTION)) {
+      _backend = Backend::RMT;
+    } else {
+      LOGW(TAG, "No RMT channel for the LED, stepping keyframes instead");
+      free(_symbols);
+      _symbols = nullptr;
+    }
+  }
+#endif
+  LOGD(TAG, "Effects by %s", _getBackendName(_backend));
+
+  // the only task for all modes, enabled while a mode has keyframes to step through
+  _ledTask = new Task(TASK_IMMEDIATE, TASK_FOREVER, [&] { _animationCallback(); }, _scheduler, false, NULL, NULL, false);
+
   // set current mode to none
   _mode = LEDMode::NONE;
+  _modeSince = millis();
   setMode(LEDMode::WAITING_WIFI);
 }
 
+// Map tag events to LED modes
+void LED::_tagEventCallback(const TagEvent& event) {
+  switch (event.type) {
+    case TagEvent::Type::READ_DONE:
+      // Only signal when writing isn't enabled
+      if (!event.armed)
+        setMode(LEDMode::TAG_READ);
+      break;
+    case TagEvent::Type::WRITE_DONE:
+      if (event.success)
+        setMode(event.overwrite ? LEDMode::TAG_REWRITTEN : LEDMode::TAG_WRITTEN);
+      break;
+    case TagEvent::Type::ERROR:
+      setMode(LEDMode::ERROR);
+      break;
+    case TagEvent::Type::STATE_CHANGED:
+      if (!event.reader) {
+        setMode(LEDMode::ERROR);
+      } else if (event.armed && event.overwrite) {
+        setMode(LEDMode::ARMED_REWRITING);
+      } else if (event.armed) {
+        setMode(LEDMode::ARMED_WRITING);
+      } else {
+        setMode(LEDMode::WAITING_READ);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
 void LED::setMode(LEDMode mode) {
+  const Animation* animation = &ANIMATIONS[static_cast<uint8_t>(mode)];
+
+  // a flash shows to its end, then returns to the latest mode
+  if (!animation->oneShot) {
+    _baseMode = mode;
+    if (_animation != nullptr && _animation->oneShot)
+      return;
+  }
+
   // Nothing to do
-  if (_mode == mode)
+  if (_mode == mode && !animation->oneShot)
     return;
 
-  // disable the current task
-  if (_ledTask != nullptr) {
+  // set the new mode
+  _account(millis());
+  _mode = mode;
+  if (_ledTask == nullptr)
+    return;
+  _animation = animation;
+  _start();
+}
+
+void LED::_start() {
+  _frame = 0;
+  if (_backend == Backend::RMT) {
+    _render();
+    _transmit();
+  }
+  // not an else, the RMT channel may have been lost
+  uint8_t steps = _steps();
+  if (_backend != Backend::RMT)
+    _show(_animation->levels[0], steps);
+
+  // step through the keyframes, a single keyframe is static
+  if (_animation->count > 1 || _animation->oneShot) {
+    uint32_t interval = _animation->interval * steps;
+    _ledTask->setInterval(interval);
+    _ledTask->restartDelayed(interval);
+  } else {
     _ledTask->disable();
-    _ledTask = nullptr;
   }
+}
 
-  // set the new mode
-  _mode = mode;
-  switch (_mode) {
-    case LEDMode::WAITING_WIFI: {
-      if (!_isRGB) {
-        ledcWrite(_ledPin, LED_BRIGHT_OFF);
-      } else {
-        _ledState = 0;
-        rgbLedWrite(_ledPin, 0, 0, 0);
-      }
-      // Set LED to blinking / blinking white
-      _ledTask = new Task(400, TASK_FOREVER, [&] {
-        if (!_isRGB) {
-          if (ledcRead(_ledPin) == LED_BRIGHT_DIM) {
-            ledcWrite(_ledPin, LED_BRIGHT_OFF);
-          } else {
-            ledcWrite(_ledPin, LED_BRIGHT_DIM);
-          }
-        } else {
-          CRGB led_color(CRGB::HTMLColorCode::Black);
-          if (!_ledState) {
-            led_color = CRGB(CHSV(HUE_BLUE, 0, LED_BRIGHT_DIM));
-            _adjustLed(&led_color, _colorAdjustment);
-            _ledState = 1;
-          } else {
-            _ledState = 0;
-          }
-          rgbLedWrite(_ledPin, led_color.red, led_color.green, led_color.blue);
-        } }, _scheduler, false, NULL, NULL, true);
-      _ledTask->enable();
-    } break;
-
-    case LEDMode::ERROR: {
-      if (!_isRGB) {
-        ledcWrite(_ledPin, LED_BRIGHT_OFF);
-      } else {
-        _ledState = 0;
-        rgbLedWrite(_ledPin, 0, 0, 0);
-      }
-      // Set LED to fast blinking / fast blinking red
-      _ledTask = new Task(100, TASK_FOREVER, [&] {
-        if (!_isRGB) {
-          if (ledcRead(_ledPin) == LED_BRIGHT_DIM) {
-            ledcWrite(_ledPin, LED_BRIGHT_OFF);
-          } else {
-            ledcWrite(_ledPin, LED_BRIGHT_DIM);
-          }
-        } else {
-          CRGB led_color(CRGB::HTMLColorCode::Black);
-          if (!_ledState) {
-            led_color = CRGB(CHSV(HUE_RED, DEFAULT_SAT, LED_BRIGHT_DIM));
-            _adjustLed(&led_color, _colorAdjustment);
-            _ledState = 1;
-          } else {
-            _ledState = 0;
-          }
-          rgbLedWrite(_ledPin, led_color.red, led_color.green, led_color.blue);
-        } }, _scheduler, false, NULL, NULL, true);
-      _ledTask->enable();
-    } break;
-    case LEDMode::WAITING_CAPTIVE: {
-      if (!_isRGB) {
-        ledcWrite(_ledPin, LED_BRIGHT_OFF);
-      } else {
-        _ledState = 0;
-        rgbLedWrite(_ledPin, 0, 0, 0);
-      }
-      // Set LED to fast blinking / fast blinking white
-      _ledTask = new Task(100, TASK_FOREVER, [&] {
-        if (!_isRGB) {
-          if (ledcRead(_ledPin) == LED_BRIGHT_DIM) {
-            ledcWrite(_ledPin, LED_BRIGHT_OFF);
-          } else {
-            ledcWrite(_ledPin, LED_BRIGHT_DIM);
-          }
-        } else {
-          CRGB led_color(CRGB::HTMLColorCode::Black);
-          if (!_ledState) {
-            led_color = CRGB(CHSV(HUE_BLUE, 0, LED_BRIGHT_DIM));
-            _adjustLed(&led_color, _colorAdjustment);
-            _ledState = 1;
-          } else {
-            _ledState = 0;
-          }
-          rgbLedWrite(_ledPin, led_color.red, led_color.green, led_color.blue);
-        } }, _scheduler, false, NULL, NULL, true);
-      _ledTask->enable();
-    } break;
-    case LEDMode::WAITING_READ: {
-      // set LED to dim solid / dim solid white
-      if (!_isRGB) {
-        ledcWrite(_ledPin, LED_BRIGHT_DIM);
-      } else {
-        CRGB led_color(CHSV(HUE_BLUE, DEFAULT_SAT, LED_BRIGHT_DIM));
-        _adjustLed(&led_color, _colorAdjustment);
-        rgbLedWrite(_ledPin, led_color.red, led_color.green, led_color.blue);
-      }
-    } break;
-    case LEDMode::TAG_READ: {
-      // schedule a task for resetting the brighness to previous level
-      Task* resetTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { setMode(LEDMode::WAITING_READ); }, _scheduler, false, NULL, NULL, true);
-
-      // Flash the LED
-      if (!_isRGB) {
-        ledcWrite(_ledPin, LED_BRIGHT_FULL);
-      } else {
-        CRGB led_color(CHSV(HUE_BLUE, DEFAULT_SAT, LED_BRIGHT_FULL));
-        _adjustLed(&led_color, _colorAdjustment);
-        rgbLedWrite(_ledPin, led_color.red, led_color.green, led_color.blue);
-      }
+void LED::_animationCallback() {
+  _countWakeups(1);
 
-      // Start the task to reset to WAITING_READ
-      resetTask->enableDelayed(250);
-    } break;
-    case LEDMode::ARMED_WRITING: {
-      if (!_isRGB) {
-        ledcWrite(_ledPin, LED_BRIGHT_OFF);
-      } else {
-        _ledState = 0;
-        rgbLedWrite(_ledPin, 0, 0, 0);
-      }
-      // Set LED to breathing / breathing green
-      _ledTask = new Task(40, TASK_FOREVER, [&] {
-        // breathing from 0 to 100
-        uint8_t brightness = (exp(sin(millis() / 1000.0 * PI)) - 0.368) * 42.546;
-        if (!_isRGB) {
-          ledcWrite(_ledPin, brightness);
-        } else {
-          CRGB led_color(CHSV(HUE_GREEN, DEFAULT_SAT, brightness));
-          _adjustLed(&led_color, _colorAdjustment);
-          rgbLedWrite(_ledPin, led_color.red, led_color.green, led_color.blue);
-        } }, _scheduler, false, NULL, NULL, true);
-      _ledTask->enable();
-    } break;
-    case LEDMode::ARMED_REWRITING: {
-      if (!_isRGB) {
-        ledcWrite(_ledPin, LED_BRIGHT_OFF);
-      } else {
-        _ledState = 0;
-        rgbLedWrite(_ledPin, 0, 0, 0);
-      }
-      // Set LED to fast breathing / breathing pulsing red
-      _ledTask = new Task(40, TASK_FOREVER, [&] {
-        // breathing from 0 to 100
-        uint8_t brightness = (exp(sin(millis() / 500.0 * PI)) - 0.368) * 42.546;
-        if (!_isRGB) {
-          ledcWrite(_ledPin, brightness);
-        } else {
-          CRGB led_color(CHSV(HUE_RED, DEFAULT_SAT, brightness));
-          _adjustLed(&led_color, _colorAdjustment);
-          rgbLedWrite(_ledPin, led_color.red, led_color.green, led_color.blue);
-        } }, _scheduler, false, NULL, NULL, true);
-      _ledTask->enable();
-    } break;
-    case LEDMode::TAG_WRITTEN: {
-      // schedule a task for resetting the brighness to previous level
-      Task* resetTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { setMode(LEDMode::ARMED_WRITING); }, _scheduler, false, NULL, NULL, true);
-
-      // Flash the LED
-      if (!_isRGB) {
-        ledcWrite(_ledPin, LED_BRIGHT_FULL);
-      } else {
-        CRGB led_color(CHSV(HUE_GREEN, DEFAULT_SAT, LED_BRIGHT_FULL));
-        _adjustLed(&led_color, _colorAdjustment);
-        rgbLedWrite(_ledPin, led_color.red, led_color.green, led_color.blue);
-      }
+  // the period was rendered already, send it again
+  if (_backend == Backend::RMT && !_animation->oneShot) {
+    if (!rmtTransmitCompleted(_rmtPin())) {
+      _ledTask->delay(LED_RMT_REARM_MARGIN);
+      return;
+    }
+    if (!_transmit())
+      _start();
+    return;
+  }
 
-      // Start the task to reset to previous state
-      resetTask->enableDelayed(250);
-    } break;
-    case LEDMode::TAG_REWRITTEN: {
-      // schedule a task for resetting the brighness to previous level
-      Task* resetTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { setMode(LEDMode::ARMED_REWRITING); }, _scheduler, false, NULL, NULL, true);
+  uint8_t steps = _steps();
+  _frame += _animation->stride * steps;
+  if (_frame >= _animation->count) {
+    if (_animation->oneShot) {
+      _animation = nullptr;
+      setMode(_baseMode);
+      return;
+    }
+    _frame -= _animation->count;
+  }
+  _show(_animation->levels[_frame], steps);
+}
 
-      // Flash the LED
-      if (!_isRGB) {
-        ledcWrite(_ledPin, LED_BRIGHT_FULL);
-      } else {
-        CRGB led_color(CHSV(HUE_RED, DEFAULT_SAT, LED_BRIGHT_FULL));
-        _adjustLed(&led_color, _colorAdjustment);
-        rgbLedWrite(_ledPin, led_color.red, led_color.green, led_color.blue);
-      }
+// keyframes per run of the task
+uint8_t LED::_steps() const {
+  switch (_backend) {
+    case Backend::LEDC_FADE:
+      return _animation->fade ? LED_FADE_STEPS : 1;
+    case Backend::RMT:
+      return (_animation->count == 1 || _animation->oneShot) ? 1 : _animation->count / _animation->stride;
+    default:
+      return 1;
+  }
+}
 
-      // Start the task to reset to previous state
-      resetTask->enableDelayed(250);
-    } break;
-    default: // switch it off
-      if (!_isRGB) {
-        ledcWrite(_ledPin, 0);
-      } else {
-        rgbLedWrite(_ledPin, 0, 0, 0);
-      }
+void LED::_show(uint8_t brightness, uint8_t steps) {
+  if (!_isRGB) {
+    if (_backend == Backend::LEDC_FADE && _animation->fade) {
+      // a fade to the keyframe after the steps, its end raises an interrupt
+      uint8_t target = _animation->levels[(_frame + _animation->stride * steps) % _animation->count];
+      ledcFade(_ledPin, brightness, target, _animation->interval * steps);
+      _countWakeups(1);
+    } else {
+      // overrides a fade still running
+      ledcWrite(_ledPin, brightness);
+    }
+  } else {
+    CRGB led_color = _color(brightness);
+    rgbLedWrite(_ledPin, led_color.red, led_color.green, led_color.blue);
+  }
+}
+
+CRGB LED::_color(uint8_t brightness) const {
+  CRGB led_color(CRGB::HTMLColorCode::Black);
+  if (brightness) {
+    led_color = CRGB(CHSV(_animation->hue, _animation->sat, brightness));
+    _adjustLed(&led_color, _colorAdjustment);
+  }
+  return led_color;
+}
+
+// the GPIO of the RGB LED (RGB_BUILTIN is offset by the number of GPIOs)
+int LED::_rmtPin() const {
+#ifdef RGB_BUILTIN
+  if (_ledPin == RGB_BUILTIN)
+    return _ledPin - SOC_GPIO_PIN_COUNT;
+#endif
+  return _ledPin;
+}
+
+// the frames of a period (or the single frame), each followed by low symbols until the next one is due
+void LED::_render() {
+  _symbolCount = 0;
+  if (_animation->count == 1 || _animation->oneShot) {
+    _symbolCount = _renderFrame(_symbols, _animation->levels[0], RMT_RESET_TICKS);
+    return;
+  }
+  uint32_t frameTicks = _animation->interval * RMT_TICKS_PER_MS - RMT_FRAME_SYMBOLS * RMT_BIT_TICKS;
+  for (uint8_t frame = 0; frame < _animation->count; frame += _animation->stride) {
+    // the last frame is cut short, so the period is done before it's sent again
+    uint32_t idleTicks = frame + _animation->stride < _animation->count ? frameTicks : frameTicks - LED_RMT_REARM_MARGIN * RMT_TICKS_PER_MS;
+    _symbolCount += _renderFrame(_symbols + _symbolCount, _animation->levels[frame], idleTicks);
+  }
+}
+
+size_t LED::_renderFrame(rmt_data_t* symbols, uint8_t brightness, uint32_t idleTicks) const {
+  CRGB led_color = _color(brightness);
+  uint8_t bytes[3];
+  switch (RGB_BUILTIN_LED_COLOR_ORDER) {
+    case LED_COLOR_ORDER_RGB:
+      bytes[0] = led_color.red, bytes[1] = led_color.green, bytes[2] = led_color.blue;
+      break;
+    case LED_COLOR_ORDER_BGR:
+      bytes[0] = led_color.blue, bytes[1] = led_color.green, bytes[2] = led_color.red;
+      break;
+    case LED_COLOR_ORDER_BRG:
+      bytes[0] = led_color.blue, bytes[1] = led_color.red, bytes[2] = led_color.green;
+      break;
+    case LED_COLOR_ORDER_RBG:
+      bytes[0] = led_color.red, bytes[1] = led_color.blue, bytes[2] = led_color.green;
+      break;
+    case LED_COLOR_ORDER_GBR:
+      bytes[0] = led_color.green, bytes[1] = led_color.blue, bytes[2] = led_color.red;
+      break;
+    default: // WS2812 default
+      bytes[0] = led_color.green, bytes[1] = led_color.red, bytes[2] = led_color.blue;
+      break;
+  }
+
+  size_t count = 0;
+  for (uint8_t byte : bytes) {
+    for (uint8_t bit = 0x80; bit; bit >>= 1) {
+      bool one = byte & bit;
+      symbols[count].level0 = 1;
+      symbols[count].duration0 = one ? 8 : 4;
+      symbols[count].level1 = 0;
+      symbols[count].duration1 = one ? 4 : 8;
+      count++;
+    }
+  }
+
+  // low for the rest of the frame, split evenly (a zero duration would end the transmission)
+  size_t idleSymbols = idleTicks / (2 * RMT_MAX_DURATION) + 1;
+  for (size_t i = 0; i < idleSymbols; ++i) {
+    uint32_t ticks = idleTicks / idleSymbols + (i < idleTicks % idleSymbols ? 1 : 0);
+    symbols[count].level0 = 0;
+    symbols[count].duration0 = ticks - ticks / 2;
+    symbols[count].level1 = 0;
+    symbols[count].duration1 = ticks / 2;
+    count++;
+  }
+  return count;
+}
+
+// false when the RMT channel is lost, the effects are stepped by the task from then on
+bool LED::_transmit() {
+  int pin = _rmtPin();
+  if (!rmtTransmitCompleted(pin)) {
+    // the period of the previous mode can't be stopped otherwise, the channel is created again
+    // (allocates, yet only when the mode changes while a period is running)
+    _rmtRestarts++;
+    if (!rmtDeinit(pin) || !rmtInit(pin, RMT_TX_MODE, static_cast<rmt_reserve_memsize_t>(LED_RMT_MEM_BLOCKS), RMT_RESOLUTION)) {
+      LOGE(TAG, "Restarting the RMT channel of the LED failed, stepping keyframes instead");
+      _backend = Backend::SOFTWARE;
+      free(_symbols);
+      _symbols = nullptr;
+      return false;
+    }
+  }
+
+  // the channel refills its memory by interrupt, half of it at a time
+  uint32_t interrupts = 1;
+  if (_symbolCount > RMT_MEM_SYMBOLS)
+    interrupts += (_symbolCount - RMT_MEM_SYMBOLS + RMT_MEM_SYMBOLS / 2 - 1) / (RMT_MEM_SYMBOLS / 2);
+  _countWakeups(interrupts);
+  return rmtWriteAsync(pin, _symbols, _symbolCount);
+}
+
+void LED::_account(uint32_t now) {
+  _modeMillis[static_cast<uint8_t>(_mode)] += now - _modeSince;
+  _modeSince = now;
+}
+
+const char* LED::_getModeName(LEDMode mode) {
+  switch (mode) {
+    case LEDMode::WAITING_WIFI:
+      return "waitingWifi";
+    case LEDMode::WAITING_CAPTIVE:
+      return "waitingCaptive";
+    case LEDMode::WAITING_READ:
+      return "waitingRead";
+    case LEDMode::TAG_READ:
+      return "tagRead";
+    case LEDMode::ARMED_WRITING:
+      return "armedWriting";
+    case LEDMode::ARMED_REWRITING:
+      return "armedRewriting";
+    case LEDMode::TAG_WRITTEN:
+      return "tagWritten";
+    case LEDMode::TAG_REWRITTEN:
+      return "tagRewritten";
+    case LEDMode::ERROR:
+      return "error";
+    default:
+      return "none";
+  }
+}
+
+const char* LED::_getBackendName(Backend backend) {
+  switch (backend) {
+    case Backend::LEDC_FADE:
+      return "ledc";
+    case Backend::RMT:
+      return "rmt";
+    default:
+      return "software";
+  }
+}
+
+// wakeups (task runs and interrupts) per second for each mode shown so far
+void LED::reportMetrics(JsonObject metrics) {
+  metrics["backend"] = _getBackendName(_backend);
+  metrics["mode"] = _getModeName(_mode);
+  metrics["rmtRestarts"] = _rmtRestarts.load();
+  JsonObject wakeups = metrics["wakeupsPerSecond"].to<JsonObject>();
+  uint32_t now = millis();
+  for (size_t i = 0; i < MODES; ++i) {
+    uint32_t shown = _modeMillis[i] + (i == static_cast<size_t>(_mode) ? now - _modeSince : 0);
+    if (shown)
+      wakeups[_getModeName(static_cast<LEDMode>(i))] = roundf(_wakeups[i] * 100000.0f / shown) / 100.0f;
   }
 }
@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <thingy.h>
+
+#if defined(MYCILA_WEBSERIAL_SUPPORT_APP) || defined(MYCILA_LOGGER_SUPPORT_APP)
+
+bool LogRateLimit::allow(uint32_t& repeated) {
+  repeated = 0;
+  uint32_t now = millis();
+  uint32_t start = _windowStart;
+  if (now - start >= LOG_RATE_WINDOW && _windowStart.compare_exchange_strong(start, now)) {
+    // a new window, summarize what the last one suppressed (unless the sweep did already)
+    _count = 0;
+    repeated = _suppressed.exchange(0);
+  }
+  if (_count.fetch_add(1) < LOG_RATE_BURST)
+    return true;
+
+  _suppressed++;
+  logRateLimiter.countSuppressed();
+  if (!_listed.exchange(true))
+    logRateLimiter.add(this);
+  return false;
+}
+
+uint32_t LogRateLimit::expired(uint32_t now) {
+  if (now - _windowStart < LOG_RATE_WINDOW)
+    return 0;
+  return _suppressed.exchange(0);
+}
+
+void LogRateLimiter::begin(Scheduler* scheduler) {
+  _scheduler = scheduler;
+
+  // summarize quiet call sites twice per window
+  _sweepTask = new Task(LOG_RATE_WINDOW / 2, TASK_FOREVER, [&] { _sweepCallback(); }, _scheduler, false, NULL, NULL, true);
+  _sweepTask->enable();
+}
+
+void LogRateLimiter::end() {
+  if (_sweepTask != nullptr) {
+    _sweepTask->disable();
+    _sweepTask = nullptr;
+  }
+}
+
+// lock-free push, the list only grows
+void LogRateLimiter::add(LogRateLimit* site) {
+  LogRateLimit* head = _sites;
+  do {
+    site->next = head;
+  } while (!_sites.compare_exchange_weak(head, site));
+  _siteCount++;
+}
+
+void LogRateLimiter::_sweepCallback() {
+  uint32_t now = millis();
+  for (LogRateLimit* site = _sites; site != nullptr; site = site->next) {
+    uint32_t repeated = site->expired(now);
+    if (!repeated)
+      continue;
+    _summaries++;
+    switch (site->level) {
+      case ARDUHAL_LOG_LEVEL_ERROR:
+        APP_LOGE(site->tag, LOG_REPEATED_FORMAT, site->format, repeated);
+        break;
+      case ARDUHAL_LOG_LEVEL_WARN:
+        APP_LOGW(site->tag, LOG_REPEATED_FORMAT, site->format, repeated);
+        break;
+      case ARDUHAL_LOG_LEVEL_INFO:
+        APP_LOGI(site->tag, LOG_REPEATED_FORMAT, site->format, repeated);
+        break;
+      default:
+        APP_LOGD(site->tag, LOG_REPEATED_FORMAT, site->format, repeated);
+        break;
+    }
+  }
+}
+
+void LogRateLimiter::reportMetrics(JsonObject metrics) {
+  metrics["sites"] = _siteCount.load();
+  metrics["suppressed"] = _suppressed.load();
+  metrics["summaries"] = _summaries.load();
+}
+
+#endif
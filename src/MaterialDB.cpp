@@ -0,0 +1,420 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <Inflater.h>
+#include <esp_rom_crc.h>
+#include <thingy.h>
+
+#define TAG "MaterialDB"
+
+#define MATERIAL_INDEX_TMP_FILE "/materials.tmp"
+
+void MaterialDB::begin(Scheduler* scheduler) {
+  // Task handling
+  _scheduler = scheduler;
+
+  // create and run a task for setting up the index (needs the filesystem)
+  Task* materialDBTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _materialDBCallback(); }, _scheduler, false, NULL, NULL, true);
+  materialDBTask->enable();
+  materialDBTask->waitFor(webServerAPI.getStatusRequest());
+}
+
+void MaterialDB::end() {
+  if (_rebuildTask != nullptr) {
+    _rebuildTask->disable();
+    _rebuildTask = nullptr;
+  }
+  if (_handler != nullptr) {
+    _webServer->removeHandler(_handler);
+    _handler = nullptr;
+  }
+  if (_downloadHandler != nullptr) {
+    _webServer->removeHandler(_downloadHandler);
+    _downloadHandler = nullptr;
+  }
+}
+
+// Check the index and add the materials endpoint to the webserver
+void MaterialDB::_materialDBCallback() {
+  LOGD(TAG, "Starting MaterialDB...");
+
+  if (!webServerAPI.isFSMounted()) {
+    LOGE(TAG, "Filesystem not mounted, material index is disabled");
+    return;
+  }
+
+  // leftover of an interrupted upload
+  LittleFS.remove(MATERIAL_DB_TMP_FILE);
+  _hashDatabase();
+
+  // the database might have been replaced without building the index (e.g. by uploading the filesystem)
+  if (!_isIndexCurrent())
+    _rebuildRequested = true;
+
+  // rebuild in the loop task when requested
+  _rebuildTask = new Task(500, TASK_FOREVER, [&] { _rebuildCallback(); }, _scheduler, false, NULL, NULL, true);
+  _rebuildTask->enable();
+
+  _handler = &_webServer->on("/api/materials", HTTP_GET, [&](AsyncWebServerRequest* request) { _handleRequest(request); });
+  _handler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+
+  _downloadHandler = &_webServer->on(MATERIAL_DB_URL, HTTP_GET, [&](AsyncWebServerRequest* request) { _handleDownload(request); });
+  _downloadHandler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+
+  LOGD(TAG, "...done!");
+}
+
+void MaterialDB::_rebuildCallback() {
+  if (!_rebuildRequested.exchange(false))
+    return;
+
+  uint32_t start = millis();
+  if (_buildIndex()) {
+    LOGI(TAG, "Material index built in %u ms", millis() - start);
+    if (_indexCallback != nullptr)
+      _indexCallback();
+  } else {
+    LOGE(TAG, "Building the material index failed");
+  }
+}
+
+// CRC32 and size of the uncompressed database from the gzip trailer
+bool MaterialDB::_readTrailer(uint32_t& crc, uint32_t& size) {
+  File file = LittleFS.open(MATERIAL_DB_FILE, "r");
+  uint8_t trailer[8];
+  if (!file || file.size() < 18 || !file.seek(file.size() - sizeof(trailer)) || file.read(trailer, sizeof(trailer)) != sizeof(trailer))
+    return false;
+  crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (trailer[3] << 24);
+  size = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | (trailer[7] << 24);
+  return true;
+}
+
+// the ETag is a hash of the gzipped database, same as taken while uploading
+void MaterialDB::_hashDatabase() {
+  File file = LittleFS.open(MATERIAL_DB_FILE, "r");
+  if (!file) {
+    _etag[0] = 0;
+    return;
+  }
+  uint8_t buffer[512];
+  uint32_t crc = 0;
+  size_t size = 0;
+  int len;
+  while ((len = file.read(buffer, sizeof(buffer))) > 0) {
+    crc = esp_rom_crc32_le(crc, buffer, len);
+    size += len;
+  }
+  _setETag(crc, size);
+}
+
+void MaterialDB::_setETag(uint32_t crc, size_t size) {
+  snprintf(_etag, sizeof(_etag), "\"%08lx-%x\"", static_cast<unsigned long>(crc), static_cast<unsigned>(size));
+  LOGD(TAG, "ETag of the material database: %s", _etag);
+}
+
+// the index was built from the database on the filesystem
+bool MaterialDB::_isIndexCurrent() {
+  uint32_t crc, size;
+  if (!_readTrailer(crc, size))
+    return false;
+
+  File file = LittleFS.open(MATERIAL_INDEX_FILE, "r");
+  MaterialIndexHeader header;
+  if (!file || file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header))
+    return false;
+  if (header.magic != MATERIAL_INDEX_MAGIC || header.format != MATERIAL_INDEX_FORMAT || header.dbCRC != crc || header.dbSize != size)
+    return false;
+
+  _version = header.version;
+  return true;
+}
+
+// stream-parse the gzipped database, only keeping the fields of the index
+bool MaterialDB::_buildIndex() {
+  File db = LittleFS.open(MATERIAL_DB_FILE, "r");
+  if (!db) {
+    LOGW(TAG, "No material database available");
+    return false;
+  }
+
+  InflateStream stream(db);
+  if (!stream.begin()) {
+    LOGE(TAG, "Not enough memory for decompressing");
+    return false;
+  }
+
+  JsonDocument filter;
+  filter["result"]["version"] = true;
+  JsonObject filterBase = filter["result"]["list"][0]["base"].to<JsonObject>();
+  filterBase["id"] = true;
+  filterBase["brand"] = true;
+  filterBase["name"] = true;
+  filterBase["meterialType"] = true;
+  filterBase["colors"] = true;
+  filterBase["minTemp"] = true;
+  filterBase["maxTemp"] = true;
+
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, stream, DeserializationOption::Filter(filter));
+  stream.end();
+  db.close();
+  if (error) {
+    LOGE(TAG, "Parsing the material database failed: %s", error.c_str());
+    return false;
+  }
+
+  JsonArray list = doc["result"]["list"].as<JsonArray>();
+  MaterialIndexHeader header;
+  header.count = list.size();
+  // the version is usually given as string
+  JsonVariant version = doc["result"]["version"];
+  header.version = version.is<const char*>() ? strtoll(version.as<const char*>(), nullptr, 10) : version.as<int64_t>();
+  uint32_t crc, size;
+  if (!_readTrailer(crc, size))
+    return false;
+  header.dbCRC = crc;
+  header.dbSize = size;
+
+  // write the index next to the old one and replace it when complete
+  File file = LittleFS.open(MATERIAL_INDEX_TMP_FILE, "w");
+  if (!file)
+    return false;
+  bool success = file.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header)) == sizeof(header);
+  for (JsonObject material : list) {
+    JsonObject base = material["base"];
+    MaterialIndexEntry entry;
+    strlcpy(entry.id, base["id"] | "", sizeof(entry.id));
+    strlcpy(entry.brand, base["brand"] | "", sizeof(entry.brand));
+    strlcpy(entry.name, base["name"] | "", sizeof(entry.name));
+    strlcpy(entry.type, base["meterialType"] | "", sizeof(entry.type));
+    for (JsonVariant color : base["colors"].as<JsonArray>()) {
+      if (entry.colorCount == MATERIAL_MAX_COLORS)
+        break;
+      const char* colorStr = color.as<const char*>();
+      if (colorStr != nullptr && colorStr[0] == '#')
+        entry.colors[entry.colorCount++] = strtoul(colorStr + 1, nullptr, 16);
+    }
+    entry.minTemp = base["minTemp"].as<int16_t>();
+    entry.maxTemp = base["maxTemp"].as<int16_t>();
+    success = success && file.write(reinterpret_cast<const uint8_t*>(&entry), sizeof(entry)) == sizeof(entry);
+  }
+  file.close();
+
+  if (!success || !LittleFS.rename(MATERIAL_INDEX_TMP_FILE, MATERIAL_INDEX_FILE)) {
+    LittleFS.remove(MATERIAL_INDEX_TMP_FILE);
+    return false;
+  }
+
+  _version = header.version;
+  LOGI(TAG, "Material index holds %u materials (version %lld)", header.count, header.version);
+  return true;
+}
+
+// an unfinished upload leaves nothing behind
+MaterialDB::Upload::~Upload() {
+  if (file) {
+    file.close();
+    LittleFS.remove(MATERIAL_DB_TMP_FILE);
+  }
+  free(buffer);
+}
+
+// collect the data in whole blocks, so every write covers a full block at a block boundary of the file
+// (the buffer itself is a plain malloc, its alignment in RAM doesn't matter to LittleFS)
+bool MaterialDB::Upload::write(const uint8_t* data, size_t len) {
+  size += len;
+  crc = esp_rom_crc32_le(crc, data, len);
+  if (buffer == nullptr) {
+    writes++;
+    return file.write(data, len) == len;
+  }
+  while (len) {
+    size_t count = min(len, MATERIAL_UPLOAD_BUFFER - buffered);
+    memcpy(buffer + buffered, data, count);
+    buffered += count;
+    data += count;
+    len -= count;
+    if (buffered == MATERIAL_UPLOAD_BUFFER && !flush())
+      return false;
+  }
+  return true;
+}
+
+bool MaterialDB::Upload::flush() {
+  if (!buffered)
+    return true;
+  writes++;
+  bool success = file.write(buffer, buffered) == buffered;
+  buffered = 0;
+  return success;
+}
+
+void MaterialDB::handleUpload(AsyncWebServerRequest* request, size_t index, uint8_t* data, size_t len, bool final) {
+  if (!index) {
+    // a new upload replaces any unfinished one
+    _upload.reset(new Upload());
+    _upload->request = request;
+    request->onDisconnect([this, request]() {
+      if (_upload && _upload->request == request)
+        _upload.reset();
+    });
+
+    if (!_upload->validator.begin()) {
+      LOGE(TAG, "Upload rejected: %s", _upload->validator.getError());
+      _upload->rejected = true;
+    } else {
+      _upload->file = LittleFS.open(MATERIAL_DB_TMP_FILE, "w");
+      if (!_upload->file) {
+        LOGE(TAG, "Opening %s failed", MATERIAL_DB_TMP_FILE);
+        return request->abort();
+      }
+      if (MATERIAL_UPLOAD_BUFFER)
+        _upload->buffer = reinterpret_cast<uint8_t*>(malloc(MATERIAL_UPLOAD_BUFFER));
+      _upload->start = millis();
+    }
+  }
+
+  if (!_upload || _upload->request != request)
+    return request->abort();
+
+  // answered with the validator's error once the upload is complete (valid stays false)
+  if (_upload->rejected) {
+    _upload->done = final;
+    return;
+  }
+
+  // stop writing as soon as the data is known to be invalid
+  if (len && _upload->validator.write(data, len)) {
+    if (!_upload->write(data, len)) {
+      LOGE(TAG, "Writing %s failed", MATERIAL_DB_TMP_FILE);
+      _upload.reset();
+      return request->abort();
+    }
+  }
+
+  if (final) {
+    // make sure everything is on flash before replacing the database
+    _upload->valid = _upload->validator.finish() && _upload->flush();
+    _upload->file.flush();
+    _upload->file.close();
+    _upload->done = true;
+    _upload->validator.end();
+    if (_upload->valid && LittleFS.rename(MATERIAL_DB_TMP_FILE, MATERIAL_DB_FILE)) {
+      _uploadStats.size = _upload->size;
+      _uploadStats.duration = millis() - _upload->start;
+      _uploadStats.writes = _upload->writes;
+      _setETag(_upload->crc, _upload->size);
+      LOGI(TAG, "New material database (version %lld, %u materials, %u bytes)",
+           _upload->validator.getVersion(), _upload->validator.getEntries(), _upload->validator.getSize());
+      LOGI(TAG, "Upload of %u bytes took %u ms in %u writes", _uploadStats.size, _uploadStats.duration, _uploadStats.writes);
+    } else {
+      _upload->valid = false;
+      LittleFS.remove(MATERIAL_DB_TMP_FILE);
+    }
+  }
+}
+
+void MaterialDB::finishUpload(AsyncWebServerRequest* request) {
+  if (!_upload || _upload->request != request)
+    return request->send(400, "text/plain", "Nothing uploaded");
+  if (!_upload->done) {
+    _upload.reset();
+    return request->send(400, "text/plain", "Only partial upload");
+  }
+  if (!_upload->valid) {
+    const char* error = _upload->validator.getError();
+    LOGW(TAG, "Upload rejected: %s", error != nullptr ? error : "not stored");
+    request->send(422, "text/plain", std::string("Invalid database: ").append(error != nullptr ? error : "not stored").c_str());
+    _upload.reset();
+    return;
+  }
+  _upload.reset();
+
+  // build the material index (clients are informed when it's done)
+  requestRebuild();
+  request->send(200, "text/plain", "OK");
+}
+
+bool MaterialDB::replaceDatabase(const char* path) {
+  if (!LittleFS.rename(path, MATERIAL_DB_FILE)) {
+    LittleFS.remove(path);
+    return false;
+  }
+  _hashDatabase();
+  requestRebuild();
+  return true;
+}
+
+void MaterialDB::reportMetrics(const JsonObject& metrics) {
+  metrics["version"] = _version;
+  JsonObject upload = metrics["lastUpload"].to<JsonObject>();
+  upload["bytes"] = _uploadStats.size;
+  upload["ms"] = _uploadStats.duration;
+  upload["writes"] = _uploadStats.writes;
+  upload["kBps"] = _uploadStats.duration ? _uploadStats.size / _uploadStats.duration : 0;
+}
+
+// serve the index as JSON
+void MaterialDB::_handleRequest(AsyncWebServerRequest* request) {
+  File file = LittleFS.open(MATERIAL_INDEX_FILE, "r");
+  MaterialIndexHeader header;
+  if (!file || file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header) || header.magic != MATERIAL_INDEX_MAGIC) {
+    request->send(404, "text/plain", "No material index available");
+    return;
+  }
+
+  // the index only changes with the database
+  char etag[32];
+  snprintf(etag, sizeof(etag), "\"i%u-%08lx-%lx\"", header.format, static_cast<unsigned long>(header.dbCRC), static_cast<unsigned long>(header.dbSize));
+  if (WebServerAPI::notModified(request, etag))
+    return;
+
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  response->addHeader("Cache-Control", "no-cache");
+  response->addHeader("ETag", etag);
+  response->printf("{\"version\":%lld,\"count\":%u,\"list\":[", header.version, header.count);
+  MaterialIndexEntry entry;
+  char color[8];
+  for (uint16_t i = 0; i < header.count && file.read(reinterpret_cast<uint8_t*>(&entry), sizeof(entry)) == sizeof(entry); ++i) {
+    JsonDocument jsonEntry;
+    jsonEntry["id"] = entry.id;
+    jsonEntry["brand"] = entry.brand;
+    jsonEntry["name"] = entry.name;
+    jsonEntry["type"] = entry.type;
+    JsonArray colors = jsonEntry["colors"].to<JsonArray>();
+    for (uint8_t c = 0; c < entry.colorCount && c < MATERIAL_MAX_COLORS; ++c) {
+      snprintf(color, sizeof(color), "#%06lx", static_cast<unsigned long>(entry.colors[c]));
+      colors.add(color);
+    }
+    jsonEntry["minTemp"] = entry.minTemp;
+    jsonEntry["maxTemp"] = entry.maxTemp;
+    if (i)
+      response->print(",");
+    serializeJson(jsonEntry, *response);
+  }
+  response->print("]}");
+  request->send(response);
+}
+
+// serve the gzipped database, clients revalidate with the ETag
+void MaterialDB::_handleDownload(AsyncWebServerRequest* request) {
+  if (!_etag[0] || !LittleFS.exists(MATERIAL_DB_FILE)) {
+    request->send(404, "text/plain", "No material database available");
+    return;
+  }
+  if (WebServerAPI::notModified(request, _etag))
+    return;
+
+  AsyncWebServerResponse* response = request->beginResponse(LittleFS, MATERIAL_DB_FILE, "application/json");
+  response->addHeader("Content-Encoding", "gzip");
+  // a link with the ETag as version can be cached forever
+  response->addHeader("Cache-Control", request->hasParam("v") ? "public, max-age=31536000, immutable" : "no-cache");
+  response->addHeader("ETag", _etag);
+  request->send(response);
+}
@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <MaterialDBValidator.h>
+
+bool MaterialDBValidator::begin(bool gzipped) {
+  _gzipped = gzipped;
+  _size = 0;
+  _error = nullptr;
+  _token = Token::VALUE;
+  _depth = 0;
+  _arrays = 0;
+  _isKey = false;
+  _justOpened = false;
+  _valueRole = Role::OTHER;
+  _keyLength = 0;
+  _hasResult = false;
+  _hasList = false;
+  _hasCount = false;
+  _hasVersion = false;
+  _version = 0;
+  _count = 0;
+  _entries = 0;
+  if (!_gzipped)
+    return true;
+  if (!_inflater.begin())
+    return _fail("not enough memory");
+  return true;
+}
+
+bool MaterialDBValidator::write(const uint8_t* data, size_t len) {
+  if (_error != nullptr)
+    return false;
+
+  if (!_gzipped) {
+    _size += len;
+    for (size_t i = 0; i < len; ++i) {
+      if (!_parse(static_cast<char>(data[i])))
+        return false;
+    }
+    return true;
+  }
+
+  GzipInflater::Status status = _inflater.write(data, len, [&](const uint8_t* out, size_t outLen) {
+    for (size_t i = 0; i < outLen; ++i) {
+      if (!_parse(static_cast<char>(out[i])))
+        return false;
+    }
+    return true;
+  });
+  if (status == GzipInflater::Status::ERROR)
+    return _fail("corrupted gzip data");
+  return true;
+}
+
+bool MaterialDBValidator::finish() {
+  if (_error != nullptr)
+    return false;
+  if (_gzipped && _inflater.getStatus() != GzipInflater::Status::DONE)
+    return _fail("incomplete gzip data");
+  if (_token != Token::DONE)
+    return _fail("incomplete JSON");
+  if (!_hasResult)
+    return _fail("result is missing");
+  if (!_hasList)
+    return _fail("result.list is missing");
+  if (!_entries)
+    return _fail("result.list is empty");
+  if (!_hasVersion || _version <= 0)
+    return _fail("result.version is missing");
+  if (_hasCount && _count != _entries)
+    return _fail("result.count doesn't match result.list");
+  return true;
+}
+
+bool MaterialDBValidator::_fail(const char* error) {
+  if (_error == nullptr)
+    _error = error;
+  return false;
+}
+
+// one character of the JSON document
+bool MaterialDBValidator::_parse(char c) {
+  switch (_token) {
+    case Token::STRING:
+      if (c == '"') {
+        if (_isKey) {
+          _keyBuffer[min<size_t>(_keyLength, VALIDATOR_KEY_LENGTH)] = 0;
+          if (_depth < VALIDATOR_KEY_LEVELS)
+            _keys[_depth] = _key(_keyBuffer);
+          _token = Token::COLON;
+          return true;
+        }
+        if (_valueRole == Role::ID && _keyLength)
+          _entryHasId = true;
+        if (_valueRole == Role::VERSION && _keyLength && !_fraction) {
+          _version = _number;
+          _hasVersion = true;
+        }
+        return _endValue();
+      }
+      if (c == '\\') {
+        _token = Token::ESCAPE;
+        return true;
+      }
+      if (static_cast<uint8_t>(c) < 0x20)
+        return _fail("control character in string");
+      if (_isKey && _keyLength < VALIDATOR_KEY_LENGTH)
+        _keyBuffer[_keyLength] = c;
+      _keyLength++;
+      // the version might be given as string of digits
+      if (_valueRole == Role::VERSION && !_isKey) {
+        if (isdigit(c) && _number < 100000000000000000LL) {
+          _number = _number * 10 + (c - '0');
+        } else {
+          _fraction = true;
+        }
+      }
+      return true;
+
+    case Token::ESCAPE:
+      _keyLength++;
+      if (c == 'u') {
+        _unicode = 0;
+        _token = Token::UNICODE;
+        return true;
+      }
+      if (strchr("\"\\/bfnrt", c) == nullptr)
+        return _fail("invalid escape sequence");
+      _token = Token::STRING;
+      return true;
+
+    case Token::UNICODE:
+      if (!isxdigit(c))
+        return _fail("invalid escape sequence");
+      if (++_unicode == 4)
+        _token = Token::STRING;
+      return true;
+
+    case Token::NUMBER:
+      if (isdigit(c)) {
+        if (!_fraction && _number < 100000000000000000LL)
+          _number = _number * 10 + (c - '0');
+        return true;
+      }
+      if (c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+        _fraction = true;
+        return true;
+      }
+      // the number ends here
+      if (_valueRole == Role::VERSION) {
+        _version = _negative ? -_number : _number;
+        _hasVersion = true;
+      } else if (_valueRole == Role::COUNT) {
+        _count = _negative ? -_number : _number;
+        _hasCount = true;
+      }
+      if (!_endValue())
+        return false;
+      return _parse(c);
+
+    case Token::LITERAL:
+      if (c != *_literal)
+        return _fail("invalid literal");
+      if (!*(++_literal))
+        return _endValue();
+      return true;
+
+    default:
+      break;
+  }
+
+  // skip whitespace between tokens
+  if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+    return true;
+
+  switch (_token) {
+    case Token::VALUE:
+      if (_justOpened && c == ']')
+        return _close(true);
+      return _beginValue(c);
+
+    case Token::KEY_OR_END:
+      if (c == '}')
+        return _close(false);
+      // fall through
+
+    case Token::KEY:
+      if (c != '"')
+        return _fail("key expected");
+      _isKey = true;
+      _keyLength = 0;
+      _token = Token::STRING;
+      return true;
+
+    case Token::COLON:
+      if (c != ':')
+        return _fail("colon expected");
+      _token = Token::VALUE;
+      _justOpened = false;
+      return true;
+
+    case Token::NEXT_OR_END:
+      if (c == ',') {
+        _token = (_arrays & (1UL << (_depth - 1))) ? Token::VALUE : Token::KEY;
+        _justOpened = false;
+        return true;
+      }
+      if (c == '}')
+        return _close(false);
+      if (c == ']')
+        return _close(true);
+      return _fail("comma or end expected");
+
+    case Token::DONE:
+      return _fail("data after the end");
+
+    default:
+      return _fail("unexpected character");
+  }
+}
+
+// role of the value starting at the current depth
+MaterialDBValidator::Role MaterialDBValidator::_role() {
+  switch (_depth) {
+    case 0:
+      return Role::ROOT;
+    case 1:
+      return _keys[1] == Key::RESULT ? Role::RESULT : Role::OTHER;
+    case 2:
+      if (_roles[2] != Role::RESULT)
+        return Role::OTHER;
+      if (_keys[2] == Key::LIST)
+        return Role::LIST;
+      if (_keys[2] == Key::COUNT)
+        return Role::COUNT;
+      if (_keys[2] == Key::VERSION)
+        return Role::VERSION;
+      return Role::OTHER;
+    case 3:
+      return _roles[3] == Role::LIST ? Role::ENTRY : Role::OTHER;
+    case 4:
+      return _roles[4] == Role::ENTRY && _keys[4] == Key::BASE ? Role::BASE : Role::OTHER;
+    case 5:
+      return _roles[5] == Role::BASE && _keys[5] == Key::ID ? Role::ID : Role::OTHER;
+    default:
+      return Role::OTHER;
+  }
+}
+
+bool MaterialDBValidator::_beginValue(char c) {
+  Role role = _role();
+  _justOpened = false;
+
+  // check the types along the path
+  switch (role) {
+    case Role::ROOT:
+    case Role::RESULT:
+    case Role::ENTRY:
+    case Role::BASE:
+      if (c != '{')
+        return _fail("object expected");
+      break;
+    case Role::LIST:
+      if (c != '[')
+        return _fail("result.list is not an array");
+      break;
+    case Role::COUNT:
+      if (c != '-' && !isdigit(c))
+        return _fail("number expected");
+      break;
+    case Role::VERSION:
+      if (c != '"' && c != '-' && !isdigit(c))
+        return _fail("result.version is not a number");
+      break;
+    case Role::ID:
+      if (c != '"')
+        return _fail("id is not a string");
+      break;
+    default:
+      break;
+  }
+
+  switch (c) {
+    case '{':
+      return _open(false, role);
+    case '[':
+      return _open(true, role);
+    case '"':
+      _isKey = false;
+      _keyLength = 0;
+      _number = 0;
+      _fraction = false;
+      _valueRole = role;
+      _token = Token::STRING;
+      return true;
+    case 't':
+      _literal = "rue";
+      _token = Token::LITERAL;
+      return true;
+    case 'f':
+      _literal = "alse";
+      _token = Token::LITERAL;
+      return true;
+    case 'n':
+      _literal = "ull";
+      _token = Token::LITERAL;
+      return true;
+    default:
+      if (c != '-' && !isdigit(c))
+        return _fail("value expected");
+      _negative = c == '-';
+      _fraction = false;
+      _number = _negative ? 0 : c - '0';
+      _valueRole = role;
+      _token = Token::NUMBER;
+      return true;
+  }
+}
+
+bool MaterialDBValidator::_endValue() {
+  _token = _depth ? Token::NEXT_OR_END : Token::DONE;
+  return true;
+}
+
+bool MaterialDBValidator::_open(bool array, Role role) {
+  if (_depth == VALIDATOR_MAX_DEPTH)
+    return _fail("nested too deeply");
+  _depth++;
+  if (array) {
+    _arrays |= 1UL << (_depth - 1);
+  } else {
+    _arrays &= ~(1UL << (_depth - 1));
+  }
+  if (_depth < VALIDATOR_KEY_LEVELS) {
+    _keys[_depth] = Key::OTHER;
+    _roles[_depth] = role;
+  }
+
+  switch (role) {
+    case Role::RESULT:
+      _hasResult = true;
+      break;
+    case Role::LIST:
+      _hasList = true;
+      break;
+    case Role::ENTRY:
+      _entries++;
+      _entryHasBase = false;
+      _entryHasId = false;
+      break;
+    case Role::BASE:
+      _entryHasBase = true;
+      break;
+    default:
+      break;
+  }
+
+  _token = array ? Token::VALUE : Token::KEY_OR_END;
+  _justOpened = array;
+  return true;
+}
+
+bool MaterialDBValidator::_close(bool array) {
+  if (!_depth || array != static_cast<bool>(_arrays & (1UL << (_depth - 1))))
+    return _fail("mismatched brackets");
+  if (_depth < VALIDATOR_KEY_LEVELS && _roles[_depth] == Role::ENTRY && !(_entryHasBase && _entryHasId))
+    return _fail("material without base.id");
+  _depth--;
+  return _endValue();
+}
+
+MaterialDBValidator::Key MaterialDBValidator::_key(const char* key) {
+  if (strcmp(key, "result") == 0)
+    return Key::RESULT;
+  if (strcmp(key, "list") == 0)
+    return Key::LIST;
+  if (strcmp(key, "count") == 0)
+    return Key::COUNT;
+  if (strcmp(key, "version") == 0)
+    return Key::VERSION;
+  if (strcmp(key, "base") == 0)
+    return Key::BASE;
+  if (strcmp(key, "id") == 0)
+    return Key::ID;
+  return Key::OTHER;
+}
@@ -0,0 +1,363 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <Preferences.h>
+#include <thingy.h>
+
+#define TAG "MaterialSync"
+
+void MaterialSync::begin(Scheduler* scheduler) {
+  // Task handling
+  _scheduler = scheduler;
+
+  // create and run a task for setting up the endpoints (needs the filesystem)
+  Task* materialSyncTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _syncCallback(); }, _scheduler, false, NULL, NULL, true);
+  materialSyncTask->enable();
+  materialSyncTask->waitFor(webServerAPI.getStatusRequest());
+}
+
+void MaterialSync::end() {
+  if (_client != nullptr)
+    _client->close(true);
+  if (_startHandler != nullptr) {
+    _webServer->removeHandler(_startHandler);
+    _startHandler = nullptr;
+  }
+  if (_statusHandler != nullptr) {
+    _webServer->removeHandler(_statusHandler);
+    _statusHandler = nullptr;
+  }
+}
+
+// Add the sync endpoints to the webserver
+void MaterialSync::_syncCallback() {
+  LOGD(TAG, "Starting MaterialSync...");
+
+  if (!webServerAPI.isFSMounted()) {
+    LOGE(TAG, "Filesystem not mounted, database sync is disabled");
+    return;
+  }
+
+  // leftover of an interrupted sync
+  LittleFS.remove(MATERIAL_SYNC_TMP_FILE);
+
+  _startHandler = &_webServer->on("/api/sync", HTTP_POST, [&](AsyncWebServerRequest* request) { _handleStart(request); });
+  _startHandler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+  _statusHandler = &_webServer->on("/api/sync", HTTP_GET, [&](AsyncWebServerRequest* request) { _handleStatus(request); });
+  _statusHandler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+
+  LOGD(TAG, "...done!");
+}
+
+const char* MaterialSync::getStateName(State state) {
+  switch (state) {
+    case State::IDLE:
+      return "idle";
+    case State::CONNECTING:
+      return "connecting";
+    case State::RECEIVING:
+      return "receiving";
+    case State::UPDATED:
+      return "updated";
+    case State::UNCHANGED:
+      return "unchanged";
+    case State::FAILED:
+      return "failed";
+    default:
+      return "unknown";
+  }
+}
+
+bool MaterialSync::start(const String& host, uint16_t port) {
+  if (_state == State::CONNECTING || _state == State::RECEIVING)
+    return false;
+  // the client of the last sync can't be deleted in its own callbacks
+  delete _client;
+  _client = nullptr;
+
+  _host = host;
+  _port = port;
+  _error = nullptr;
+  _lineLength = 0;
+  _statusLine = true;
+  _inBody = false;
+  _httpStatus = 0;
+  _contentLength = -1;
+  _remoteETag = "";
+  _remoteModified = "";
+  _received = 0;
+  _stored = 0;
+  _buffered = 0;
+  _version = 0;
+  _start = millis();
+  _duration = 0;
+  _state = State::CONNECTING;
+
+  if (!_validator.begin(false) || !_deflater.begin()) {
+    _fail("not enough memory");
+    _cleanup();
+    return true;
+  }
+  _file = LittleFS.open(MATERIAL_SYNC_TMP_FILE, "w");
+  if (!_file) {
+    _fail("opening the temp file failed");
+    _cleanup();
+    return true;
+  }
+  if (MATERIAL_UPLOAD_BUFFER)
+    _buffer = reinterpret_cast<uint8_t*>(malloc(MATERIAL_UPLOAD_BUFFER));
+
+  _client = new AsyncClient();
+  _client->onConnect([this](__unused void* arg, __unused AsyncClient* client) { _onConnect(); });
+  _client->onData([this](__unused void* arg, __unused AsyncClient* client, void* data, size_t len) {
+    _onData(reinterpret_cast<const uint8_t*>(data), len);
+  });
+  _client->onError([this](__unused void* arg, AsyncClient* client, int8_t error) { _fail(client->errorToString(error)); });
+  _client->onTimeout([this](__unused void* arg, AsyncClient* client, __unused uint32_t time) {
+    _fail("timeout");
+    client->close(true);
+  });
+  _client->onDisconnect([this](__unused void* arg, __unused AsyncClient* client) { _onDisconnect(); });
+  _client->setRxTimeout(MATERIAL_SYNC_TIMEOUT);
+
+  LOGI(TAG, "Fetching the material database from %s:%u", _host.c_str(), _port);
+  if (!_client->connect(_host.c_str(), _port)) {
+    _fail("connecting failed");
+    _cleanup();
+    delete _client;
+    _client = nullptr;
+  }
+  return true;
+}
+
+void MaterialSync::_onConnect() {
+  String request = "GET " MATERIAL_SYNC_PATH " HTTP/1.0\r\nHost: " + _host + "\r\nUser-Agent: " APP_NAME "\r\n";
+
+  // only ask for changes when the database still is the one from the last sync
+  Preferences preferences;
+  preferences.begin("k2rfid", true);
+  if (preferences.getString("syncLocal") == materialDB.getETag()) {
+    String etag = preferences.getString("syncETag");
+    String modified = preferences.getString("syncModified");
+    if (etag.length())
+      request += "If-None-Match: " + etag + "\r\n";
+    if (modified.length())
+      request += "If-Modified-Since: " + modified + "\r\n";
+  }
+  preferences.end();
+
+  request += "Connection: close\r\n\r\n";
+  _client->write(request.c_str(), request.length());
+}
+
+void MaterialSync::_onData(const uint8_t* data, size_t len) {
+  if (_state != State::CONNECTING && _state != State::RECEIVING)
+    return;
+
+  // response header, line by line
+  while (len && !_inBody) {
+    char c = static_cast<char>(*data++);
+    len--;
+    if (c == '\n') {
+      if (_lineLength && _line[_lineLength - 1] == '\r')
+        _lineLength--;
+      _line[_lineLength] = 0;
+      _lineLength = 0;
+      if (!_onLine(_line))
+        return;
+    } else if (_lineLength < MATERIAL_SYNC_LINE_LENGTH) {
+      _line[_lineLength++] = c;
+    }
+  }
+
+  if (len)
+    _onBody(data, len);
+}
+
+// one line of the response header, false to stop
+bool MaterialSync::_onLine(const char* line) {
+  if (_statusLine) {
+    _statusLine = false;
+    if (sscanf(line, "HTTP/%*d.%*d %d", &_httpStatus) != 1) {
+      _fail("invalid response");
+      _client->close();
+      return false;
+    }
+    return true;
+  }
+
+  if (!line[0]) {
+    // nothing to fetch
+    if (_httpStatus != 200) {
+      _client->close();
+      return false;
+    }
+    _inBody = true;
+    _state = State::RECEIVING;
+    return true;
+  }
+
+  if (strncasecmp(line, "Content-Length:", 15) == 0) {
+    _contentLength = strtol(line + 15, nullptr, 10);
+  } else if (strncasecmp(line, "ETag:", 5) == 0) {
+    _remoteETag = String(line + 5);
+    _remoteETag.trim();
+  } else if (strncasecmp(line, "Last-Modified:", 14) == 0) {
+    _remoteModified = String(line + 14);
+    _remoteModified.trim();
+  } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strcasestr(line + 18, "chunked") != nullptr) {
+    _fail("chunked transfer is not supported");
+    _client->close();
+    return false;
+  }
+  return true;
+}
+
+// validate and compress the received JSON
+bool MaterialSync::_onBody(const uint8_t* data, size_t len) {
+  _received += len;
+  if (!_validator.write(data, len)) {
+    _fail(_validator.getError());
+    _client->close();
+    return false;
+  }
+  if (!_deflater.write(data, len, [&](const uint8_t* out, size_t outLen) { return _store(out, outLen); })) {
+    _fail("writing the temp file failed");
+    _client->close();
+    return false;
+  }
+  return true;
+}
+
+// collect the compressed data in whole blocks, LittleFS handles these best
+bool MaterialSync::_store(const uint8_t* data, size_t len) {
+  _stored += len;
+  if (_buffer == nullptr)
+    return _file.write(data, len) == len;
+  while (len) {
+    size_t count = min(len, MATERIAL_UPLOAD_BUFFER - _buffered);
+    memcpy(_buffer + _buffered, data, count);
+    _buffered += count;
+    data += count;
+    len -= count;
+    if (_buffered == MATERIAL_UPLOAD_BUFFER && !_flush())
+      return false;
+  }
+  return true;
+}
+
+bool MaterialSync::_flush() {
+  if (!_buffered)
+    return true;
+  bool success = _file.write(_buffer, _buffered) == _buffered;
+  _buffered = 0;
+  return success;
+}
+
+void MaterialSync::_onDisconnect() {
+  if (_state == State::CONNECTING || _state == State::RECEIVING)
+    _complete();
+  _cleanup();
+  _duration = millis() - _start;
+}
+
+// the printer has sent everything
+void MaterialSync::_complete() {
+  if (_httpStatus == 304) {
+    LOGI(TAG, "Material database on the printer is unchanged");
+    _state = State::UNCHANGED;
+    return;
+  }
+  if (_httpStatus != 200) {
+    LOGW(TAG, "Printer answered with HTTP %d", _httpStatus);
+    return _fail(_httpStatus ? "unexpected response" : "no response");
+  }
+  if (_contentLength >= 0 && _received != static_cast<size_t>(_contentLength))
+    return _fail("incomplete download");
+  if (!_validator.finish())
+    return _fail(_validator.getError());
+
+  _version = _validator.getVersion();
+  if (_version == materialDB.getVersion()) {
+    LOGI(TAG, "Material database is up to date (version %lld)", _version);
+    _state = State::UNCHANGED;
+  } else {
+    // make sure everything is on flash before replacing the database
+    bool success = _deflater.finish([&](const uint8_t* out, size_t outLen) { return _store(out, outLen); }) && _flush();
+    _file.flush();
+    _file.close();
+    if (!success || !materialDB.replaceDatabase(MATERIAL_SYNC_TMP_FILE))
+      return _fail("storing the database failed");
+    LOGI(TAG, "New material database (version %lld, %u bytes, %u bytes compressed)", _version, _received, _stored);
+    _state = State::UPDATED;
+  }
+
+  // remember what was fetched for a conditional request next time
+  Preferences preferences;
+  preferences.begin("k2rfid", false);
+  preferences.putString("syncETag", _remoteETag);
+  preferences.putString("syncModified", _remoteModified);
+  preferences.putString("syncLocal", materialDB.getETag());
+  preferences.end();
+}
+
+void MaterialSync::_fail(const char* error) {
+  if (_state == State::FAILED)
+    return;
+  _error = error;
+  _state = State::FAILED;
+  LOGW(TAG, "Syncing the material database failed: %s", error);
+}
+
+// nothing of an unfinished sync is left behind
+void MaterialSync::_cleanup() {
+  _validator.end();
+  _deflater.end();
+  if (_file) {
+    _file.close();
+    LittleFS.remove(MATERIAL_SYNC_TMP_FILE);
+  }
+  free(_buffer);
+  _buffer = nullptr;
+}
+
+void MaterialSync::_handleStart(AsyncWebServerRequest* request) {
+  // default to the printer found last
+  String host;
+  if (request->hasParam("ip", true)) {
+    host = request->getParam("ip", true)->value();
+  } else if (static_cast<uint32_t>(printerDiscovery.getPrinter()) != 0) {
+    host = printerDiscovery.getPrinter().toString();
+  } else {
+    request->send(400, "text/plain", "ip is required");
+    return;
+  }
+  if (!start(host)) {
+    request->send(409, "text/plain", "Sync is running already");
+    return;
+  }
+  _handleStatus(request);
+}
+
+void MaterialSync::_handleStatus(AsyncWebServerRequest* request) {
+  JsonDocument jsonMsg;
+  State state = _state;
+  jsonMsg["state"] = getStateName(state);
+  if (state == State::FAILED)
+    jsonMsg["error"] = _error;
+  jsonMsg["host"] = _host;
+  jsonMsg["version"] = _version;
+  jsonMsg["bytes"] = _received;
+  jsonMsg["compressed"] = _stored;
+  jsonMsg["ms"] = (state == State::CONNECTING || state == State::RECEIVING) ? millis() - _start : _duration;
+
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  serializeJson(jsonMsg, *response);
+  request->send(response);
+}
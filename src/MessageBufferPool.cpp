@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <MessageBufferPool.h>
+
+MessageBufferPool::~MessageBufferPool() {
+  for (std::vector<uint8_t>* buffer : _free)
+    delete buffer;
+}
+
+AsyncWebSocketSharedBuffer MessageBufferPool::get(size_t length) {
+  std::vector<uint8_t>* buffer = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // the first one large enough, or any to grow
+    for (auto it = _free.begin(); it != _free.end(); ++it) {
+      if ((*it)->capacity() >= length) {
+        buffer = *it;
+        _free.erase(it);
+        break;
+      }
+    }
+    if (buffer == nullptr && !_free.empty()) {
+      buffer = _free.back();
+      _free.pop_back();
+    }
+  }
+
+  if (buffer == nullptr) {
+    buffer = new std::vector<uint8_t>();
+    _countAllocation(sizeof(std::vector<uint8_t>));
+  }
+  if (buffer->capacity() < length) {
+    _countAllocation(length);
+  } else {
+    _reused++;
+  }
+  buffer->resize(length);
+
+  // back into the pool when all clients have sent it
+  return AsyncWebSocketSharedBuffer(buffer, [this](std::vector<uint8_t>* released) { _release(released); }, ControlAllocator<uint8_t>(this));
+}
+
+void MessageBufferPool::_release(std::vector<uint8_t>* buffer) {
+  if (buffer->capacity() <= WS_BUFFER_POOL_MAX) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_free.size() < WS_BUFFER_POOL_SIZE) {
+      _free.push_back(buffer);
+      return;
+    }
+  }
+  delete buffer;
+}
+
+void MessageBufferPool::reportMetrics(JsonObject metrics) {
+  uint32_t events = _events;
+  metrics["events"] = events;
+  metrics["allocations"] = _allocations.load();
+  metrics["allocatedBytes"] = _allocatedBytes.load();
+  metrics["reused"] = _reused.load();
+  metrics["allocationsPerEvent"] = events ? static_cast<float>(_allocations) / events : 0.0f;
+  metrics["bytesPerEvent"] = events ? _allocatedBytes / events : 0;
+  std::lock_guard<std::mutex> lock(_mutex);
+  metrics["pooled"] = _free.size();
+}
+
+void* MessageBufferPool::JsonAllocator::allocate(size_t size) {
+  _pool->_countAllocation(size);
+  return malloc(size);
+}
+
+void MessageBufferPool::JsonAllocator::deallocate(void* pointer) {
+  free(pointer);
+}
+
+void* MessageBufferPool::JsonAllocator::reallocate(void* pointer, size_t newSize) {
+  _pool->_countAllocation(newSize);
+  return realloc(pointer, newSize);
+}
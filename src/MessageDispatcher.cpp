@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <MessageDispatcher.h>
+
+bool MessageDispatcher::on(const MessageType& type, const JsonDocument& filter, Handler handler) {
+  if (_entryCount >= WS_MAX_HANDLERS || _find(type.name) != nullptr)
+    return false;
+  if (_typeFilter.isNull())
+    _typeFilter["type"] = true;
+
+  Entry& entry = _entries[_entryCount++];
+  entry.hash = type.hash;
+  entry.name = type.name;
+  entry.filter = filter;
+  entry.handler = handler;
+  return true;
+}
+
+bool MessageDispatcher::dispatch(AsyncWebSocketClient* client, const uint8_t* data, size_t len, bool binary) {
+  if (len > WS_MAX_MESSAGE_SIZE || !_looksLikeObject(data, len, binary)) {
+    _malformed++;
+    return false;
+  }
+  uint32_t start = micros();
+
+  // the type only (nothing else is stored)
+  JsonDocument jsonRXMsg;
+  if (_parse(jsonRXMsg, data, len, binary, _typeFilter) != DeserializationError::Ok) {
+    _malformed++;
+    return false;
+  }
+  Entry* entry = _find(jsonRXMsg["type"] | "");
+  if (entry == nullptr) {
+    _unknown++;
+    return false;
+  }
+
+  // the fields of the handler
+  jsonRXMsg.clear();
+  if (_parse(jsonRXMsg, data, len, binary, entry->filter) != DeserializationError::Ok) {
+    _malformed++;
+    return false;
+  }
+  uint32_t duration = micros() - start;
+  entry->count++;
+  entry->micros += duration;
+  if (duration > entry->maxMicros)
+    entry->maxMicros = duration;
+
+  entry->handler(client, jsonRXMsg);
+  return true;
+}
+
+// a JSON object or a MessagePack map, skipping whitespace of JSON
+bool MessageDispatcher::_looksLikeObject(const uint8_t* data, size_t len, bool binary) {
+  if (binary)
+    return len && ((data[0] & 0xF0) == 0x80 || data[0] == 0xDE || data[0] == 0xDF);
+  for (size_t i = 0; i < len; ++i) {
+    if (!isspace(data[i]))
+      return data[i] == '{';
+  }
+  return false;
+}
+
+DeserializationError MessageDispatcher::_parse(JsonDocument& jsonRXMsg, const uint8_t* data, size_t len, bool binary, const JsonDocument& filter) {
+  if (binary)
+    return deserializeMsgPack(jsonRXMsg, data, len, DeserializationOption::Filter(filter), DeserializationOption::NestingLimit(WS_MAX_NESTING));
+  return deserializeJson(jsonRXMsg, reinterpret_cast<const char*>(data), len, DeserializationOption::Filter(filter), DeserializationOption::NestingLimit(WS_MAX_NESTING));
+}
+
+// by hash, the name guards against collisions
+MessageDispatcher::Entry* MessageDispatcher::_find(const char* type) {
+  uint32_t hash = MessageType::fnv1a(type);
+  for (size_t i = 0; i < _entryCount; ++i) {
+    if (_entries[i].hash == hash && strcmp(_entries[i].name, type) == 0)
+      return &_entries[i];
+  }
+  return nullptr;
+}
+
+void MessageDispatcher::reportMetrics(JsonObject metrics) {
+  metrics["malformed"] = _malformed.load();
+  metrics["unknown"] = _unknown.load();
+  JsonObject types = metrics["types"].to<JsonObject>();
+  for (size_t i = 0; i < _entryCount; ++i) {
+    const Entry& entry = _entries[i];
+    uint32_t count = entry.count;
+    JsonObject type = types[entry.name].to<JsonObject>();
+    type["count"] = count;
+    type["avgParseMicros"] = count ? entry.micros / count : 0;
+    type["maxParseMicros"] = entry.maxMicros.load();
+  }
+}
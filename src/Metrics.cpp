@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <thingy.h>
+
+#define TAG "Metrics"
+
+void Metrics::begin(Scheduler* scheduler) {
+  // Task handling
+  _scheduler = scheduler;
+
+  // count all tag events
+  tagEventBus.subscribe(TagEvent::ALL, [&](const TagEvent& event) { _tagEventCallback(event); });
+
+  // create and run a task for setting up the metrics endpoint
+  Task* metricsTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _metricsCallback(); }, _scheduler, false, NULL, NULL, true);
+  metricsTask->enable();
+  metricsTask->waitFor(webServerAPI.getStatusRequest());
+}
+
+void Metrics::end() {
+  if (_handler != nullptr) {
+    _webServer->removeHandler(_handler);
+    _handler = nullptr;
+  }
+}
+
+void Metrics::_tagEventCallback(const TagEvent& event) {
+  _eventCount[static_cast<uint8_t>(event.type)]++;
+  _lastEvent = event.timestamp;
+  if (event.type == TagEvent::Type::READ_DONE && !event.success)
+    _readErrors++;
+  if (event.type == TagEvent::Type::WRITE_DONE && !event.success)
+    _writeErrors++;
+}
+
+// Add the metrics endpoint to the webserver
+void Metrics::_metricsCallback() {
+  LOGD(TAG, "Starting Metrics...");
+
+  _handler = &_webServer->on("/api/metrics", HTTP_GET, [&](AsyncWebServerRequest* request) {
+    JsonDocument jsonMsg;
+    jsonMsg["uptime"] = millis();
+
+    JsonObject heap = jsonMsg["heap"].to<JsonObject>();
+    heap["free"] = ESP.getFreeHeap();
+    heap["min"] = ESP.getMinFreeHeap();
+    heap["maxAlloc"] = ESP.getMaxAllocHeap();
+
+    JsonObject tags = jsonMsg["tags"].to<JsonObject>();
+    tags["arrived"] = _eventCount[static_cast<uint8_t>(TagEvent::Type::TAG_ARRIVED)];
+    tags["left"] = _eventCount[static_cast<uint8_t>(TagEvent::Type::TAG_LEFT)];
+    tags["read"] = _eventCount[static_cast<uint8_t>(TagEvent::Type::READ_DONE)];
+    tags["readErrors"] = _readErrors;
+    tags["written"] = _eventCount[static_cast<uint8_t>(TagEvent::Type::WRITE_DONE)];
+    tags["writeErrors"] = _writeErrors;
+    tags["errors"] = _eventCount[static_cast<uint8_t>(TagEvent::Type::ERROR)];
+    tags["lastEvent"] = _lastEvent;
+
+    rfid.reportMetrics(jsonMsg["rfid"].to<JsonObject>());
+    led.reportMetrics(jsonMsg["led"].to<JsonObject>());
+    materialDB.reportMetrics(jsonMsg["materialDB"].to<JsonObject>());
+    webSite.reportMetrics(jsonMsg["websocket"].to<JsonObject>());
+    tagAPI.reportMetrics(jsonMsg["tagAPI"].to<JsonObject>());
+    eventStream.reportMetrics(jsonMsg["events"].to<JsonObject>());
+#if defined(MYCILA_WEBSERIAL_SUPPORT_APP) || defined(MYCILA_LOGGER_SUPPORT_APP)
+    logRateLimiter.reportMetrics(jsonMsg["logRateLimit"].to<JsonObject>());
+#endif
+#ifdef MYCILA_WEBSERIAL_SUPPORT_APP
+    webSerial.reportMetrics(jsonMsg["webSerial"].to<JsonObject>());
+  #ifdef LOG_DEFERRED
+    deferredLog.reportMetrics(jsonMsg["log"].to<JsonObject>());
+  #endif
+#endif
+
+    JsonObject bus = jsonMsg["eventBus"].to<JsonObject>();
+    bus["dispatched"] = tagEventBus.getDispatched();
+    bus["dropped"] = tagEventBus.getDropped();
+
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    serializeJson(jsonMsg, *response);
+    request->send(response);
+  });
+  _handler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+
+  LOGD(TAG, "...done!");
+}
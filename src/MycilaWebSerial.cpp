@@ -4,32 +4,63 @@
  */
 
 #include <MycilaWebSerial.h>
-#include <assert.h>
+#include <WebServerAPI.h>
+#include <esp_heap_caps.h>
 
+#include <algorithm>
 #include <string>
 
 // gzipped website
 extern const uint8_t webserial_html_start[] asm("_binary__pio_embed_webserial_html_gz_start");
 extern const uint8_t webserial_html_end[] asm("_binary__pio_embed_webserial_html_gz_end");
+extern const char* __EMBED_ETAG_WEBSERIAL__;
 
 void WebSerial::begin(AsyncWebServer* server, const char* url, Scheduler* scheduler) {
   _server = server;
   _scheduler = scheduler;
+  _frame.reserve(WSL_FRAME_SIZE);
+
+  // scrollback, preferably in PSRAM
+  if (psramFound()) {
+    _scrollback = reinterpret_cast<uint8_t*>(heap_caps_malloc(WSL_SCROLLBACK_PSRAM, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+    _scrollbackSize = _scrollback != nullptr ? WSL_SCROLLBACK_PSRAM : 0;
+    _scrollbackPSRAM = _scrollback != nullptr;
+  }
+  if (_scrollback == nullptr && WSL_SCROLLBACK > 0) {
+    _scrollback = reinterpret_cast<uint8_t*>(malloc(WSL_SCROLLBACK));
+    _scrollbackSize = _scrollback != nullptr ? WSL_SCROLLBACK : 0;
+  }
 
   std::string backendUrl = url;
   backendUrl.append("ws");
   _ws = new AsyncWebSocket(backendUrl.c_str());
 
   _server->on(url, HTTP_GET, [&](AsyncWebServerRequest* request) {
+    // revalidate with the ETag of the embedded page
+    if (WebServerAPI::notModified(request, __EMBED_ETAG_WEBSERIAL__))
+      return;
     AsyncWebServerResponse* response = request->beginResponse(200, "text/html", webserial_html_start, webserial_html_end - webserial_html_start);
     response->addHeader("Content-Encoding", "gzip");
+    response->addHeader("Cache-Control", "no-cache");
+    response->addHeader("ETag", __EMBED_ETAG_WEBSERIAL__);
     request->send(response);
   });
 
   _ws->onEvent([&](__unused AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, __unused void* arg, uint8_t* data, __unused size_t len) -> void {
     if (type == WS_EVT_CONNECT) {
+      // slow clients are handled by holding frames back, see _queueFrame()
       client->setCloseClientOnQueueFull(false);
       client->keepAlivePeriod(10);
+      std::lock_guard<std::mutex> lock(_clientsMutex);
+      _clients.emplace_back();
+      _clients.back().id = client->id();
+      _clientCount = _clients.size();
+      return;
+    }
+    if (type == WS_EVT_DISCONNECT) {
+      std::lock_guard<std::mutex> lock(_clientsMutex);
+      _clients.erase(std::remove_if(_clients.begin(), _clients.end(), [&](const Client& other) { return other.id == client->id(); }), _clients.end());
+      _clientCount = _clients.size();
       return;
     }
     if (type == WS_EVT_DATA) {
@@ -49,6 +80,10 @@ void WebSerial::begin(AsyncWebServer* server, const char* url, Scheduler* schedu
   // set up a task to cleanup orphan websock-clients
   Task* _wsCleanupTask = new Task(1000, TASK_FOREVER, [&] { _wsCleanupCallback(); }, _scheduler, false, NULL, NULL, true);
   _wsCleanupTask->enable();
+
+  // and one to batch the logged lines and send what was held back for slow clients
+  _drainTask = new Task(WSL_DRAIN_INTERVAL, TASK_FOREVER, [&] { _drainCallback(); }, _scheduler, false, NULL, NULL, true);
+  _drainTask->enable();
 }
 
 void WebSerial::end() {
@@ -57,6 +92,10 @@ void WebSerial::end() {
     _wsCleanupTask->disable();
     _wsCleanupTask = nullptr;
   }
+  if (_drainTask != nullptr) {
+    _drainTask->disable();
+    _drainTask = nullptr;
+  }
 
   // delete websock handler
   if (_ws != nullptr) {
@@ -64,82 +103,262 @@ void WebSerial::end() {
     delete _ws;
     _ws = nullptr;
   }
+
+  _scrollbackSize = 0;
+  free(_scrollback);
+  _scrollback = nullptr;
+  _scrollbackHead = _scrollbackTail = _scrollbackUsed = 0;
 }
 
 size_t WebSerial::write(uint8_t m) {
-  if (!_ws)
-    return 0;
+  return write(&m, 1);
+}
 
-  // We do not support non-buffered write on webserial
-  // we fail with a stack trace allowing the user to change the code to use write(const uint8_t* buffer, size_t size) instead
-  if (!_initialBufferCapacity) {
-#ifdef ESP8266
-    ets_printf("Non-buffered write is not supported: use webSerial.setBuffer(size_t)");
-#else
-    log_e("Non-buffered write is not supported: use webSerial.setBuffer(size_t)");
-#endif
-    assert(false);
+// one record per line, a line without '\n' is continued by the next write
+size_t WebSerial::write(const uint8_t* buffer, size_t size) {
+  if (!_ws || size == 0)
     return 0;
+  // nobody is listening (and there is no scrollback)
+  if (!wantsLines())
+    return size;
+
+  size_t start = 0;
+  while (start < size) {
+    const uint8_t* eol = reinterpret_cast<const uint8_t*>(memchr(buffer + start, '\n', size - start));
+    size_t end = eol != nullptr ? eol - buffer : size;
+    _record(buffer + start, end - start, eol != nullptr);
+    start = end + 1;
   }
+  return size;
+}
 
-  write(&m, 1);
-  return (1);
+// copy a line into the ring (never blocks, never allocates)
+// a single record per line, so lines of other tasks can't get in between: longer lines are cut
+void WebSerial::_record(const uint8_t* data, size_t length, bool eol) {
+  size_t ticket;
+  LogLine* line = _ring.reserve(ticket);
+  if (line == nullptr) {
+    _ringFull++;
+    return;
+  }
+  if (length > WSL_LINE_SIZE) {
+    memcpy(line->data, data, WSL_LINE_SIZE - 3);
+    memcpy(line->data + WSL_LINE_SIZE - 3, "...", 3);
+    line->length = WSL_LINE_SIZE;
+    _truncatedLines++;
+  } else {
+    memcpy(line->data, data, length);
+    line->length = length;
+  }
+  line->eol = eol;
+  _ring.commit(ticket);
+  if (eol)
+    _lines++;
 }
 
-size_t WebSerial::write(const uint8_t* buffer, size_t size) {
-  if (!_ws || size == 0)
-    return 0;
+void WebSerial::_wsCleanupCallback() {
+  _ws->cleanupClients(WSL_MAX_WS_CLIENTS);
+}
 
-  // No buffer, send directly (i.e. use case for log streaming)
-  if (!_initialBufferCapacity) {
-    size = buffer[size - 1] == '\n' ? size - 1 : size;
-    _send(buffer, size);
-    return size;
+// hold the frame back, dropping the oldest one when the client is too slow
+void WebSerial::_queueFrame(Client& client, const AsyncWebSocketSharedBuffer& frame) {
+  if (client.count == WSL_CLIENT_BACKLOG) {
+    client.backlog[client.first].reset();
+    client.first = (client.first + 1) % WSL_CLIENT_BACKLOG;
+    client.count--;
+    client.droppedInARow++;
+    _droppedFrames++;
   }
+  client.backlog[(client.first + client.count) % WSL_CLIENT_BACKLOG] = frame;
+  client.count++;
+  _drain(client);
+}
 
-  // fill the buffer while sending data for each EOL
-  size_t start = 0, end = 0;
-  while (end < size) {
-    if (buffer[end] == '\n') {
-      if (end > start) {
-        _buffer.append(reinterpret_cast<const char*>(buffer + start), end - start);
-      }
-      _send(reinterpret_cast<const uint8_t*>(_buffer.c_str()), _buffer.length());
-      start = end + 1;
+// hand held back frames to the WebSocket while the client keeps up
+void WebSerial::_drain(Client& client) {
+  AsyncWebSocketClient* wsClient = _ws->client(client.id);
+  if (wsClient == nullptr)
+    return;
+
+  size_t depth = wsClient->queueLen();
+  while (client.count && depth < WSL_CLIENT_SLOW_QUEUE) {
+    if (!wsClient->text(client.backlog[client.first]))
+      break;
+    client.backlog[client.first].reset();
+    client.first = (client.first + 1) % WSL_CLIENT_BACKLOG;
+    client.count--;
+    client.droppedInARow = 0;
+    depth++;
+  }
+  client.highWater = std::max(client.highWater, depth);
+  if (depth > _highWater)
+    _highWater = depth;
+
+  // gave up on this one
+  if (client.droppedInARow >= WSL_CLIENT_MAX_DROPPED) {
+    client.droppedInARow = 0;
+    _disconnected++;
+    wsClient->close();
+  }
+}
+
+// batch the recorded lines into frames and send them (in the loop task)
+void WebSerial::_drainCallback() {
+  // new clients get the scrollback ahead of any new line
+  {
+    std::lock_guard<std::mutex> lock(_clientsMutex);
+    for (Client& client : _clients) {
+      if (!client.replayed)
+        _replay(client);
     }
-    end++;
   }
-  if (end > start) {
-    _buffer.append(reinterpret_cast<const char*>(buffer + start), end - start);
+
+  LogLine* line;
+  while ((line = _ring.front()) != nullptr) {
+    _batch(*line);
+    _ring.release();
+  }
+  _emit();
+
+  std::lock_guard<std::mutex> lock(_clientsMutex);
+  for (Client& client : _clients) {
+    if (client.count)
+      _drain(client);
   }
-  return size;
 }
 
-void WebSerial::_send(const uint8_t* buffer, size_t size) {
-  if (_ws && size > 0) {
-    //_ws->cleanupClients(WSL_MAX_WS_CLIENTS);
-    if (_ws->count()) {
-      _ws->textAll((const char*)buffer, size);
+// lines are '\n' terminated in the frame, the last '\n' isn't sent
+void WebSerial::_batch(const LogLine& line) {
+  // no room for the line, send the complete lines first
+  if (_frame.size() + line.length + 1 > WSL_FRAME_SIZE)
+    _emit();
+  // a line of its own too long for a frame, cut it
+  if (_frame.size() + line.length + 1 > WSL_FRAME_SIZE) {
+    _frame.push_back('\n');
+    _frameEnd = _frame.size();
+    _frameLines++;
+    _splitLines++;
+    _emit();
+  }
+
+  _frame.insert(_frame.end(), line.data, line.data + line.length);
+  if (line.eol) {
+    if (_frame.size() == _frameEnd) {
+      // skip empty lines
+      return;
     }
+    _frame.push_back('\n');
+    _frameEnd = _frame.size();
+    _frameLines++;
+  }
+}
+
+// send the complete lines as one frame, shared by all clients
+void WebSerial::_emit() {
+  if (!_frameEnd)
+    return;
+  AsyncWebSocketSharedBuffer frame = std::make_shared<std::vector<uint8_t>>(_frame.begin(), _frame.begin() + _frameEnd - 1);
+  _frame.erase(_frame.begin(), _frame.begin() + _frameEnd);
+  _frameEnd = 0;
+  _frames++;
+  _batchedLines += _frameLines;
+  _frameLines = 0;
+  _keep(frame);
+
+  std::lock_guard<std::mutex> lock(_clientsMutex);
+  for (Client& client : _clients)
+    _queueFrame(client, frame);
+}
+
+// append the frame to the scrollback, evicting the oldest frames as needed
+void WebSerial::_keep(const AsyncWebSocketSharedBuffer& frame) {
+  uint16_t length = std::min(frame->size(), static_cast<size_t>(UINT16_MAX));
+  size_t needed = sizeof(length) + length;
+  if (needed > _scrollbackSize)
+    return;
+  while (_scrollbackSize - _scrollbackUsed < needed) {
+    uint16_t oldest;
+    _scrollbackRead(_scrollbackTail, reinterpret_cast<uint8_t*>(&oldest), sizeof(oldest));
+    _scrollbackTail = (_scrollbackTail + sizeof(oldest) + oldest) % _scrollbackSize;
+    _scrollbackUsed -= sizeof(oldest) + oldest;
+    _evicted++;
   }
+  _scrollbackWrite(_scrollbackHead, reinterpret_cast<const uint8_t*>(&length), sizeof(length));
+  _scrollbackWrite((_scrollbackHead + sizeof(length)) % _scrollbackSize, frame->data(), length);
+  _scrollbackHead = (_scrollbackHead + needed) % _scrollbackSize;
+  _scrollbackUsed += needed;
+}
+
+// send the scrollback to a new client, the kept frames joined into a few large ones
+void WebSerial::_replay(Client& client) {
+  client.replayed = true;
+  size_t pos = _scrollbackTail;
+  size_t left = _scrollbackUsed;
+  AsyncWebSocketSharedBuffer frame;
+  while (left) {
+    uint16_t length;
+    _scrollbackRead(pos, reinterpret_cast<uint8_t*>(&length), sizeof(length));
+    pos = (pos + sizeof(length)) % _scrollbackSize;
 
-  // if buffer grew too much, free it, otherwise clear it
-  if (_initialBufferCapacity) {
-    if (_buffer.length() > _initialBufferCapacity) {
-      setBuffer(_initialBufferCapacity);
+    if (frame && frame->size() + 1 + length > WSL_SCROLLBACK_FRAME) {
+      _queueFrame(client, frame);
+      _replayFrames++;
+      frame.reset();
+    }
+    if (!frame) {
+      frame = std::make_shared<std::vector<uint8_t>>();
+      frame->reserve(WSL_SCROLLBACK_FRAME);
     } else {
-      _buffer.clear();
+      frame->push_back('\n');
     }
+    size_t offset = frame->size();
+    frame->resize(offset + length);
+    _scrollbackRead(pos, frame->data() + offset, length);
+    pos = (pos + length) % _scrollbackSize;
+    left -= sizeof(length) + length;
+  }
+  if (frame) {
+    _queueFrame(client, frame);
+    _replayFrames++;
   }
 }
 
-void WebSerial::setBuffer(size_t initialCapacity) {
-  assert(initialCapacity <= UINT16_MAX);
-  _initialBufferCapacity = initialCapacity;
-  _buffer = std::string();
-  _buffer.reserve(initialCapacity);
+void WebSerial::_scrollbackWrite(size_t pos, const uint8_t* data, size_t length) {
+  size_t first = std::min(length, _scrollbackSize - pos);
+  memcpy(_scrollback + pos, data, first);
+  memcpy(_scrollback, data + first, length - first);
 }
 
-void WebSerial::_wsCleanupCallback() {
-  _ws->cleanupClients(WSL_MAX_WS_CLIENTS);
+void WebSerial::_scrollbackRead(size_t pos, uint8_t* data, size_t length) const {
+  size_t first = std::min(length, _scrollbackSize - pos);
+  memcpy(data, _scrollback + pos, first);
+  memcpy(data + first, _scrollback, length - first);
+}
+
+void WebSerial::reportMetrics(JsonObject metrics) {
+  uint32_t frames = _frames;
+  metrics["lines"] = _lines.load();
+  metrics["ringFull"] = _ringFull.load();
+  metrics["ringUsed"] = _ring.size();
+  metrics["splitLines"] = _splitLines.load();
+  metrics["truncatedLines"] = _truncatedLines.load();
+  metrics["frames"] = frames;
+  metrics["linesPerFrame"] = frames ? static_cast<float>(_batchedLines) / frames : 0.0f;
+  metrics["droppedFrames"] = _droppedFrames.load();
+  JsonObject scrollback = metrics["scrollback"].to<JsonObject>();
+  scrollback["size"] = _scrollbackSize;
+  scrollback["psram"] = _scrollbackPSRAM;
+  scrollback["used"] = _scrollbackUsed;
+  scrollback["evicted"] = _evicted.load();
+  scrollback["replayFrames"] = _replayFrames.load();
+  metrics["disconnected"] = _disconnected.load();
+  metrics["queueHighWater"] = _highWater.load();
+  JsonArray clients = metrics["clients"].to<JsonArray>();
+  std::lock_guard<std::mutex> lock(_clientsMutex);
+  for (const Client& client : _clients) {
+    JsonObject jsonClient = clients.add<JsonObject>();
+    jsonClient["id"] = client.id;
+    jsonClient["heldBack"] = client.count;
+    jsonClient["queueHighWater"] = client.highWater;
+  }
 }
@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <Preferences.h>
+#include <errno.h>
+#include <lwip/sockets.h>
+#include <thingy.h>
+
+#define TAG "PrinterDiscovery"
+
+void PrinterDiscovery::begin(Scheduler* scheduler) {
+  // Task handling
+  _scheduler = scheduler;
+
+  // the printer found last
+  Preferences preferences;
+  preferences.begin("k2rfid", true);
+  _printer = preferences.getUInt("printer", 0);
+  preferences.end();
+
+  // create and run a task for setting up the endpoints
+  Task* discoveryTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _discoveryCallback(); }, _scheduler, false, NULL, NULL, true);
+  discoveryTask->enable();
+  discoveryTask->waitFor(webServerAPI.getStatusRequest());
+}
+
+void PrinterDiscovery::end() {
+  if (_pollTask != nullptr) {
+    _pollTask->disable();
+    _pollTask = nullptr;
+  }
+  for (Probe& probe : _probes)
+    _closeProbe(probe);
+  if (_getHandler != nullptr) {
+    _webServer->removeHandler(_getHandler);
+    _getHandler = nullptr;
+  }
+  if (_postHandler != nullptr) {
+    _webServer->removeHandler(_postHandler);
+    _postHandler = nullptr;
+  }
+}
+
+// Add the printer endpoint to the webserver
+void PrinterDiscovery::_discoveryCallback() {
+  LOGD(TAG, "Starting PrinterDiscovery...");
+
+  // run the probes in the loop task
+  _pollTask = new Task(PRINTER_POLL_INTERVAL, TASK_FOREVER, [&] { _pollCallback(); }, _scheduler, false, NULL, NULL, true);
+  _pollTask->enable();
+
+  _getHandler = &_webServer->on("/api/printer", HTTP_GET, [&](AsyncWebServerRequest* request) { _handleRequest(request); });
+  _getHandler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+  _postHandler = &_webServer->on("/api/printer", HTTP_POST, [&](AsyncWebServerRequest* request) {
+    requestDiscovery();
+    _handleRequest(request);
+  });
+  _postHandler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+
+  LOGD(TAG, "...done!");
+}
+
+const char* PrinterDiscovery::getStateName(State state) {
+  switch (state) {
+    case State::IDLE:
+      return "idle";
+    case State::VALIDATING:
+      return "validating";
+    case State::SCANNING:
+      return "scanning";
+    case State::FOUND:
+      return "found";
+    case State::NOT_FOUND:
+      return "not_found";
+    default:
+      return "unknown";
+  }
+}
+
+void PrinterDiscovery::_pollCallback() {
+  if (_discoveryRequested.exchange(false) && _state != State::VALIDATING && _state != State::SCANNING)
+    _start();
+  if (_state != State::VALIDATING && _state != State::SCANNING)
+    return;
+
+  // wait for all probes at once, without blocking
+  fd_set readSet, writeSet;
+  FD_ZERO(&readSet);
+  FD_ZERO(&writeSet);
+  int maxFd = -1;
+  for (Probe& probe : _probes) {
+    if (probe.state == ProbeState::CONNECTING) {
+      FD_SET(probe.fd, &writeSet);
+    } else if (probe.state == ProbeState::RECEIVING) {
+      FD_SET(probe.fd, &readSet);
+    } else {
+      continue;
+    }
+    maxFd = max(maxFd, probe.fd);
+  }
+  timeval timeout = {0, 0};
+  if (maxFd >= 0 && select(maxFd + 1, &readSet, &writeSet, nullptr, &timeout) < 0) {
+    LOGE(TAG, "select failed: %d", errno);
+    return;
+  }
+
+  uint32_t now = millis();
+  for (Probe& probe : _probes) {
+    if (probe.state == ProbeState::CONNECTING && FD_ISSET(probe.fd, &writeSet)) {
+      // connected (or refused)
+      int error = 0;
+      socklen_t length = sizeof(error);
+      getsockopt(probe.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+      if (error) {
+        _probeDone(probe, false);
+        continue;
+      }
+      char request[64];
+      int len = snprintf(request, sizeof(request), "GET /info HTTP/1.0\r\nHost: %s\r\n\r\n", IPAddress(probe.ip).toString().c_str());
+      if (send(probe.fd, request, len, 0) != len) {
+        _probeDone(probe, false);
+        continue;
+      }
+      probe.state = ProbeState::RECEIVING;
+    } else if (probe.state == ProbeState::RECEIVING && FD_ISSET(probe.fd, &readSet)) {
+      // keep some data for finding the model across reads
+      if (probe.length == PRINTER_PROBE_BUFFER) {
+        memmove(probe.buffer, probe.buffer + PRINTER_PROBE_BUFFER / 2, PRINTER_PROBE_BUFFER / 2);
+        probe.length = PRINTER_PROBE_BUFFER / 2;
+      }
+      int len = recv(probe.fd, probe.buffer + probe.length, PRINTER_PROBE_BUFFER - probe.length, 0);
+      if (len <= 0) {
+        // closed without the model
+        if (len == 0 || (errno != EWOULDBLOCK && errno != EAGAIN))
+          _probeDone(probe, false);
+        continue;
+      }
+      probe.length += len;
+      probe.buffer[probe.length] = 0;
+      if (_checkResponse(probe))
+        continue;
+    }
+    if (probe.state != ProbeState::FREE && now - probe.start > PRINTER_PROBE_TIMEOUT)
+      _probeDone(probe, false);
+  }
+  if (_state != State::VALIDATING && _state != State::SCANNING)
+    return;
+
+  // keep the probes busy
+  bool running = false;
+  for (Probe& probe : _probes) {
+    uint32_t ip;
+    if (probe.state == ProbeState::FREE && _state == State::SCANNING && _nextHost(ip))
+      _startProbe(probe, ip);
+    running = running || probe.state != ProbeState::FREE;
+  }
+  if (!running && (_state != State::SCANNING || _nextHostIndex >= 255))
+    _finish(State::NOT_FOUND);
+}
+
+void PrinterDiscovery::_start() {
+  _startTime = millis();
+  _probeCount = 0;
+  _fromCache = false;
+  _self = espNetwork.getESPConnect()->getIPAddress();
+  if (static_cast<uint32_t>(_self) == 0 || eventHandler.getNetworkState() == Mycila::ESPConnect::State::PORTAL_STARTED) {
+    LOGW(TAG, "No network for finding the printer");
+    _finish(State::NOT_FOUND);
+    return;
+  }
+
+  // try the printer found last first, it usually is still there
+  _nextHostIndex = 1;
+  _cached = _printer;
+  if (_cached && _startProbe(_probes[0], _cached)) {
+    LOGD(TAG, "Validating printer at %s", IPAddress(_cached).toString().c_str());
+    _state = State::VALIDATING;
+  } else {
+    LOGI(TAG, "Scanning %u.%u.%u.0/24 for a printer", _self[0], _self[1], _self[2]);
+    _state = State::SCANNING;
+  }
+}
+
+// the next host of the subnet, false when done
+bool PrinterDiscovery::_nextHost(uint32_t& ip) {
+  while (_nextHostIndex < 255) {
+    IPAddress host(_self[0], _self[1], _self[2], _nextHostIndex++);
+    ip = static_cast<uint32_t>(host);
+    if (host != _self && ip != _cached)
+      return true;
+  }
+  return false;
+}
+
+bool PrinterDiscovery::_startProbe(Probe& probe, uint32_t ip) {
+  probe.fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (probe.fd < 0) {
+    LOGE(TAG, "No socket available: %d", errno);
+    return false;
+  }
+  fcntl(probe.fd, F_SETFL, fcntl(probe.fd, F_GETFL, 0) | O_NONBLOCK);
+
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(80);
+  address.sin_addr.s_addr = ip;
+  if (connect(probe.fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 && errno != EINPROGRESS) {
+    close(probe.fd);
+    probe.fd = -1;
+    return false;
+  }
+
+  probe.state = ProbeState::CONNECTING;
+  probe.ip = ip;
+  probe.start = millis();
+  probe.headerChecked = false;
+  probe.length = 0;
+  _probeCount++;
+  return true;
+}
+
+void PrinterDiscovery::_closeProbe(Probe& probe) {
+  if (probe.fd >= 0)
+    close(probe.fd);
+  probe.fd = -1;
+  probe.state = ProbeState::FREE;
+}
+
+// look for an HTTP 200 and "model": "F008", true when the probe is done
+bool PrinterDiscovery::_checkResponse(Probe& probe) {
+  if (!probe.headerChecked) {
+    if (probe.length < 12)
+      return false;
+    probe.headerChecked = true;
+    int status = 0;
+    if (sscanf(probe.buffer, "HTTP/%*d.%*d %d", &status) != 1 || status != 200) {
+      _probeDone(probe, false);
+      return true;
+    }
+  }
+
+  const char* model = strstr(probe.buffer, "\"model\"");
+  if (model == nullptr)
+    return false;
+  // "model" : "F008" (wait for the complete value)
+  const char* value = model + 7;
+  while (*value == ' ' || *value == ':')
+    value++;
+  if (!*value)
+    return false;
+  if (*value != '"') {
+    _probeDone(probe, false);
+    return true;
+  }
+  const char* end = strchr(value + 1, '"');
+  if (end == nullptr)
+    return false;
+  _probeDone(probe, end - value - 1 == strlen(PRINTER_MODEL) && strncmp(value + 1, PRINTER_MODEL, strlen(PRINTER_MODEL)) == 0);
+  return true;
+}
+
+void PrinterDiscovery::_probeDone(Probe& probe, bool isPrinter) {
+  uint32_t ip = probe.ip;
+  _closeProbe(probe);
+
+  if (isPrinter) {
+    _fromCache = _state == State::VALIDATING;
+    if (ip != _printer) {
+      _printer = ip;
+      Preferences preferences;
+      preferences.begin("k2rfid", false);
+      preferences.putUInt("printer", ip);
+      preferences.end();
+    }
+    _finish(State::FOUND);
+    return;
+  }
+
+  // the printer moved, look for it
+  if (_state == State::VALIDATING) {
+    LOGI(TAG, "No printer at %s anymore, scanning %u.%u.%u.0/24", IPAddress(ip).toString().c_str(), _self[0], _self[1], _self[2]);
+    _state = State::SCANNING;
+  }
+}
+
+void PrinterDiscovery::_finish(State state) {
+  for (Probe& probe : _probes)
+    _closeProbe(probe);
+  _duration = millis() - _startTime;
+  _state = state;
+  if (state == State::FOUND) {
+    LOGI(TAG, "Found printer at %s after %u probes in %u ms", getPrinter().toString().c_str(), _probeCount.load(), _duration.load());
+  } else {
+    LOGI(TAG, "Found no printer after %u probes in %u ms", _probeCount.load(), _duration.load());
+  }
+}
+
+void PrinterDiscovery::_handleRequest(AsyncWebServerRequest* request) {
+  JsonDocument jsonMsg;
+  State state = _state;
+  // a requested discovery is about to start
+  if (_discoveryRequested && state != State::VALIDATING && state != State::SCANNING)
+    state = State::VALIDATING;
+  jsonMsg["state"] = getStateName(state);
+  if (_printer)
+    jsonMsg["ip"] = getPrinter().toString();
+  if (state == State::FOUND || state == State::NOT_FOUND) {
+    jsonMsg["cached"] = _fromCache.load();
+    jsonMsg["probes"] = _probeCount.load();
+    jsonMsg["ms"] = _duration.load();
+  }
+
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  serializeJson(jsonMsg, *response);
+  request->send(response);
+}
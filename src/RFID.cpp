@@ -5,6 +5,7 @@
 
 #include <Adafruit_PN532.h>
 #include <Preferences.h>
+#include <esp_timer.h>
 #include <thingy.h>
 
 #include <iostream>
@@ -21,22 +22,17 @@ void RFID::begin(Scheduler* scheduler) {
   Task* initNFCTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _initNFCcallback(); }, _scheduler, false, NULL, NULL, true);
   initNFCTask->enable();
   initNFCTask->waitFor(webSite.getStatusRequest());
-
-  // Register listener to website
-  webSite.listenSpooldata([&](JsonDocument doc) { _spooldataRxCallback(doc); });
 }
 
 void RFID::end() {
   LOGD(TAG, "Stopping RFID...");
   _PN532Status = false;
-  if (_rfidReadTask != nullptr) {
-    _rfidReadTask->disable();
-  }
-  if (_rfidWriteTask != nullptr) {
-    _rfidWriteTask->disable();
+
+  // let the reader task finish its current cycle and delete itself
+  _stopTask = true;
+  if (_taskHandle != nullptr) {
+    xTaskNotifyGive(_taskHandle);
   }
-  _tagReadCallback = nullptr;
-  _tagWriteCallback = nullptr;
   LOGD(TAG, "...done!");
 }
 
@@ -51,6 +47,96 @@ void RFID::_initNFCcallback() {
     return;
   }
 
+  // already running
+  if (_taskHandle != nullptr)
+    return;
+
+  // get some preference for writing behaviour
+  Preferences preferences;
+  preferences.begin("k2rfid", true);
+  _overwriteEnabled = preferences.getBool("overwrite", false);
+  preferences.end();
+  _armedOverwrite = _overwriteEnabled;
+
+  // the reader gets a task of its own, so blocking PN532 calls never delay the network handling
+  LOGD(TAG, "Starting RFID task...");
+  _stopTask = false;
+  if (xTaskCreatePinnedToCore(_rfidTask, "rfid", RFID_TASK_STACK_SIZE, this, RFID_TASK_PRIORITY, &_taskHandle, RFID_TASK_CORE) != pdPASS) {
+    _taskHandle = nullptr;
+    LOGE(TAG, "Unable to create RFID task");
+  }
+}
+
+// Queue a command for the reader task and wake it up (any task)
+void RFID::_postCommand(const Command& command) {
+  size_t ticket;
+  Command* slot = _commands.reserve(ticket);
+  if (slot == nullptr) {
+    LOGE(TAG, "RFID command queue is full, command dropped");
+    return;
+  }
+  *slot = command;
+  _commands.commit(ticket);
+  if (_taskHandle != nullptr) {
+    xTaskNotifyGive(_taskHandle);
+  }
+}
+
+// Post an event to the tag event bus (from the reader task)
+void RFID::_postEvent(TagEvent::Type type, const CFSTag* tag, bool success) {
+  TagEvent* event = tagEventBus.reserve(type);
+  if (event == nullptr) {
+    LOGW(TAG, "Tag event queue is full, event dropped");
+    return;
+  }
+  // the slot is reused, don't pass on the tag of an earlier event
+  event->tag = tag != nullptr ? *tag : CFSTag();
+  event->success = success;
+  event->armed = _armed;
+  event->overwrite = _armedOverwrite;
+  event->armId = _armId;
+  event->reader = _PN532Status;
+  tagEventBus.commit();
+}
+
+void RFID::_rfidTask(void* arg) {
+  static_cast<RFID*>(arg)->_rfidLoop();
+}
+
+// Main loop of the reader task
+void RFID::_rfidLoop() {
+  // initialize the reader (and retry until it is found)
+  while (!_stopTask && !_initNFC()) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(250));
+  }
+
+  // continuously try to find and read tags in proximity
+  _state = State::IDLE;
+  _stateEntered = esp_timer_get_time();
+  TickType_t nextPoll = xTaskGetTickCount();
+  while (!_stopTask) {
+    _processCommands();
+
+    TickType_t now = xTaskGetTickCount();
+    if (static_cast<int32_t>(now - nextPoll) >= 0) {
+      _holdOff = pdMS_TO_TICKS(RFID_POLL_INTERVAL);
+      _runStateMachine();
+      nextPoll = now + _holdOff;
+      now = xTaskGetTickCount();
+    }
+
+    // sleep until the next poll is due or a command arrives
+    if (static_cast<int32_t>(nextPoll - now) > 0) {
+      ulTaskNotifyTake(pdTRUE, nextPoll - now);
+    }
+  }
+
+  LOGD(TAG, "RFID task stopped");
+  _taskHandle = nullptr;
+  vTaskDelete(NULL);
+}
+
+bool RFID::_initNFC() {
   LOGD(TAG, "Starting RFID...");
   _spi->begin(PN532_SCK, PN532_MISO, PN532_MOSI, PN532_SS);
   _nfc.begin();
@@ -58,29 +144,37 @@ void RFID::_initNFCcallback() {
   uint32_t versiondata = _nfc.getFirmwareVersion();
   if (!versiondata) {
     LOGE(TAG, "Didn't find PN53x board");
+    return false;
+  }
 
-    // Retry initialization
-    Task* initNFCTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _initNFCcallback(); }, _scheduler, false, NULL, NULL, true);
-    initNFCTask->enableDelayed(250);
-  } else {
-    // Got ok data, print it out!
-    LOGD(TAG, "Found chip PN5%x", (versiondata >> 24) & 0xFF);
-    LOGD(TAG, "Firmware ver. %d.%d", (versiondata >> 16) & 0xFF, (versiondata >> 8) & 0xFF);
-    LOGD(TAG, "...done!");
-
-    // get some preference for writing behaviour
-    Preferences preferences;
-    preferences.begin("k2rfid", true);
-    _overwriteEnabled = preferences.getBool("overwrite", false);
-    preferences.end();
+  // Got ok data, print it out!
+  LOGD(TAG, "Found chip PN5%x", (versiondata >> 24) & 0xFF);
+  LOGD(TAG, "Firmware ver. %d.%d", (versiondata >> 16) & 0xFF, (versiondata >> 8) & 0xFF);
+  LOGD(TAG, "...done!");
+  _PN532Status = true;
 
-    // start a task for continuously trying to find and read tags in proximity
-    _rfidReadTask = new Task(250, TASK_FOREVER, [&] { _rfidReadCallback(); }, _scheduler, false, NULL, NULL, true);
-    _rfidReadTask->enable();
-    _PN532Status = true;
+  // announce the reader state
+  _postEvent(TagEvent::Type::STATE_CHANGED);
+  return true;
+}
 
-    // show LED state
-    led.setMode(getStatus_as_LEDMode());
+// Apply commands from the web layer and the loop task (in the reader task)
+void RFID::_processCommands() {
+  Command* command;
+  while ((command = _commands.front()) != nullptr) {
+    switch (command->type) {
+      case Command::Type::SPOOLDATA:
+        _spooldata = command->spooldata;
+        break;
+      case Command::Type::ARM:
+        _armed = command->enable;
+        _armedOverwrite = command->overwrite;
+        _armId = command->armId;
+        _writeError = 0;
+        _postEvent(TagEvent::Type::STATE_CHANGED);
+        break;
+    }
+    _commands.release();
   }
 }
 
@@ -92,162 +186,242 @@ void RFID::_doBeep(uint32_t freq) {
 #endif
 }
 
-// try to read tag
-void RFID::_rfidReadCallback() {
-  try { // check if some tag is present
-    CFSTag tag(&_nfc);
-
-    // new tag is foud
-    if (_lastTag != tag) {
-      _lastTag = tag;
-      _tagInProximity = true;
-      _newTagInProximity = true;
-      if (tag._encrypted) {
-        LOGI(TAG, "encrypted tag (%s) found...", static_cast<std::string>(tag.getUid()).c_str());
-      } else {
-        LOGI(TAG, "un-encrypted tag (%s) found...", static_cast<std::string>(tag.getUid()).c_str());
-      }
-
-      // read spooldata from tag
-      if (tag.readSpoolData(&_nfc)) {
-        if (tag.isEmpty()) {
-          LOGD(TAG, "tag is empty...");
-          // possibly write tag here
-          if (_writeEnabled) {
-            LOGW(TAG, "writing empty tag...");
-            bool write_result = tag.writeSpoolData(&_nfc, _spooldata);
-            led.setMode(LED::LEDMode::TAG_WRITTEN);
-            _doBeep(2000);
-            // invoke callback
-            if (_tagWriteCallback != nullptr) {
-              _tagWriteCallback(write_result);
-            }
-          } else {
-            led.setMode(LED::LEDMode::TAG_READ);
-            _doBeep();
-            // invoke event callback
-            if (_tagReadCallback != nullptr) {
-              _tagReadCallback(tag);
-            }
-          }
-        } else {
-          LOGD(TAG, "tag is not empty...");
-          // LOGD(TAG, "read from tag: %s", static_cast<std::string>(tag.getSpooldata()).c_str());
-          // possibly write tag here
-          if (_writeEnabled && _overwriteEnabled) {
-            LOGW(TAG, "re-writing tag...");
-            bool overwrite_result = tag.writeSpoolData(&_nfc, _spooldata);
-            if (overwrite_result) {
-              led.setMode(LED::LEDMode::TAG_REWRITTEN);
-              _doBeep(2000);
-              _writeError = 0;
-              // invoke event callback
-              if (_tagWriteCallback != nullptr) {
-                _tagWriteCallback(overwrite_result);
-              }
-            } else {
-              _tagInProximity = false;
-              _newTagInProximity = false;
-              _lastTag = CFSTag();
-              if (++_writeError > 10) {
-                // invoke event callback
-                if (_tagWriteCallback != nullptr) {
-                  _tagWriteCallback(overwrite_result);
-                }
-                led.setMode(LED::LEDMode::ERROR);
-                _doBeep(3000);
-              }
-            }
-          } else {
-            // Only signal when writing isn't enabled
-            if (!_writeEnabled) {
-              led.setMode(LED::LEDMode::TAG_READ);
-              _doBeep();
-            }
-            // invoke event callback
-            if (_tagReadCallback != nullptr) {
-              _tagReadCallback(tag);
-            }
-          }
-        }
-      } else {
-        LOGW(TAG, "tag data corrupted or reader error...");
-        // possibly write tag here
-        if (_writeEnabled && _overwriteEnabled) {
-          LOGW(TAG, "writing corrupted tag...");
-          bool write_result = tag.writeSpoolData(&_nfc, _spooldata);
-          if (write_result) {
-            led.setMode(LED::LEDMode::TAG_REWRITTEN);
-            _doBeep(2000);
-            _writeError = 0;
-            // invoke callback
-            if (_tagWriteCallback != nullptr) {
-              _tagWriteCallback(write_result);
-            }
-          } else {
-            _tagInProximity = false;
-            _newTagInProximity = false;
-            _lastTag = CFSTag();
-            if (++_writeError > 10) {
-              // invoke event callback
-              if (_tagWriteCallback != nullptr) {
-                _tagWriteCallback(write_result);
-              }
-              led.setMode(LED::LEDMode::ERROR);
-              _doBeep(3000);
-            }
-          }
-        } else {
-          led.setMode(LED::LEDMode::TAG_READ);
-          _doBeep();
-          // invoke event callback
-          if (_tagReadCallback != nullptr) {
-            _tagReadCallback(tag);
-          }
-        }
-      }
-    } else { // the last tag is still in proximity
-      _tagInProximity = true;
-      _newTagInProximity = false;
+// state table (in order of RFID::State)
+const RFID::StateEntry RFID::_stateTable[static_cast<size_t>(RFID::State::COUNT)] = {
+  {"idle", &RFID::_stateIdle},
+  {"detect", &RFID::_stateDetect},
+  {"authenticate", &RFID::_stateAuthenticate},
+  {"read", &RFID::_stateRead},
+  {"write", &RFID::_stateWrite},
+  {"verify", &RFID::_stateVerify},
+  {"cooldown", &RFID::_stateCooldown},
+};
+
+// run one cycle of the state machine (in the reader task)
+void RFID::_runStateMachine() {
+  do {
+    _transition((this->*_stateTable[static_cast<size_t>(_state)].handler)());
+  } while (_state != State::IDLE);
+}
+
+// account the time spent in the current state and move on
+void RFID::_transition(State next) {
+  int64_t now = esp_timer_get_time();
+  uint32_t elapsed = static_cast<uint32_t>(now - _stateEntered);
+  std::unique_lock<std::mutex> lock(_metricsMutex);
+  StateTiming& timing = _stateTiming[static_cast<size_t>(_state)];
+  timing.count++;
+  timing.lastUs = elapsed;
+  timing.totalUs += elapsed;
+  if (elapsed > timing.maxUs)
+    timing.maxUs = elapsed;
+
+  Transition& transition = _trace[_traceCount++ % RFID_TRACE_LENGTH];
+  transition.timestamp = millis();
+  transition.durationUs = elapsed;
+  transition.from = _state;
+  transition.to = next;
+  lock.unlock();
+#ifdef RFID_TRACE_STATES
+  LOGD(TAG, "%s -> %s (%u us)", _stateTable[static_cast<size_t>(_state)].name, _stateTable[static_cast<size_t>(next)].name, elapsed);
+#endif
+
+  _state = next;
+  _stateEntered = now;
+}
+
+// waiting for the next poll
+RFID::State RFID::_stateIdle() {
+  return State::DETECT;
+}
+
+// check if some tag is present
+RFID::State RFID::_stateDetect() {
+  if (!_tag.detect(&_nfc))
+    return _tagMissing();
+
+  _retryCounter = RETRIES;
+
+  // the last tag is still in proximity
+  if (_tag == _lastTag) {
+    _tagInProximity = true;
+    _newTagInProximity = false;
+    return State::IDLE;
+  }
+
+  // new tag is found
+  return State::AUTHENTICATE;
+}
+
+RFID::State RFID::_stateAuthenticate() {
+  if (!_tag.authenticate(&_nfc))
+    return _tagMissing();
+
+  _lastTag = _tag;
+  _tagInProximity = true;
+  _newTagInProximity = true;
+  if (_tag.isEncrypted()) {
+    LOGI_UNLIMITED(TAG, "encrypted tag (%s) found...", static_cast<std::string>(_tag.getUid()).c_str());
+  } else {
+    LOGI_UNLIMITED(TAG, "un-encrypted tag (%s) found...", static_cast<std::string>(_tag.getUid()).c_str());
+  }
+  _postEvent(TagEvent::Type::TAG_ARRIVED, &_tag);
+  return State::READ;
+}
+
+// read spooldata from tag and decide whether to write it
+RFID::State RFID::_stateRead() {
+  _readSuccess = _tag.readSpoolData(&_nfc);
+  if (!_readSuccess) {
+    LOGW(TAG, "tag data corrupted or reader error...");
+  } else if (_tag.isEmpty()) {
+    LOGD(TAG, "tag is empty...");
+  } else {
+    LOGD(TAG, "tag is not empty...");
+  }
+
+  // write empty tags when armed, overwrite any tag when armed for overwriting
+  if (_armed && (_armedOverwrite || (_readSuccess && _tag.isEmpty()))) {
+    if (!_readSuccess) {
+      LOGW(TAG, "writing corrupted tag...");
+    } else if (_tag.isEmpty()) {
+      LOGW(TAG, "writing empty tag...");
+    } else {
+      LOGW(TAG, "re-writing tag...");
     }
-  } catch (const runtime_error& e) { // no tag in proximity
-    if (!(--_retryCounter)) {        // try it a few times before accepting that the tag is really gone
-      _retryCounter = RETRIES;
-      if (_lastTag != CFSTag()) { // well, it seems to be really gone
-        LOGI(TAG, "tag (%s) is gone...\n", static_cast<std::string>(_lastTag.getUid()).c_str());
-        _lastTag = CFSTag();
-      }
-      _tagInProximity = false;
-      _newTagInProximity = false;
+    return State::WRITE;
+  }
+
+  // Only signal when writing isn't enabled (or the tag is unreadable)
+  if (!_armed || !_readSuccess) {
+    _doBeep();
+  }
+  _postEvent(TagEvent::Type::READ_DONE, &_tag, _readSuccess);
+  return State::COOLDOWN;
+}
+
+RFID::State RFID::_stateWrite() {
+  if (!_tag.writeSpoolData(&_nfc, _spooldata))
+    return _writeFailed();
+  return State::VERIFY;
+}
+
+RFID::State RFID::_stateVerify() {
+  if (!_tag.verifySpoolData(&_nfc, _spooldata))
+    return _writeFailed();
+
+  _doBeep(2000);
+  _writeError = 0;
+  _postEvent(TagEvent::Type::WRITE_DONE, &_tag, true);
+  return State::COOLDOWN;
+}
+
+// hold off the next detection after an operation
+RFID::State RFID::_stateCooldown() {
+  _holdOff = pdMS_TO_TICKS(RFID_COOLDOWN_INTERVAL);
+  return State::IDLE;
+}
+
+// no tag (or no tag we can access) in proximity
+RFID::State RFID::_tagMissing() {
+  if (!(--_retryCounter)) { // try it a few times before accepting that the tag is really gone
+    _retryCounter = RETRIES;
+    if (_lastTag != CFSTag()) { // well, it seems to be really gone
+      LOGI_UNLIMITED(TAG, "tag (%s) is gone...", static_cast<std::string>(_lastTag.getUid()).c_str());
+      _postEvent(TagEvent::Type::TAG_LEFT, &_lastTag);
+      _lastTag = CFSTag();
     }
+    _tagInProximity = false;
+    _newTagInProximity = false;
+  }
+  return State::IDLE;
+}
+
+// writing or verifying failed
+RFID::State RFID::_writeFailed() {
+  // forget the tag, so writing is retried when it is detected again
+  _tagInProximity = false;
+  _newTagInProximity = false;
+  _lastTag = CFSTag();
+
+  // give up after some retries
+  if (++_writeError > RFID_WRITE_RETRIES) {
+    _writeError = 0;
+    _doBeep(3000);
+    _postEvent(TagEvent::Type::WRITE_DONE, &_tag, false);
+    _postEvent(TagEvent::Type::ERROR, &_tag);
+  }
+  return State::COOLDOWN;
+}
+
+// add state timings and the latest transitions to metrics
+void RFID::reportMetrics(const JsonObject& metrics) {
+  // a consistent copy, the JSON is built without holding up the reader task
+  StateTiming timings[static_cast<size_t>(State::COUNT)];
+  Transition transitions[RFID_TRACE_LENGTH];
+  uint32_t traceCount;
+  {
+    std::lock_guard<std::mutex> lock(_metricsMutex);
+    memcpy(timings, _stateTiming, sizeof(timings));
+    memcpy(transitions, _trace, sizeof(transitions));
+    traceCount = _traceCount;
+  }
+
+  JsonObject states = metrics["states"].to<JsonObject>();
+  for (size_t i = 0; i < static_cast<size_t>(State::COUNT); ++i) {
+    const StateTiming& timing = timings[i];
+    JsonObject state = states[_stateTable[i].name].to<JsonObject>();
+    state["count"] = timing.count;
+    state["lastUs"] = timing.lastUs;
+    state["maxUs"] = timing.maxUs;
+    state["avgUs"] = timing.count ? static_cast<uint32_t>(timing.totalUs / timing.count) : 0;
+  }
+
+  JsonArray trace = metrics["trace"].to<JsonArray>();
+  uint32_t first = traceCount > RFID_TRACE_LENGTH ? traceCount - RFID_TRACE_LENGTH : 0;
+  for (uint32_t i = first; i < traceCount; ++i) {
+    const Transition& transition = transitions[i % RFID_TRACE_LENGTH];
+    JsonObject entry = trace.add<JsonObject>();
+    entry["t"] = transition.timestamp;
+    entry["from"] = _stateTable[static_cast<size_t>(transition.from)].name;
+    entry["to"] = _stateTable[static_cast<size_t>(transition.to)].name;
+    entry["us"] = transition.durationUs;
   }
 }
 
 // enable writing tag with the provided SpoolData
-void RFID::enableWriting(bool enable, bool overwrite) {
+// the reader task picks up the new state and announces it on the tag event bus
+uint32_t RFID::enableWriting(bool enable, bool overwrite) {
   _writeEnabled = enable;
   _overwriteEnabled = overwrite;
-  _writeError = 0;
 
-  if (_writeEnabled && _overwriteEnabled) {
-    led.setMode(LED::LEDMode::ARMED_REWRITING);
-  } else if (_writeEnabled && !_overwriteEnabled) {
-    led.setMode(LED::LEDMode::ARMED_WRITING);
-  } else if (!_writeEnabled && _overwriteEnabled) {
-    led.setMode(LED::LEDMode::WAITING_READ);
-  } else {
-    led.setMode(LED::LEDMode::WAITING_READ);
-  }
+  Command command;
+  command.type = Command::Type::ARM;
+  command.enable = enable;
+  command.overwrite = overwrite;
+  command.armId = ++_armCount;
+  _postCommand(command);
+  return command.armId;
 }
 
-// enable writing tag with the provided SpoolData
+// enable beeping on read/write
 void RFID::enableBeep(bool enable) {
   _beep = enable;
 }
 
-// Handle spooldata from app received event
-void RFID::_spooldataRxCallback(JsonDocument doc) {
-  // save it for writing
-  _spooldata = SpoolData(doc);
-  LOGI(TAG, "Spooldata received for writing: %s", static_cast<std::string>(_spooldata).c_str());
+// set spooldata for writing (from the web layer or the loop task)
+void RFID::setSpooldata(const JsonDocument& doc) {
+  // save it for writing (parsing errors are thrown back to the caller)
+  SpoolData spooldata(doc);
+  LOGI_UNLIMITED(TAG, "Spooldata received for writing: %s", static_cast<std::string>(spooldata).c_str());
+  {
+    std::lock_guard<std::mutex> lock(_rxSpooldataMutex);
+    _rxSpooldata = spooldata;
+  }
+
+  // hand it over to the reader task
+  Command command;
+  command.type = Command::Type::SPOOLDATA;
+  command.spooldata = spooldata;
+  _postCommand(command);
 }
@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <thingy.h>
+
+#include <algorithm>
+
+#define TAG "TagAPI"
+
+void TagAPI::begin(Scheduler* scheduler) {
+  // Task handling
+  _scheduler = scheduler;
+  _readers.reserve(TAG_API_MAX_WAITERS);
+
+  // answer the waiting requests from the tag events
+  tagEventBus.subscribe(TagEvent::mask(TagEvent::Type::READ_DONE) | TagEvent::mask(TagEvent::Type::TAG_LEFT) |
+                          TagEvent::mask(TagEvent::Type::WRITE_DONE) | TagEvent::mask(TagEvent::Type::STATE_CHANGED),
+                        [&](const TagEvent& event) { _tagEventCallback(event); });
+
+  // create and run a task for setting up the endpoints
+  Task* apiTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _apiCallback(); }, _scheduler, false, NULL, NULL, true);
+  apiTask->enable();
+  apiTask->waitFor(webServerAPI.getStatusRequest());
+}
+
+void TagAPI::end() {
+  if (_timeoutTask != nullptr) {
+    _timeoutTask->disable();
+    _timeoutTask = nullptr;
+  }
+  if (_getHandler != nullptr) {
+    _webServer->removeHandler(_getHandler);
+    _getHandler = nullptr;
+  }
+  if (_postHandler != nullptr) {
+    _webServer->removeHandler(_postHandler);
+    _postHandler = nullptr;
+  }
+}
+
+// Add the tag endpoints to the webserver
+void TagAPI::_apiCallback() {
+  LOGD(TAG, "Starting TagAPI...");
+
+  // answer requests that waited too long
+  _timeoutTask = new Task(TAG_API_POLL_INTERVAL, TASK_FOREVER, [&] { _timeoutCallback(); }, _scheduler, false, NULL, NULL, true);
+  _timeoutTask->enable();
+
+  _getHandler = &_webServer->on("/api/tag", HTTP_GET, [&](AsyncWebServerRequest* request) { _handleGet(request); });
+  _getHandler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+  _postHandler = new AsyncCallbackJsonWebHandler("/api/tag", [&](AsyncWebServerRequest* request, JsonVariant& json) { _handlePost(request, json); });
+  _postHandler->setMethod(HTTP_POST);
+  _postHandler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+  _webServer->addHandler(_postHandler);
+
+  LOGD(TAG, "...done!");
+}
+
+void TagAPI::_handleGet(AsyncWebServerRequest* request) {
+  bool hasSince = request->hasParam("since");
+  uint32_t since = hasSince ? strtoul(request->getParam("since")->value().c_str(), nullptr, 10) : 0;
+  uint32_t wait = _getWait(request->hasParam("wait") ? strtoul(request->getParam("wait")->value().c_str(), nullptr, 10) : TAG_API_DEFAULT_WAIT);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  // without since, only a tag still on the reader is answered right away
+  if (!hasSince)
+    since = _present ? _seq - 1 : _seq;
+  if (_seq > since) {
+    _reads++;
+    request->send(200, "application/json", _tagJson.c_str());
+    return;
+  }
+  if (!wait) {
+    request->send(204);
+    return;
+  }
+  if (_readers.size() >= TAG_API_MAX_WAITERS) {
+    request->send(503, "text/plain", "Too many waiting requests");
+    return;
+  }
+
+  // long-poll: answered by the next tag read
+  Waiter reader;
+  reader.request = request->getThis();
+  reader.start = millis();
+  reader.wait = wait;
+  reader.since = since;
+  _readers.push_back(reader);
+  request->pause();
+}
+
+void TagAPI::_handlePost(AsyncWebServerRequest* request, JsonVariant& json) {
+  if (!rfid.getStatus()) {
+    request->send(503, "text/plain", "Reader not available");
+    return;
+  }
+  JsonDocument jsonSpool;
+  jsonSpool.set(json["spooldata"]);
+  if (jsonSpool.isNull()) {
+    request->send(400, "text/plain", "spooldata is required");
+    return;
+  }
+  if (!_isValidSpooldata(jsonSpool)) {
+    request->send(400, "text/plain", "spooldata needs color (#RRGGBB), type and weight");
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_writing) {
+    request->send(409, "text/plain", "Writing is running already");
+    return;
+  }
+  try {
+    rfid.setSpooldata(jsonSpool);
+  } catch (...) {
+    request->send(400, "text/plain", "Invalid spooldata");
+    return;
+  }
+
+  // arm a single write, answered by its result
+  _writer.request = request->getThis();
+  _writer.start = millis();
+  _writer.wait = _getWait(json["wait"] | TAG_API_DEFAULT_WAIT);
+  _writing = true;
+  _armId = rfid.enableWriting(true, json["overwrite"] | false);
+  LOGI(TAG, "Writing armed by API");
+  request->pause();
+}
+
+// Serialize the tag read last and answer the waiting readers, or finish the write (in the loop task)
+void TagAPI::_tagEventCallback(const TagEvent& event) {
+  // only the write armed here is answered
+  if (event.type == TagEvent::Type::WRITE_DONE) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_writing && event.armId == _armId)
+      _finishWrite(event.success, &event.tag);
+    return;
+  }
+  // re-armed from elsewhere (e.g. the website), the write is theirs now
+  if (event.type == TagEvent::Type::STATE_CHANGED) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_writing && static_cast<int32_t>(event.armId - _armId) > 0)
+      _finishWrite(false, nullptr, false);
+    return;
+  }
+  if (event.type == TagEvent::Type::TAG_LEFT) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _present = false;
+    return;
+  }
+
+  JsonDocument jsonMsg;
+  jsonMsg["success"] = event.success;
+  jsonMsg["uid"] = static_cast<std::string>(event.tag.getUid()).c_str();
+  jsonMsg["empty"] = event.tag.isEmpty();
+  if (event.success && !event.tag.isEmpty())
+    jsonMsg["spooldata"] = event.tag.getSpooldata();
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  jsonMsg["seq"] = ++_seq;
+  _present = true;
+  _tagJson.clear();
+  serializeJson(jsonMsg, _tagJson);
+  for (Waiter& reader : _readers) {
+    if (_seq > reader.since) {
+      if (auto request = reader.request.lock()) {
+        _reads++;
+        request->send(200, "application/json", _tagJson.c_str());
+      }
+      reader.request.reset();
+    }
+  }
+  _readers.erase(std::remove_if(_readers.begin(), _readers.end(), [](const Waiter& reader) { return reader.request.expired(); }), _readers.end());
+}
+
+void TagAPI::_timeoutCallback() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  uint32_t now = millis();
+  for (Waiter& reader : _readers) {
+    if (now - reader.start >= reader.wait) {
+      if (auto request = reader.request.lock())
+        request->send(204);
+      reader.request.reset();
+      _timeouts++;
+    }
+  }
+  _readers.erase(std::remove_if(_readers.begin(), _readers.end(), [](const Waiter& reader) { return reader.request.expired(); }), _readers.end());
+
+  if (_writing && now - _writer.start >= _writer.wait) {
+    _timeouts++;
+    _finishWrite(false, nullptr);
+  }
+}
+
+// answer the write request and disarm again (with the lock held)
+// - not disarmed when the arming was replaced already
+void TagAPI::_finishWrite(bool success, const CFSTag* tag, bool disarm) {
+  _writing = false;
+  if (disarm)
+    rfid.enableWriting(false, rfid.getOverwriteEnabled());
+
+  JsonDocument jsonMsg;
+  jsonMsg["result"] = success;
+  if (tag != nullptr) {
+    jsonMsg["uid"] = static_cast<std::string>(tag->getUid()).c_str();
+    _writes++;
+  } else {
+    jsonMsg["error"] = disarm ? "timeout" : "replaced";
+  }
+  LOGI_UNLIMITED(TAG, "Writing by API %s", success ? "succeeded" : (tag != nullptr ? "failed" : (disarm ? "timed out" : "replaced")));
+  _sendJson(_writer.request, tag != nullptr ? 200 : (disarm ? 408 : 409), jsonMsg);
+  _writer.request.reset();
+}
+
+// the fields SpoolData can't do without (it doesn't check them)
+bool TagAPI::_isValidSpooldata(const JsonDocument& jsonSpool) {
+  const char* color = jsonSpool["color"] | "";
+  if (strlen(color) != 7 || color[0] != '#' || strspn(color + 1, "0123456789abcdefABCDEF") != 6)
+    return false;
+  return jsonSpool["type"].is<const char*>() && jsonSpool["weight"].is<uint32_t>();
+}
+
+uint32_t TagAPI::_getWait(uint32_t wait) {
+  return min(wait, static_cast<uint32_t>(TAG_API_MAX_WAIT));
+}
+
+void TagAPI::_sendJson(AsyncWebServerRequestPtr& request, int code, const JsonDocument& jsonMsg) {
+  if (auto paused = request.lock()) {
+    AsyncResponseStream* response = paused->beginResponseStream("application/json");
+    response->setCode(code);
+    serializeJson(jsonMsg, *response);
+    paused->send(response);
+  }
+}
+
+void TagAPI::reportMetrics(JsonObject metrics) {
+  metrics["reads"] = _reads.load();
+  metrics["writes"] = _writes.load();
+  metrics["timeouts"] = _timeouts.load();
+  std::lock_guard<std::mutex> lock(_mutex);
+  metrics["waiting"] = _readers.size() + (_writing ? 1 : 0);
+}
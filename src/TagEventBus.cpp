@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <thingy.h>
+
+#define TAG "TagEventBus"
+
+void TagEventBus::begin(Scheduler* scheduler) {
+  // Task handling
+  _scheduler = scheduler;
+
+  // create a task for dispatching events to the subscribers
+  _dispatchTask = new Task(20, TASK_FOREVER, [&] { _dispatchCallback(); }, _scheduler, false, NULL, NULL, true);
+  _dispatchTask->enable();
+}
+
+void TagEventBus::end() {
+  if (_dispatchTask != nullptr) {
+    _dispatchTask->disable();
+    _dispatchTask = nullptr;
+  }
+  for (size_t i = 0; i < _subscriberCount; ++i) {
+    _subscribers[i] = Subscription();
+  }
+  _subscriberCount = 0;
+}
+
+bool TagEventBus::subscribe(uint32_t mask, Subscriber subscriber) {
+  if (_subscriberCount >= TAG_EVENT_MAX_SUBSCRIBERS) {
+    LOGE(TAG, "No free subscriber slot");
+    return false;
+  }
+  _subscribers[_subscriberCount].mask = mask;
+  _subscribers[_subscriberCount].callback = subscriber;
+  _subscriberCount++;
+  return true;
+}
+
+TagEvent* TagEventBus::reserve(TagEvent::Type type) {
+  TagEvent* event = _ring.reserve();
+  if (event == nullptr) {
+    _dropped++;
+    return nullptr;
+  }
+  event->type = type;
+  event->timestamp = millis();
+  event->success = false;
+  return event;
+}
+
+// Hand all pending events to the interested subscribers (runs in the Scheduler)
+void TagEventBus::_dispatchCallback() {
+  const TagEvent* event;
+  while ((event = _ring.front()) != nullptr) {
+    const uint32_t mask = TagEvent::mask(event->type);
+    for (size_t i = 0; i < _subscriberCount; ++i) {
+      if (_subscribers[i].mask & mask) {
+        _subscribers[i].callback(*event);
+      }
+    }
+    _dispatched++;
+    _ring.release();
+  }
+}
@@ -0,0 +1,327 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Copyright (C) 2025 Robert Wendlandt
+ */
+
+#include <thingy.h>
+
+#include <inttypes.h>
+#include <time.h>
+
+#define TAG "TagHistory"
+
+// anything before is not a synced time
+#define HISTORY_MIN_VALID_TIME 1700000000
+
+static const char* const operationNames[] = {"read", "write", "error"};
+
+void TagHistory::begin(Scheduler* scheduler) {
+  // Task handling
+  _scheduler = scheduler;
+
+  // collect the results of tag operations
+  tagEventBus.subscribe(TagEvent::mask(TagEvent::Type::READ_DONE) |
+                          TagEvent::mask(TagEvent::Type::WRITE_DONE) |
+                          TagEvent::mask(TagEvent::Type::ERROR),
+                        [&](const TagEvent& event) { _tagEventCallback(event); });
+
+  // create and run a task for setting up the history (needs the filesystem)
+  Task* historyTask = new Task(TASK_IMMEDIATE, TASK_ONCE, [&] { _historyCallback(); }, _scheduler, false, NULL, NULL, true);
+  historyTask->enable();
+  historyTask->waitFor(webServerAPI.getStatusRequest());
+}
+
+void TagHistory::end() {
+  if (_flushTask != nullptr) {
+    _flushTask->disable();
+    _flushTask = nullptr;
+  }
+  flush();
+  _ready = false;
+  if (_handler != nullptr) {
+    _webServer->removeHandler(_handler);
+    _handler = nullptr;
+  }
+}
+
+// Set up the log and add the history endpoint to the webserver
+void TagHistory::_historyCallback() {
+  LOGD(TAG, "Starting TagHistory...");
+
+  if (!webServerAPI.isFSMounted()) {
+    LOGE(TAG, "Filesystem not mounted, history is disabled");
+    return;
+  }
+  _recover();
+  _ready = true;
+
+  // write buffered records in batches
+  _flushTask = new Task(HISTORY_FLUSH_INTERVAL, TASK_FOREVER, [&] { flush(); }, _scheduler, false, NULL, NULL, true);
+  _flushTask->enable();
+
+  _handler = &_webServer->on("/api/history", HTTP_GET, [&](AsyncWebServerRequest* request) { _handleRequest(request); });
+  _handler->setFilter([](__unused AsyncWebServerRequest* request) {
+    return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
+  });
+
+  LOGD(TAG, "...done!");
+}
+
+// find the next record number from the last record of each segment
+void TagHistory::_recover() {
+  if (!LittleFS.exists(HISTORY_DIR))
+    LittleFS.mkdir(HISTORY_DIR);
+
+  uint32_t next = 0;
+  for (uint32_t segment = 0; segment < HISTORY_SEGMENTS; ++segment) {
+    File file = LittleFS.open(_segmentPath(segment * HISTORY_SEGMENT_RECORDS).c_str(), "r");
+    if (!file)
+      continue;
+    size_t records = file.size() / sizeof(HistoryRecord);
+    HistoryRecord record;
+    if (records &&
+        file.seek((records - 1) * sizeof(HistoryRecord)) &&
+        file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record) &&
+        (record.seq / HISTORY_SEGMENT_RECORDS) % HISTORY_SEGMENTS == segment &&
+        record.seq % HISTORY_SEGMENT_RECORDS == records - 1) {
+      next = max(next, record.seq + 1);
+    }
+    file.close();
+  }
+
+  _flushedSeq = next;
+  LOGI(TAG, "History continues at record %" PRIu32, next);
+}
+
+void TagHistory::_tagEventCallback(const TagEvent& event) {
+  // make room for the record
+  if (_buffered == HISTORY_BUFFER_RECORDS)
+    flush();
+  if (_buffered == HISTORY_BUFFER_RECORDS) {
+    _lost++;
+    LOGW(TAG, "History buffer full, record lost");
+    return;
+  }
+
+  HistoryRecord& record = _buffer[_buffered++];
+  record = HistoryRecord();
+  time_t now = time(nullptr);
+  record.time = now > HISTORY_MIN_VALID_TIME ? static_cast<uint32_t>(now) : 0;
+  record.uptime = event.timestamp;
+  memcpy(record.uid, event.tag.getUid().uidByte, sizeof(record.uid));
+  switch (event.type) {
+    case TagEvent::Type::WRITE_DONE:
+      record.op = HistoryRecord::Operation::WRITE;
+      break;
+    case TagEvent::Type::ERROR:
+      record.op = HistoryRecord::Operation::ERROR;
+      break;
+    default:
+      record.op = HistoryRecord::Operation::READ;
+      break;
+  }
+  record.success = event.success;
+  record.armed = event.armed;
+  record.overwrite = event.overwrite;
+  std::string spooldata = static_cast<std::string>(event.tag.getSpooldata());
+  memcpy(record.spooldata, spooldata.c_str(), min(spooldata.size(), sizeof(record.spooldata)));
+}
+
+// records are numbered when written, so records collected before the filesystem was ready get valid numbers
+void TagHistory::flush() {
+  if (!_ready || !_buffered)
+    return;
+
+  size_t done = 0;
+  uint32_t seq = _flushedSeq;
+  while (done < _buffered) {
+    // write as many records as fit into the current segment in one go
+    uint32_t slot = seq % HISTORY_SEGMENT_RECORDS;
+    size_t count = min<size_t>(_buffered - done, HISTORY_SEGMENT_RECORDS - slot);
+    for (size_t i = 0; i < count; ++i)
+      _buffer[done + i].seq = seq + i;
+
+    // a new segment replaces the oldest one
+    std::string path = _segmentPath(seq);
+    File file = LittleFS.open(path.c_str(), (slot == 0 || !LittleFS.exists(path.c_str())) ? "w" : "r+");
+    if (!file) {
+      LOGE(TAG, "Opening %s failed", path.c_str());
+      break;
+    }
+    size_t written = 0;
+    if (file.seek(slot * sizeof(HistoryRecord)))
+      written = file.write(reinterpret_cast<const uint8_t*>(&_buffer[done]), count * sizeof(HistoryRecord));
+    file.close();
+    if (written != count * sizeof(HistoryRecord)) {
+      LOGE(TAG, "Writing %s failed", path.c_str());
+      break;
+    }
+
+    done += count;
+    seq += count;
+    _flushedSeq = seq;
+  }
+
+  // keep what couldn't be written for the next attempt
+  if (done) {
+    memmove(_buffer, &_buffer[done], (_buffered - done) * sizeof(HistoryRecord));
+    _buffered -= done;
+  }
+}
+
+uint32_t TagHistory::getFirstSeq() {
+  // all segments before the current one are complete
+  uint32_t current = _flushedSeq / HISTORY_SEGMENT_RECORDS;
+  return current >= HISTORY_SEGMENTS - 1 ? (current - (HISTORY_SEGMENTS - 1)) * HISTORY_SEGMENT_RECORDS : 0;
+}
+
+std::string TagHistory::_segmentPath(uint32_t seq) {
+  return std::string(HISTORY_DIR "/") + std::to_string((seq / HISTORY_SEGMENT_RECORDS) % HISTORY_SEGMENTS) + ".bin";
+}
+
+// GET /api/history?cursor=<seq>&limit=<n>&format=csv
+// streams records from the log, the response carries the cursor for the next page
+void TagHistory::_handleRequest(AsyncWebServerRequest* request) {
+  std::shared_ptr<Reader> reader = std::make_shared<Reader>();
+  uint32_t next = _flushedSeq;
+  reader->first = getFirstSeq();
+
+  uint32_t cursor = reader->first;
+  if (request->hasParam("cursor"))
+    cursor = strtoul(request->getParam("cursor")->value().c_str(), nullptr, 10);
+  uint32_t limit = HISTORY_PAGE_LIMIT;
+  if (request->hasParam("limit"))
+    limit = constrain(strtoul(request->getParam("limit")->value().c_str(), nullptr, 10), 1UL, static_cast<unsigned long>(HISTORY_SEGMENTS * HISTORY_SEGMENT_RECORDS));
+  reader->csv = request->hasParam("format") && request->getParam("format")->value() == "csv";
+
+  // records before first are gone already
+  reader->seq = min(max(cursor, reader->first), next);
+  reader->end = reader->seq + min(limit, next - reader->seq);
+
+  AsyncWebServerResponse* response = request->beginChunkedResponse(reader->csv ? "text/csv" : "application/json",
+                                                                   [reader](uint8_t* buffer, size_t maxLen, __unused size_t index) -> size_t {
+                                                                     return _fill(*reader, buffer, maxLen);
+                                                                   });
+  response->addHeader("X-History-Next", String(reader->end));
+  request->send(response);
+}
+
+// copy as much of the output as fits into the chunk
+size_t TagHistory::_fill(Reader& reader, uint8_t* buffer, size_t maxLen) {
+  size_t len = 0;
+  while (len < maxLen) {
+    if (reader.offset >= reader.line.size() && !_nextLine(reader))
+      break;
+    size_t count = min(maxLen - len, reader.line.size() - reader.offset);
+    memcpy(buffer + len, reader.line.data() + reader.offset, count);
+    len += count;
+    reader.offset += count;
+  }
+  return len;
+}
+
+// prepare the next piece of output, false when done
+bool TagHistory::_nextLine(Reader& reader) {
+  char header[64];
+  HistoryRecord record;
+  reader.line.clear();
+  reader.offset = 0;
+
+  switch (reader.phase) {
+    case Reader::Phase::HEADER:
+      reader.phase = Reader::Phase::RECORDS;
+      if (reader.csv) {
+        reader.line = "seq,time,uptime,uid,operation,success,armed,overwrite,spooldata,type,color,weight\n";
+      } else {
+        snprintf(header, sizeof(header), "{\"first\":%" PRIu32 ",\"next\":%" PRIu32 ",\"records\":[", reader.first, reader.end);
+        reader.line = header;
+      }
+      return true;
+
+    case Reader::Phase::RECORDS:
+      // stop early when a record was overwritten in the meantime
+      if (reader.seq < reader.end && _readRecord(reader, record)) {
+        _formatRecord(record, reader.csv, reader.count > 0, reader.line);
+        reader.seq++;
+        reader.count++;
+        return true;
+      }
+      reader.file.close();
+      reader.phase = Reader::Phase::TRAILER;
+      // fall through
+
+    case Reader::Phase::TRAILER:
+      reader.phase = Reader::Phase::DONE;
+      if (reader.csv)
+        return false;
+      reader.line = "]}";
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+bool TagHistory::_readRecord(Reader& reader, HistoryRecord& record) {
+  if (reader.segment != reader.seq / HISTORY_SEGMENT_RECORDS) {
+    reader.file.close();
+    reader.file = LittleFS.open(_segmentPath(reader.seq).c_str(), "r");
+    reader.segment = reader.seq / HISTORY_SEGMENT_RECORDS;
+  }
+  if (!reader.file)
+    return false;
+
+  size_t position = (reader.seq % HISTORY_SEGMENT_RECORDS) * sizeof(HistoryRecord);
+  if (reader.file.position() != position && !reader.file.seek(position))
+    return false;
+  if (reader.file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) != sizeof(record))
+    return false;
+  return record.seq == reader.seq;
+}
+
+void TagHistory::_formatRecord(const HistoryRecord& record, bool csv, bool separator, std::string& line) {
+  char uid[9];
+  snprintf(uid, sizeof(uid), "%02x%02x%02x%02x", record.uid[0], record.uid[1], record.uid[2], record.uid[3]);
+
+  // only keep what belongs into spooldata
+  char spooldata[sizeof(record.spooldata) + 1];
+  size_t len = 0;
+  for (size_t i = 0; i < sizeof(record.spooldata) && record.spooldata[i]; ++i) {
+    if (isalnum(record.spooldata[i]))
+      spooldata[len++] = record.spooldata[i];
+  }
+  spooldata[len] = 0;
+
+  // decode material
+  std::string type = "";
+  std::string color = "";
+  uint32_t weight = 0;
+  if (len) {
+    try {
+      SpoolData spool = SpoolData(std::string(spooldata));
+      type = spool.getType();
+      color = spool.getColorString();
+      weight = spool.getWeight();
+    } catch (const std::exception& e) {
+      type = "";
+      color = "";
+      weight = 0;
+    }
+  }
+
+  const char* operation = operationNames[static_cast<uint8_t>(record.op) % 3];
+  char buffer[256];
+  if (csv) {
+    snprintf(buffer, sizeof(buffer), "%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%s,%s,%u,%u,%u,%s,%s,%s,%" PRIu32 "\n",
+             record.seq, record.time, record.uptime, uid, operation, record.success, record.armed, record.overwrite,
+             spooldata, type.c_str(), color.c_str(), weight);
+  } else {
+    snprintf(buffer, sizeof(buffer),
+             "%s{\"seq\":%" PRIu32 ",\"time\":%" PRIu32 ",\"uptime\":%" PRIu32 ",\"uid\":\"%s\",\"op\":\"%s\",\"success\":%s,\"armed\":%s,\"overwrite\":%s,"
+             "\"spooldata\":\"%s\",\"type\":\"%s\",\"color\":\"%s\",\"weight\":%" PRIu32 "}",
+             separator ? "," : "", record.seq, record.time, record.uptime, uid, operation,
+             record.success ? "true" : "false", record.armed ? "true" : "false", record.overwrite ? "true" : "false",
+             spooldata, type.c_str(), color.c_str(), weight);
+  }
+  line = buffer;
+}
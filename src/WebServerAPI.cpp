@@ -42,10 +42,16 @@ void WebServerAPI::_webServerCallback() {
     _fsMounted = true;
   }
 
+  // assets linked with their content hash (?v=...) never change (the database has its own handler)
+  _webServer->serveStatic("/", LittleFS, "/")
+    .setCacheControl("public, max-age=31536000, immutable")
+    .setFilter([&](AsyncWebServerRequest* request) { return _fsMounted && request->hasParam("v") && request->url() != MATERIAL_DB_URL; });
+
   // Handle getting files from File System (will auto-magically serve the gzipped files)
+  // browsers have to revalidate using the ETag, the database is served by MaterialDB
   _webServer->serveStatic("/", LittleFS, "/")
-    .setCacheControl("max-age=600")
-    .setFilter([&](__unused AsyncWebServerRequest* request) { return _fsMounted; });
+    .setCacheControl("no-cache")
+    .setFilter([&](AsyncWebServerRequest* request) { return _fsMounted && request->url() != MATERIAL_DB_URL; });
 
   // serve logo for espConnect
   _webServer->serveStatic("/logo", LittleFS, "/logo_captive.svg")
@@ -102,6 +108,19 @@ void WebServerAPI::_webServerCallback() {
   _sr.signalComplete();
 }
 
+// answer a conditional GET with 304 when the client's copy is current
+bool WebServerAPI::notModified(AsyncWebServerRequest* request, const char* etag) {
+  if (!request->hasHeader("If-None-Match"))
+    return false;
+  const String& match = request->header("If-None-Match");
+  if (match != "*" && match.indexOf(etag) < 0)
+    return false;
+  AsyncWebServerResponse* response = request->beginResponse(304);
+  response->addHeader("ETag", etag);
+  request->send(response);
+  return true;
+}
+
 StatusRequest* WebServerAPI::getStatusRequest() {
   return &_sr;
 }
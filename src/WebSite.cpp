@@ -8,6 +8,7 @@
 #include <Preferences.h>
 #include <thingy.h>
 
+#include <algorithm>
 #include <string>
 
 #define TAG "WebSite"
@@ -22,6 +23,11 @@ extern const uint8_t thingy_html_end[] asm("_binary__pio_embed_website_html_gz_e
 
 // constants from build process
 extern const char* __COMPILED_BUILD_BOARD__;
+extern const char* __EMBED_ETAG_WEBSITE__;
+
+// messages from the clients
+static constexpr MessageType MSG_ARM_STATE("arm_state");
+static constexpr MessageType MSG_UPDATE_CONFIG("update_config");
 
 void WebSite::begin(Scheduler* scheduler) {
   // Task handling
@@ -35,7 +41,6 @@ void WebSite::begin(Scheduler* scheduler) {
 }
 
 void WebSite::end() {
-  _spooldataCallback = nullptr;
   _sr.setWaiting();
 
   // end the cleanup task
@@ -43,6 +48,10 @@ void WebSite::end() {
     _wsCleanupTask->disable();
     _wsCleanupTask = nullptr;
   }
+  if (_flushTask != nullptr) {
+    _flushTask->disable();
+    _flushTask = nullptr;
+  }
 
   // delete websock handler
   if (_ws != nullptr) {
@@ -52,8 +61,12 @@ void WebSite::end() {
   }
 
 #ifdef MYCILA_WEBSERIAL_SUPPORT_APP
-  webSerial.end();
+  #ifdef LOG_DEFERRED
+  deferredLog.end();
+  #else
   delete webLogger;
+  #endif
+  webSerial.end();
 #endif
 }
 
@@ -74,213 +87,96 @@ void WebSite::_webSiteCallback() {
   // Allow web-logging for K2RFID-app via WebSerial
 #ifdef MYCILA_WEBSERIAL_SUPPORT_APP
   webSerial.begin(_webServer, "/weblog", _scheduler);
-  webSerial.setBuffer(100);
+  #ifdef LOG_DEFERRED
+  deferredLog.begin(_scheduler, &webSerial);
+  deferredLog.setLevel(ARDUHAL_LOG_LEVEL_INFO);
+  #else
   webLogger = new Mycila::Logger();
   webLogger->setLevel(ARDUHAL_LOG_LEVEL_INFO);
   webLogger->forwardTo(&webSerial);
+  #endif
 #endif
 
   // create websock handler
   _ws = new AsyncWebSocket("/ws");
+  _clients.reserve(WSL_MAX_WS_CLIENTS);
+  _registerMessages();
 
-  _ws->onEvent([&](__unused AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, __unused size_t len) -> void {
+  _ws->onEvent([&](__unused AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len) -> void {
     if (type == WS_EVT_CONNECT) {
       client->keepAlivePeriod(10);
       client->setCloseClientOnQueueFull(false);
 
-      // send ID, config, spooldata, arming,...
-      JsonDocument jsonMsg;
-      jsonMsg["type"] = "initial_config";
-      jsonMsg["id"] = client->id();
-      jsonMsg["host"] = espNetwork.getESPConnect()->getIPAddress().toString().c_str();
-      jsonMsg["cloneSerial"] = _cloneSerial;
-#ifdef USE_BEEPER
-      jsonMsg["beepAvailable"] = true;
-      jsonMsg["beepOnRW"] = _beepOnRW;
-#else
-      jsonMsg["beepAvailable"] = false;
-      jsonMsg["beepOnRW"] = false;
-#endif
-      jsonMsg["writeTags"] = rfid.getWriteEnabled();
-      jsonMsg["writeEmptyTags"] = !rfid.getOverwriteEnabled();
-      jsonMsg["PN532"] = rfid.getStatus();
-
-      // append spooldata - from RFID - only when length is available
-      JsonDocument jsonSpool = static_cast<JsonDocument>(rfid.getSpooldata());
-      if (jsonSpool["length"].as<const uint32_t>() > 0) {
-        jsonMsg["spooldata"] = jsonSpool;
+      // clients ask for MessagePack with /ws?format=msgpack
+      // and resume after a reconnect with &epoch=<epoch>&seq=<last seq>
+      AsyncWebServerRequest* request = reinterpret_cast<AsyncWebServerRequest*>(arg);
+      WSClient wsClient;
+      wsClient.id = client->id();
+      if (request != nullptr) {
+        wsClient.binary = request->hasParam("format") && request->getParam("format")->value() == "msgpack";
+        if (request->hasParam("epoch") && request->hasParam("seq")) {
+          wsClient.resume = true;
+          wsClient.epoch = strtoul(request->getParam("epoch")->value().c_str(), nullptr, 10);
+          wsClient.lastSeq = strtoul(request->getParam("seq")->value().c_str(), nullptr, 10);
+        }
       }
 
-      // send welcome message
-      AsyncWebSocketMessageBuffer* buffer = new AsyncWebSocketMessageBuffer(measureJson(jsonMsg));
-      serializeJson(jsonMsg, buffer->get(), buffer->length());
-      client->text(buffer);
-      LOGD(TAG, "Client %d connected", client->id());
+      // ID, config, spooldata, arming,... are sent with the next flush
+      {
+        std::lock_guard<std::mutex> lock(_clientsMutex);
+        _clients.push_back(wsClient);
+      }
+      LOGD(TAG, "Client %d connected (%s)", client->id(), wsClient.binary ? "MessagePack" : "JSON");
     } else if (type == WS_EVT_DISCONNECT) {
+      {
+        std::lock_guard<std::mutex> lock(_clientsMutex);
+        _clients.erase(std::remove_if(_clients.begin(), _clients.end(), [&](const WSClient& wsClient) { return wsClient.id == client->id(); }), _clients.end());
+      }
+      _disconnectTime = millis();
       LOGD(TAG, "Client %d disconnected", client->id());
     } else if (type == WS_EVT_ERROR) {
       LOGD(TAG, "Client %d error", client->id());
     } else if (type == WS_EVT_DATA) {
       AwsFrameInfo* info = reinterpret_cast<AwsFrameInfo*>(arg);
       if (info->final && info->index == 0 && info->len == len) {
-        if (info->opcode == WS_TEXT) {
-          data[len] = 0;
-        }
         // pong on client keep-alive message
-        if (strcmp(reinterpret_cast<char*>(data), "ping") == 0) {
+        if (info->opcode == WS_TEXT && len == 4 && memcmp(data, "ping", 4) == 0) {
           // LOGD(TAG, "Client %d pinged us", client->id());
           client->text("pong");
-        } else { // some message is received
-          JsonDocument jsonRXMsg;
-          DeserializationError error = deserializeJson(jsonRXMsg, reinterpret_cast<char*>(data));
-          if (error == DeserializationError::Ok) {
-            // Which kind of message was received?
-            if (strcmp(jsonRXMsg["type"].as<const char*>(), "arm_state") == 0) {
-              JsonDocument jsonMsg;
-              jsonMsg["type"] = "arm_state";
-              jsonMsg["origin"] = client->id();
-              bool write = jsonRXMsg["writeTags"].as<const bool>();
-              bool writeEmpty = jsonRXMsg["writeEmptyTags"].as<const bool>();
-              if (writeEmpty == rfid.getOverwriteEnabled()) {
-                // save persistent option in preferences
-                Preferences preferences;
-                preferences.begin("k2rfid", false);
-                preferences.putBool("overwrite", !writeEmpty);
-                preferences.end();
-              }
-
-              // for safety, disable writing first
-              if (rfid.getWriteEnabled()) {
-                rfid.enableWriting(false, !writeEmpty);
-              }
-
-              // was spooldata received as well?
-              JsonDocument jsonSpool = jsonRXMsg["spooldata"];
-              if (!jsonSpool.isNull()) {
-                if (_spooldataCallback != nullptr) {
-                  try {
-                    _spooldataCallback(jsonSpool);
-                    jsonMsg["spooldata"] = jsonSpool;
-                  } catch (...) {
-                    // don't try to write in case of errors
-                    write = false;
-                    LOGE(TAG, "ERROR while parsing send spooldata");
-                  }
-                }
-              } else {
-                // don't try to write without spooldatat
-                write = false;
-              }
-
-              // configure programmer
-              rfid.enableWriting(write, !writeEmpty);
-
-              // log the new state
-              if (write && !writeEmpty) {
-                LOGI(TAG, "writing and re-writing enabled");
-              } else if (write && writeEmpty) {
-                LOGI(TAG, "writing (on empty tags) enabled");
-              } else if (!write && !writeEmpty) {
-                LOGI(TAG, "writing disabled (but overwrite is still set)");
-              } else if (!write && writeEmpty) {
-                LOGI(TAG, "writing disabled");
-              }
-
-              // fill remaining fields of the response and send
-              jsonMsg["writeTags"] = write;
-              jsonMsg["writeEmptyTags"] = writeEmpty;
-              AsyncWebSocketMessageBuffer* buffer = new AsyncWebSocketMessageBuffer(measureJson(jsonMsg));
-              serializeJson(jsonMsg, buffer->get(), buffer->length());
-              _ws->textAll(buffer);
-            } else if (strcmp(jsonRXMsg["type"].as<const char*>(), "update_config") == 0) {
-              _beepOnRW = jsonRXMsg["beepOnRW"].as<const bool>();
-              rfid.enableBeep(_beepOnRW);
-              _cloneSerial = jsonRXMsg["cloneSerial"].as<const bool>();
-
-              // save persistent options in preferences
-              Preferences preferences;
-              preferences.begin("k2rfid", false);
-              preferences.putBool("beep", _beepOnRW);
-              preferences.putBool("clone", _cloneSerial);
-              preferences.end();
-
-              // echo the config message to all connected clients
-              JsonDocument jsonMsg;
-              jsonMsg["type"] = "update_config";
-              jsonMsg["origin"] = client->id();
-              jsonMsg["beepOnRW"] = _beepOnRW;
-#ifdef USE_BEEPER
-              jsonMsg["beepAvailable"] = true;
-#else
-              jsonMsg["beepAvailable"] = false;
-#endif
-              jsonMsg["cloneSerial"] = _cloneSerial;
-              AsyncWebSocketMessageBuffer* buffer = new AsyncWebSocketMessageBuffer(measureJson(jsonMsg));
-              serializeJson(jsonMsg, buffer->get(), buffer->length());
-              _ws->textAll(buffer);
-            }
-          }
+          return;
         }
+        // some message is received
+        if (!_dispatcher.dispatch(client, data, len, info->opcode != WS_TEXT))
+          LOGD(TAG, "Client %d sent an unknown or malformed message", client->id());
       }
     }
   });
 
   _webServer->addHandler(_ws);
 
+  // inform clients about a new material database
+  materialDB.onIndexChanged([&]() {
+    if (!_wantEvents())
+      return;
+    JsonDocument jsonMsg(_pool.getAllocator());
+    jsonMsg["type"] = "new_db";
+    _publish(std::move(jsonMsg), true);
+  });
+
   // Handle posting database
   _webServer->on(
-    "/material_database.json",
+    MATERIAL_DB_URL,
     HTTP_POST,
     [&](AsyncWebServerRequest* request) {
       if (request->getResponse()) {
         return;
       }
 
-      // check that writing is actually finished
-      if (request->_tempObject == nullptr)
-        return request->send(400, "text/plain", "Nothing uploaded");
-      if (!(*reinterpret_cast<bool*>(request->_tempObject)))
-        return request->send(400, "text/plain", "Only partial upload");
-
-      // inform clients...
-      JsonDocument jsonMsg;
-      jsonMsg["type"] = "new_db";
-      AsyncWebSocketMessageBuffer* buffer = new AsyncWebSocketMessageBuffer(measureJson(jsonMsg));
-      serializeJson(jsonMsg, buffer->get(), buffer->length());
-      _ws->textAll(buffer);
-
-      request->send(200, "text/plain", "OK");
+      // check that the upload is complete and valid
+      materialDB.finishUpload(request);
     },
-    [](AsyncWebServerRequest* request, String filename, size_t index, uint8_t* data, size_t len, bool final) {
-      if (!index) {
-        // remember that we started writing
-        request->_tempObject = new bool(false);
-
-        // open file
-        request->_tempFile = LittleFS.open("/material_database.json.gz", "w+");
-
-        if (!request->_tempFile)
-          request->abort();
-      }
-
-      if (len) {
-        if (request->_tempObject == nullptr)
-          return request->abort();
-
-        // write content into file
-        request->_tempFile.write(data, len);
-      }
-
-      if (final) {
-        if (request->_tempObject == nullptr)
-          return request->abort();
-
-        // close file
-        request->_tempFile.close();
-
-        // note that writing is done
-        (*reinterpret_cast<bool*>(request->_tempObject)) = true;
-      }
+    [](AsyncWebServerRequest* request, __unused String filename, size_t index, uint8_t* data, size_t len, bool final) {
+      materialDB.handleUpload(request, index, data, len, final);
     });
 
   // serve boardname info
@@ -306,21 +202,31 @@ void WebSite::_webSiteCallback() {
   // serve our home page here, yet only when the ESPConnect portal is not shown
   _webServer->on("/", HTTP_GET, [&](AsyncWebServerRequest* request) {
               // LOGD(TAG, "Serve...");
+              if (WebServerAPI::notModified(request, __EMBED_ETAG_WEBSITE__))
+                return;
               auto* response = request->beginResponse(200,
                                                       "text/html",
                                                       thingy_html_start,
                                                       thingy_html_end - thingy_html_start);
               response->addHeader("Content-Encoding", "gzip");
+              response->addHeader("Cache-Control", "no-cache");
+              response->addHeader("ETag", __EMBED_ETAG_WEBSITE__);
               request->send(response);
             })
     .setFilter([](__unused AsyncWebServerRequest* request) {
       return eventHandler.getNetworkState() != Mycila::ESPConnect::State::PORTAL_STARTED;
     });
 
-  // register event handlers to reader
-  LOGD(TAG, "register event handlers to reader");
-  rfid.listenTagRead([&](CFSTag tag) { _tagReadCallback(tag); });
-  rfid.listenTagWrite([&](bool success) { _tagWriteCallback(success); });
+  // subscribe to events from the reader
+  LOGD(TAG, "subscribe to tag events");
+  tagEventBus.subscribe(TagEvent::mask(TagEvent::Type::READ_DONE) | TagEvent::mask(TagEvent::Type::WRITE_DONE) |
+                          TagEvent::mask(TagEvent::Type::STATE_CHANGED),
+                        [&](const TagEvent& event) { _tagEventCallback(event); });
+
+  // send the queued messages once per tick
+  _epoch = esp_random();
+  _flushTask = new Task(WS_COALESCE_INTERVAL, TASK_FOREVER, [&] { _flushCallback(); }, _scheduler, false, NULL, NULL, true);
+  _flushTask->enable();
 
   // set up a task to cleanup orphan websock-clients
   _disconnectTime = millis();
@@ -331,47 +237,427 @@ void WebSite::_webSiteCallback() {
   LOGD(TAG, "...done!");
 }
 
+// Register the handlers of the messages from the clients, with the fields they read
+void WebSite::_registerMessages() {
+  JsonDocument armStateFilter;
+  armStateFilter["writeTags"] = true;
+  armStateFilter["writeEmptyTags"] = true;
+  armStateFilter["spooldata"] = true;
+  _dispatcher.on(MSG_ARM_STATE, armStateFilter, [&](AsyncWebSocketClient* client, JsonDocument& jsonRXMsg) { _armStateCallback(client, jsonRXMsg); });
+
+  JsonDocument updateConfigFilter;
+  updateConfigFilter["beepOnRW"] = true;
+  updateConfigFilter["cloneSerial"] = true;
+  _dispatcher.on(MSG_UPDATE_CONFIG, updateConfigFilter, [&](AsyncWebSocketClient* client, JsonDocument& jsonRXMsg) { _updateConfigCallback(client, jsonRXMsg); });
+}
+
+// Handle arming from a client (JSON or MessagePack)
+void WebSite::_armStateCallback(AsyncWebSocketClient* client, JsonDocument& jsonRXMsg) {
+  JsonDocument jsonMsg(_pool.getAllocator());
+  jsonMsg["type"] = "arm_state";
+  jsonMsg["origin"] = client->id();
+  bool write = jsonRXMsg["writeTags"].as<const bool>();
+  bool writeEmpty = jsonRXMsg["writeEmptyTags"].as<const bool>();
+  if (writeEmpty == rfid.getOverwriteEnabled()) {
+    // save persistent option in preferences
+    Preferences preferences;
+    preferences.begin("k2rfid", false);
+    preferences.putBool("overwrite", !writeEmpty);
+    preferences.end();
+  }
+
+  // was spooldata received as well?
+  JsonDocument jsonSpool = jsonRXMsg["spooldata"];
+  if (!jsonSpool.isNull()) {
+    try {
+      rfid.setSpooldata(jsonSpool);
+      jsonMsg["spooldata"] = jsonSpool;
+    } catch (...) {
+      // don't try to write in case of errors
+      write = false;
+      LOGE(TAG, "ERROR while parsing send spooldata");
+    }
+  } else {
+    // don't try to write without spooldatat
+    write = false;
+  }
+
+  // configure programmer
+  // - the reader applies commands in order, the spooldata is in place before the arming
+  // - announced first, the reader's STATE_CHANGED must not be taken for arming from elsewhere
+  _announcedArmed = write;
+  _announcedOverwrite = !writeEmpty;
+  rfid.enableWriting(write, !writeEmpty);
+
+  // log the new state
+  if (write && !writeEmpty) {
+    LOGI(TAG, "writing and re-writing enabled");
+  } else if (write && writeEmpty) {
+    LOGI(TAG, "writing (on empty tags) enabled");
+  } else if (!write && !writeEmpty) {
+    LOGI(TAG, "writing disabled (but overwrite is still set)");
+  } else if (!write && writeEmpty) {
+    LOGI(TAG, "writing disabled");
+  }
+
+  // fill remaining fields of the response and send
+  _invalidateSnapshot();
+  jsonMsg["writeTags"] = write;
+  jsonMsg["writeEmptyTags"] = writeEmpty;
+  _publish(std::move(jsonMsg), true);
+}
+
+// Handle a config change from a client (JSON or MessagePack)
+void WebSite::_updateConfigCallback(AsyncWebSocketClient* client, JsonDocument& jsonRXMsg) {
+  _beepOnRW = jsonRXMsg["beepOnRW"].as<const bool>();
+  rfid.enableBeep(_beepOnRW);
+  _cloneSerial = jsonRXMsg["cloneSerial"].as<const bool>();
+
+  // save persistent options in preferences
+  Preferences preferences;
+  preferences.begin("k2rfid", false);
+  preferences.putBool("beep", _beepOnRW);
+  preferences.putBool("clone", _cloneSerial);
+  preferences.end();
+  _invalidateSnapshot();
+
+  // echo the config message to all connected clients
+  JsonDocument jsonMsg(_pool.getAllocator());
+  jsonMsg["type"] = "update_config";
+  jsonMsg["origin"] = client->id();
+  jsonMsg["beepOnRW"] = _beepOnRW.load();
+#ifdef USE_BEEPER
+  jsonMsg["beepAvailable"] = true;
+#else
+  jsonMsg["beepAvailable"] = false;
+#endif
+  jsonMsg["cloneSerial"] = _cloneSerial.load();
+  _publish(std::move(jsonMsg), true);
+}
+
+// Send ID, config, spooldata, arming,... to a new client
+// - a resuming client only gets the events it has missed, when they are all still recorded
+// - the id is the only per-client part, it goes ahead of the shared snapshot
+void WebSite::_welcome(const WSClient& client) {
+  _pool.countEvent();
+  bool resume = client.resume && client.epoch == _epoch && client.lastSeq <= _seq && client.lastSeq + 1 >= _replayFrom;
+
+  JsonDocument jsonMsg(_pool.getAllocator());
+  jsonMsg["type"] = "client_id";
+  jsonMsg["id"] = client.id;
+  jsonMsg["epoch"] = _epoch;
+  jsonMsg["seq"] = _seq;
+  jsonMsg["resumed"] = resume;
+  _send(client.id, client.binary, _serialize(jsonMsg, client.binary));
+  if (!resume) {
+    _send(client.id, client.binary, _getSnapshot(client.binary));
+    return;
+  }
+
+  // the recorded events are MessagePack
+  _resumed++;
+  for (uint32_t seq = client.lastSeq + 1; seq <= _seq; seq++) {
+    AsyncWebSocketSharedBuffer buffer = _replay[seq % WS_REPLAY_EVENTS].msgPack;
+    if (!client.binary) {
+      JsonDocument replayMsg(_pool.getAllocator());
+      deserializeMsgPack(replayMsg, buffer->data(), buffer->size());
+      buffer = _serialize(replayMsg, false);
+    }
+    _send(client.id, client.binary, buffer);
+    _replayed++;
+  }
+}
+
+// The initial_config message, only rebuilt after config, arming, spooldata or the host has changed
+AsyncWebSocketSharedBuffer WebSite::_getSnapshot(bool binary) {
+  uint32_t version = _snapshotVersion;
+  IPAddress host = espNetwork.getESPConnect()->getIPAddress();
+
+  std::lock_guard<std::mutex> lock(_snapshotMutex);
+  if (_snapshot.version != version || _snapshot.host != host) {
+    _snapshot.version = version;
+    _snapshot.host = host;
+    _snapshot.text.reset();
+    _snapshot.binary.reset();
+  }
+  AsyncWebSocketSharedBuffer& buffer = binary ? _snapshot.binary : _snapshot.text;
+  if (buffer) {
+    _snapshotHits++;
+    return buffer;
+  }
+
+  JsonDocument jsonMsg(_pool.getAllocator());
+  jsonMsg["type"] = "initial_config";
+  jsonMsg["host"] = host.toString().c_str();
+  jsonMsg["cloneSerial"] = _cloneSerial.load();
+#ifdef USE_BEEPER
+  jsonMsg["beepAvailable"] = true;
+  jsonMsg["beepOnRW"] = _beepOnRW.load();
+#else
+  jsonMsg["beepAvailable"] = false;
+  jsonMsg["beepOnRW"] = false;
+#endif
+  jsonMsg["writeTags"] = rfid.getWriteEnabled();
+  jsonMsg["writeEmptyTags"] = !rfid.getOverwriteEnabled();
+  jsonMsg["PN532"] = rfid.getStatus();
+
+  // append spooldata - from RFID - only when length is available
+  JsonDocument jsonSpool = static_cast<JsonDocument>(rfid.getSpooldata());
+  if (jsonSpool["length"].as<const uint32_t>() > 0) {
+    jsonMsg["spooldata"] = jsonSpool;
+  }
+
+  buffer = _serialize(jsonMsg, binary);
+  _snapshotBuilds++;
+  return buffer;
+}
+
+// Serialize a message as JSON text or as MessagePack
+AsyncWebSocketSharedBuffer WebSite::_serialize(const JsonDocument& jsonMsg, bool binary) {
+  uint32_t start = micros();
+  size_t length = binary ? measureMsgPack(jsonMsg) : measureJson(jsonMsg);
+  AsyncWebSocketSharedBuffer buffer = _pool.get(length);
+  if (binary) {
+    serializeMsgPack(jsonMsg, buffer->data(), length);
+  } else {
+    serializeJson(jsonMsg, reinterpret_cast<char*>(buffer->data()), length);
+  }
+  Stats& stats = binary ? _msgPackStats : _jsonStats;
+  stats.serialized++;
+  stats.bytes += length;
+  stats.micros += micros() - start;
+  return buffer;
+}
+
+void WebSite::_send(uint32_t id, bool binary, AsyncWebSocketSharedBuffer buffer) {
+  if (binary) {
+    _ws->binary(id, buffer);
+  } else {
+    _ws->text(id, buffer);
+  }
+}
+
+// Queue a message for all clients, it is numbered and sent with the next flush
+// - a state update replaces a pending one of the same type, only the latest state matters
+void WebSite::_publish(JsonDocument&& jsonMsg, bool coalesce) {
+  std::lock_guard<std::mutex> lock(_pendingMutex);
+  if (coalesce) {
+    const char* type = jsonMsg["type"] | "";
+    auto pending = std::find_if(_pending.begin(), _pending.end(), [&](const Pending& other) {
+      return other.coalesce && strcmp(other.jsonMsg["type"] | "", type) == 0;
+    });
+    if (pending != _pending.end()) {
+      _pending.erase(pending);
+      _coalesced++;
+    }
+  }
+  _pending.push_back({std::move(jsonMsg), coalesce});
+}
+
+// Send what was queued since the last tick (in the loop task only, this keeps the order)
+void WebSite::_flushCallback() {
+  {
+    std::lock_guard<std::mutex> lock(_clientsMutex);
+    _sending = _clients;
+    for (WSClient& client : _clients)
+      client.welcomed = true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    std::swap(_pending, _flushing);
+  }
+
+  // events were skipped while nobody was around, they can't be replayed
+  if (_unrecorded.exchange(false)) {
+    _seq++;
+    _replayFrom = _seq + 1;
+  }
+
+  for (WSClient& client : _sending) {
+    if (!client.welcomed)
+      _welcome(client);
+    _checkBackpressure(client);
+  }
+
+  // serialized at most once per format, MessagePack is always needed for the replay
+  for (Pending& pending : _flushing) {
+    _pool.countEvent();
+    pending.jsonMsg["seq"] = ++_seq;
+    AsyncWebSocketSharedBuffer binary = _serialize(pending.jsonMsg, true);
+    AsyncWebSocketSharedBuffer text;
+    for (WSClient& client : _sending) {
+      if (client.closing)
+        continue;
+      // a slow client gets the latest state once it has caught up
+      if (client.stale && pending.coalesce) {
+        _collapsed++;
+        continue;
+      }
+      if (!client.binary && !text)
+        text = _serialize(pending.jsonMsg, false);
+      _send(client.id, client.binary, client.binary ? binary : text);
+      client.depth++;
+    }
+    _record(_seq, binary);
+  }
+  _flushing.clear();
+
+  // keep the state of the slow clients
+  std::lock_guard<std::mutex> lock(_clientsMutex);
+  for (const WSClient& sent : _sending) {
+    for (WSClient& client : _clients) {
+      if (client.id == sent.id) {
+        client.stale = sent.stale;
+        client.depth = sent.depth;
+        client.highWater = std::max(sent.highWater, sent.depth);
+      }
+    }
+  }
+}
+
+// Apply the slow-client policy by the depth of the client's queue
+// - from WS_CLIENT_SLOW_QUEUE, state updates are held back (and replaced by the latest state later)
+// - from WS_CLIENT_MAX_QUEUE, the client is disconnected (it can resume after reconnecting)
+// - the lock keeps the disconnect handler (and so the library) from deleting the client while it's used
+void WebSite::_checkBackpressure(WSClient& client) {
+  std::lock_guard<std::mutex> lock(_clientsMutex);
+  AsyncWebSocketClient* wsClient = _ws->client(client.id);
+  if (wsClient == nullptr) {
+    client.closing = true;
+    return;
+  }
+  client.depth = wsClient->queueLen();
+  client.highWater = std::max(client.highWater, client.depth);
+  if (client.depth > _queueHighWater)
+    _queueHighWater = client.depth;
+
+  if (client.depth >= WS_CLIENT_MAX_QUEUE) {
+    LOGW(TAG, "Client %d is too slow (%u messages queued), disconnecting", client.id, client.depth);
+    client.closing = true;
+    _slowDisconnects++;
+    wsClient->close();
+  } else if (client.depth >= WS_CLIENT_SLOW_QUEUE) {
+    client.stale = true;
+  } else if (client.stale) {
+    // caught up, all held back state updates collapse into the current state
+    client.stale = false;
+    _send(client.id, client.binary, _getSnapshot(client.binary));
+    client.depth++;
+  }
+}
+
+// Keep an event for clients resuming later
+void WebSite::_record(uint32_t seq, AsyncWebSocketSharedBuffer msgPack) {
+  Recorded& recorded = _replay[seq % WS_REPLAY_EVENTS];
+  if (recorded.msgPack)
+    _replayFrom = max(_replayFrom, recorded.seq + 1);
+  recorded.seq = seq;
+  recorded.msgPack = msgPack;
+}
+
+// false when nobody can get an event, now or when resuming shortly
+bool WebSite::_wantEvents() {
+  {
+    std::lock_guard<std::mutex> lock(_clientsMutex);
+    if (!_clients.empty())
+      return true;
+  }
+  if (millis() - _disconnectTime < WS_REPLAY_WINDOW)
+    return true;
+  _unrecorded = true;
+  return false;
+}
+
+// Add the websocket statistics to the metrics
+void WebSite::reportMetrics(JsonObject metrics) {
+  {
+    std::lock_guard<std::mutex> lock(_clientsMutex);
+    JsonArray clients = metrics["clients"].to<JsonArray>();
+    for (const WSClient& client : _clients) {
+      JsonObject jsonClient = clients.add<JsonObject>();
+      jsonClient["id"] = client.id;
+      jsonClient["format"] = client.binary ? "msgpack" : "json";
+      jsonClient["queued"] = client.depth;
+      jsonClient["queueHighWater"] = client.highWater;
+      jsonClient["stale"] = client.stale;
+    }
+  }
+  metrics["seq"] = _seq;
+  metrics["coalesced"] = _coalesced.load();
+  metrics["resumed"] = _resumed.load();
+  metrics["replayed"] = _replayed.load();
+  metrics["collapsed"] = _collapsed.load();
+  metrics["slowDisconnects"] = _slowDisconnects.load();
+  metrics["queueHighWater"] = _queueHighWater.load();
+  metrics["snapshotBuilds"] = _snapshotBuilds.load();
+  metrics["snapshotHits"] = _snapshotHits.load();
+  _jsonStats.report(metrics["json"].to<JsonObject>());
+  _msgPackStats.report(metrics["msgpack"].to<JsonObject>());
+  _pool.reportMetrics(metrics["heap"].to<JsonObject>());
+  _dispatcher.reportMetrics(metrics["received"].to<JsonObject>());
+}
+
+void WebSite::Stats::report(JsonObject jsonStats) const {
+  uint32_t count = serialized;
+  jsonStats["messages"] = count;
+  jsonStats["bytes"] = bytes.load();
+  jsonStats["avgBytes"] = count ? bytes / count : 0;
+  jsonStats["avgMicros"] = count ? micros / count : 0;
+}
+
 // get StatusRequest object for initializing task
 StatusRequest* WebSite::getStatusRequest() {
   return &_sr;
 }
 
-// Handle spooldata from reader received event
-void WebSite::_tagReadCallback(CFSTag tag) {
-  if (tag.isEmpty()) {
-    JsonDocument jsonMsg;
-    jsonMsg["type"] = "read_tag";
-    jsonMsg["uid"] = static_cast<std::string>(tag.getUid()).c_str();
-    AsyncWebSocketMessageBuffer* buffer = new AsyncWebSocketMessageBuffer(measureJson(jsonMsg));
-    serializeJson(jsonMsg, buffer->get(), buffer->length());
-    if (_ws->count()) {
-      _ws->textAll(buffer);
-    }
-  } else {
-    SpoolData spooldata = tag.getSpooldata();
-    JsonDocument jsonMsg;
-    jsonMsg["type"] = "read_spool";
-    jsonMsg["uid"] = static_cast<std::string>(tag.getUid()).c_str();
-    jsonMsg["spooldata"] = static_cast<JsonDocument>(tag.getSpooldata());
-    AsyncWebSocketMessageBuffer* buffer = new AsyncWebSocketMessageBuffer(measureJson(jsonMsg));
-    serializeJson(jsonMsg, buffer->get(), buffer->length());
-    if (_ws->count()) {
-      _ws->textAll(buffer);
+// Dispatch tag events from the reader
+void WebSite::_tagEventCallback(const TagEvent& event) {
+  if (event.type == TagEvent::Type::READ_DONE) {
+    _tagReadCallback(event.tag);
+  } else if (event.type == TagEvent::Type::WRITE_DONE) {
+    _tagWriteCallback(event.success);
+  } else if (event.type == TagEvent::Type::STATE_CHANGED) {
+    // the reader came up or the arming was applied
+    _invalidateSnapshot();
+
+    // announce arming which wasn't done over the websocket (e.g. by the tag API)
+    if ((event.armed != _announcedArmed || event.overwrite != _announcedOverwrite) && _wantEvents()) {
+      _announcedArmed = event.armed;
+      _announcedOverwrite = event.overwrite;
+      JsonDocument jsonMsg(_pool.getAllocator());
+      jsonMsg["type"] = "arm_state";
+      jsonMsg["origin"] = -1;
+      jsonMsg["writeTags"] = event.armed;
+      jsonMsg["writeEmptyTags"] = !event.overwrite;
+      if (event.armed)
+        jsonMsg["spooldata"] = rfid.getSpooldata();
+      _publish(std::move(jsonMsg), true);
     }
   }
 }
 
+// Handle spooldata from reader received event
+void WebSite::_tagReadCallback(const CFSTag& tag) {
+  if (!_wantEvents())
+    return;
+  JsonDocument jsonMsg(_pool.getAllocator());
+  jsonMsg["type"] = tag.isEmpty() ? "read_tag" : "read_spool";
+  jsonMsg["uid"] = static_cast<std::string>(tag.getUid()).c_str();
+  if (!tag.isEmpty()) {
+    jsonMsg["spooldata"] = tag.getSpooldata();
+  }
+  _publish(std::move(jsonMsg), false);
+}
+
 // Handle spooldata written by reader event
 void WebSite::_tagWriteCallback(bool success) {
-  LOGD(TAG, "Spooldata written %s", success ? "sucessfully" : "unsucessfully");
-  JsonDocument jsonMsg;
+  LOGD_UNLIMITED(TAG, "Spooldata written %s", success ? "sucessfully" : "unsucessfully");
+  if (!_wantEvents())
+    return;
+  JsonDocument jsonMsg(_pool.getAllocator());
   jsonMsg["type"] = "write_spool";
   jsonMsg["result"] = success;
-  AsyncWebSocketMessageBuffer* buffer = new AsyncWebSocketMessageBuffer(measureJson(jsonMsg));
-  serializeJson(jsonMsg, buffer->get(), buffer->length());
-  if (_ws->count()) {
-    _ws->textAll(buffer);
-  }
+  _publish(std::move(jsonMsg), false);
 }
 
 void WebSite::_wsCleanupCallback() {
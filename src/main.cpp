@@ -19,6 +19,20 @@ WebSite webSite(webServer);
 SPIClass rfidSpi(HSPI);
 RFID rfid(rfidSpi);
 LED led;
+TagEventBus tagEventBus;
+Metrics metrics(webServer);
+TagHistory tagHistory(webServer);
+Inventory inventory(webServer);
+MaterialDB materialDB(webServer);
+MaterialSync materialSync(webServer);
+PrinterDiscovery printerDiscovery(webServer);
+TagAPI tagAPI(webServer);
+EventStream eventStream(webServer);
+
+// Rate limit of the log call sites
+#if defined(MYCILA_WEBSERIAL_SUPPORT_APP) || defined(MYCILA_LOGGER_SUPPORT_APP)
+LogRateLimiter logRateLimiter;
+#endif
 
 // Allow logging for K2RFID-app via serial
 #if defined(MYCILA_LOGGER_SUPPORT_APP)
@@ -28,7 +42,11 @@ Mycila::Logger* serialLogger = nullptr;
 // Allow logging for K2RFID-app via webserial
 #if defined(MYCILA_WEBSERIAL_SUPPORT_APP)
 WebSerial webSerial;
+  #ifdef LOG_DEFERRED
+DeferredLog deferredLog;
+  #else
 Mycila::Logger* webLogger = nullptr;
+  #endif
 #endif
 
 void setup() {
@@ -51,6 +69,14 @@ void setup() {
   serialLogger->setLevel(ARDUHAL_LOG_LEVEL_DEBUG);
 #endif
 
+#if defined(MYCILA_WEBSERIAL_SUPPORT_APP) || defined(MYCILA_LOGGER_SUPPORT_APP)
+  // Add LogRateLimiter to Scheduler
+  logRateLimiter.begin(&scheduler);
+#endif
+
+  // Add TagEventBus-Task to Scheduler
+  tagEventBus.begin(&scheduler);
+
   // Add LED-Task to Scheduler
   led.begin(&scheduler);
 
@@ -63,11 +89,35 @@ void setup() {
   // Add WebServerAPI to Scheduler
   webServerAPI.begin(&scheduler);
 
+  // Add MaterialDB to Scheduler
+  materialDB.begin(&scheduler);
+
+  // Add MaterialSync to Scheduler
+  materialSync.begin(&scheduler);
+
+  // Add PrinterDiscovery to Scheduler
+  printerDiscovery.begin(&scheduler);
+
   // Add WebSite to Scheduler
   webSite.begin(&scheduler);
 
   // Add RFID to Scheduler
   rfid.begin(&scheduler);
+
+  // Add Metrics to Scheduler
+  metrics.begin(&scheduler);
+
+  // Add TagHistory to Scheduler
+  tagHistory.begin(&scheduler);
+
+  // Add Inventory to Scheduler
+  inventory.begin(&scheduler);
+
+  // Add TagAPI to Scheduler
+  tagAPI.begin(&scheduler);
+
+  // Add EventStream to Scheduler
+  eventStream.begin(&scheduler);
 }
 
 void loop() {
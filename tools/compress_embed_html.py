@@ -1,5 +1,7 @@
 import gzip
+import hashlib
 import os
+import re
 import sys
 import subprocess
 
@@ -8,18 +10,40 @@ Import("env") # pyright: ignore [reportUndefinedVariable]
 os.makedirs(".pio/embed", exist_ok=True)
 html_files = [f for f in os.listdir('assets/embed_html/') if f.endswith('.html')]
 
+# content hashes of the assets on the filesystem, referenced as /<asset>?v=<hash> by the pages
+asset_hashes = {}
+for folder in ['assets/data/', 'assets/data_css/']:
+    for asset in os.listdir(folder):
+        if os.path.isfile(folder + asset):
+            with open(folder + asset, 'rb') as assetFile:
+                asset_hashes[asset] = hashlib.sha256(assetFile.read()).hexdigest()[:8]
+assets_hash = hashlib.sha256(str(sorted(asset_hashes.items())).encode()).hexdigest()[:8]
+
 for filename in html_files:
     skip = False
-    # comment out next four lines to always rebuild
+    # comment out next six lines to always rebuild
     if os.path.isfile('.pio/embed/' + filename + '.timestamp'):
         with open('.pio/embed/' + filename + '.timestamp', 'r', -1, 'utf-8') as timestampFile:
             if os.path.getmtime('assets/embed_html/' + filename) == float(timestampFile.readline()):
-                skip = True
+                # the assets have to be unchanged as well
+                if timestampFile.readline().strip() == assets_hash:
+                    skip = True
 
     if skip:
         sys.stderr.write(f"compress_embed_html.py: {filename}.gz already available\n")
         continue
 
+    # add the content hash to links of assets (these can be cached forever)
+    with open('assets/embed_html/' + filename, 'r', -1, 'utf-8') as htmlFile:
+        html = htmlFile.read()
+    html = re.sub(
+        r'((?:href|src)=")/([^"?#/]+)"',
+        lambda m: f'{m.group(1)}/{m.group(2)}?v={asset_hashes[m.group(2)]}"' if m.group(2) in asset_hashes else m.group(0),
+        html,
+    )
+    with open('.pio/embed/' + filename + '.src', 'w', -1, 'utf-8') as stagedFile:
+        stagedFile.write(html)
+
     # use html-minifier-terser to reduce size of html/js/css
     # you need to install html-minifier-terser first:
     #   npm install html-minifier-terser -g
@@ -39,7 +63,7 @@ for filename in html_files:
             "--remove-tag-whitespace",
             "--collapse-whitespace",
             "--conservative-collapse",
-            f"assets/embed_html/{filename}",
+            f".pio/embed/{filename}.src",
             "-o",
             f".pio/embed/{filename}",
         ]
@@ -60,7 +84,7 @@ for filename in html_files:
     #         "--remove-tag-whitespace",
     #         "--collapse-whitespace",
     #         "--conservative-collapse",
-    #         f"assets/embed_html/{filename}",
+    #         f".pio/embed/{filename}.src",
     #         "-o",
     #         f".pio/embed/{filename}",
     #     ]
@@ -76,7 +100,21 @@ for filename in html_files:
 
     # Delete temporary minified html
     os.remove(".pio/embed/" + filename)
+    os.remove(".pio/embed/" + filename + ".src")
 
     # remember timestamp of last change
     with open('.pio/embed/' + filename + '.timestamp', 'w', -1, 'utf-8') as timestampFile:
-        timestampFile.write(str(os.path.getmtime('assets/embed_html/' + filename)))
+        timestampFile.write(str(os.path.getmtime('assets/embed_html/' + filename)) + '\n' + assets_hash)
+
+# strong ETags of the embedded pages, e.g. __EMBED_ETAG_WEBSITE__ for website.html.gz
+etagFile = os.path.join(env.subst("$BUILD_DIR"), "__embed_etags.c") # pyright: ignore [reportUndefinedVariable]
+os.makedirs(os.path.dirname(etagFile), exist_ok=True)
+with open(etagFile, "w") as f:
+    for filename in html_files:
+        with open(".pio/embed/" + filename + ".gz", "rb") as gzFile:
+            etag = hashlib.sha256(gzFile.read()).hexdigest()[:16]
+        name = os.path.splitext(filename)[0].upper().replace("-", "_")
+        f.write(f'const char* __EMBED_ETAG_{name}__ = "\\"{etag}\\"";\n')
+        sys.stderr.write(f"compress_embed_html.py: ETag of {filename}.gz: {etag}\n")
+
+env.AppendUnique(PIOBUILDFILES=[etagFile]) # pyright: ignore [reportUndefinedVariable]
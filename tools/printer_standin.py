@@ -0,0 +1,85 @@
+# Stand-in for the printer's webserver, for testing the database sync and the discovery
+#
+#   python tools/printer_standin.py [--port 80] [--database assets/data/material_database.json]
+#
+# then sync from the website, or with:
+#   curl -F ip=<this host> http://<K2RFID>/api/sync && curl http://<K2RFID>/api/sync
+
+import argparse
+import hashlib
+import json
+import os
+import sys
+import time
+from email.utils import formatdate
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def make_handler(args):
+    class PrinterHandler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.0"
+
+        def do_GET(self):
+            if self.path == "/info":
+                self._send(200, "application/json", json.dumps({"model": args.model, "hostname": "K2Plus-standin"}).encode())
+            elif self.path == "/downloads/defData/material_database.json":
+                self._database()
+            else:
+                self._send(404, "text/plain", b"Not found")
+
+        def _database(self):
+            # read on every request, so the database can be edited while running
+            with open(args.database, "rb") as databaseFile:
+                database = databaseFile.read()
+            etag = '"' + hashlib.sha1(database).hexdigest()[:16] + '"'
+            modified = formatdate(os.path.getmtime(args.database), usegmt=True)
+            if not args.no_validators and self.headers.get("If-None-Match") == etag:
+                self.send_response(304)
+                self.send_header("ETag", etag)
+                self.end_headers()
+                return
+
+            self.send_response(200)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(database)))
+            if not args.no_validators:
+                self.send_header("ETag", etag)
+                self.send_header("Last-Modified", modified)
+            self.end_headers()
+            # send in pieces like a slow printer would
+            for offset in range(0, len(database), args.chunk):
+                self.wfile.write(database[offset : offset + args.chunk])
+                self.wfile.flush()
+                if args.delay:
+                    time.sleep(args.delay / 1000)
+
+        def _send(self, code, contentType, body):
+            self.send_response(code)
+            self.send_header("Content-Type", contentType)
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+    return PrinterHandler
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Stand-in for the webserver of a K2 Plus")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--database", default="assets/data/material_database.json")
+    parser.add_argument("--model", default="F008", help="model reported by /info")
+    parser.add_argument("--chunk", type=int, default=1460, help="bytes per write of the database")
+    parser.add_argument("--delay", type=int, default=0, help="delay between writes (ms)")
+    parser.add_argument("--no-validators", action="store_true", help="don't send ETag and Last-Modified")
+    args = parser.parse_args()
+
+    server = ThreadingHTTPServer(("", args.port), make_handler(args))
+    sys.stderr.write(f"printer_standin.py: serving {args.database} on port {args.port}\n")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()